@@ -29,12 +29,15 @@
    Please read the accompanying README and LICENSE files.
 ---------------------------------------------------------------------- */
 
+#include <algorithm>
+#include <stdint.h>
 #include "stdio.h"
 #include "string.h"
 #include "stdlib.h"
 #include "atom.h"
 
-#define DELTA 20000
+#define NMIN 300000
+#define SORTBITS 10
 
 Atom::Atom()
 {
@@ -44,6 +47,7 @@ Atom::Atom()
   nmax = 0;
 
   x = v = f = vold = NULL;
+  mass = 1.0;
 
   comm_size = 3;
   reverse_size = 3;
@@ -51,6 +55,8 @@ Atom::Atom()
 
   threads_per_atom = 1;
   use_tex = 0;
+  host_modified = 1;
+  sort_curve = 0;
 }
 
 Atom::~Atom()
@@ -63,48 +69,48 @@ Atom::~Atom()
   }
 }
 
+/* the arena grows the four arrays in place or moves their pages,
+   by ARENA_GROW at least, nmax becomes whatever they hold now */
+
 void Atom::growarray()
 {
-  int nold = nmax;
-  cMCLData<MMD_float3, xx> *temp_x, *temp_v, *temp_f, *temp_vold;
-  if(nmax==0) nmax=300000;
-  else {
-    temp_x = d_x;
-    temp_v = d_v;
-    temp_f = d_f;
-    temp_vold = d_vold;
+  if(nmax==0) {
+    d_x = new cMCLData<MMD_float3,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_INPUT | MCL_ARG_DYNAMIC, NMIN,0,0);
+    d_v = new cMCLData<MMD_float3,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_INPUT | MCL_ARG_DYNAMIC, NMIN,0,0);
+    d_f = new cMCLData<MMD_float3,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, NMIN,0,0);
+    d_vold = new cMCLData<MMD_float3,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, NMIN,0,0);
+  } else {
+    d_x->resize(nmax + 1);
+    d_v->resize(nmax + 1);
+    d_f->resize(nmax + 1);
+    d_vold->resize(nmax + 1);
   }
-  
-  nmax += DELTA;
-  d_x = new cMCLData<MMD_float3,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_INPUT | MCL_ARG_DYNAMIC, nmax,0,0);
-  d_v = new cMCLData<MMD_float3,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_INPUT | MCL_ARG_DYNAMIC, nmax,0,0);
-  d_f = new cMCLData<MMD_float3,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nmax,0,0);
-  d_vold = new cMCLData<MMD_float3,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nmax,0,0);
+  nmax = d_x->getDim()[0];
 
   x = d_x->hostData();
   v = d_v->hostData();
   f = d_f->hostData();
   vold = d_vold->hostData();
 
-  if(nold > 0) {
-    memcpy(x, temp_x->hostData(), nold * sizeof(MMD_float3));
-    memcpy(v, temp_v->hostData(), nold * sizeof(MMD_float3));
-    memcpy(f, temp_f->hostData(), nold * sizeof(MMD_float3));
-    memcpy(vold, temp_vold->hostData(), nold * sizeof(MMD_float3));
-
-    mcl_unregister_buffer(temp_x->devData());
-    mcl_unregister_buffer(temp_v->devData());
-    mcl_unregister_buffer(temp_f->devData());
-    mcl_unregister_buffer(temp_vold->devData());
-    delete temp_x, temp_v, temp_f, temp_vold;
-  }
-
-
   if (x == NULL || v == NULL || f == NULL || vold == NULL) {
     printf("ERROR: No memory for atoms\n");
   }
 }
 
+/* growarray() while x and v are only current on the device:
+   pull them back first, the new buffers upload them on their first use */
+
+void Atom::grow_device()
+{
+  mcl_handle* hdl = mcl->LaunchKernel("comm_kernel.h", "atom_sync", 1, 0, NULL, 3,
+    d_x->devData(), d_x->devSize(), d_x->mclFlags() | MCL_ARG_OUTPUT,
+    d_v->devData(), d_v->devSize(), d_v->mclFlags() | MCL_ARG_OUTPUT,
+    &nmax, sizeof(nmax), MCL_ARG_SCALAR);
+  mcl_wait(hdl);
+  mcl_hdl_free(hdl);
+  growarray();
+}
+
 void Atom::addatom(MMD_float x_in, MMD_float y_in, MMD_float z_in, 
 		   MMD_float vx_in, MMD_float vy_in, MMD_float vz_in)
 {
@@ -261,6 +267,106 @@ int Atom::skip_exchange(MMD_float *buf)
   return 6;
 }
 
+/* space-filling curve over the box extended by margin (the ghost region),
+   SORTBITS cells per dimension */
+
+void Atom::sort_setup(MMD_float margin)
+{
+  sort_lo[0] = box.xlo - margin;
+  sort_lo[1] = box.ylo - margin;
+  sort_lo[2] = box.zlo - margin;
+  sort_inv[0] = (1 << SORTBITS) / (box.xhi - box.xlo + 2 * margin);
+  sort_inv[1] = (1 << SORTBITS) / (box.yhi - box.ylo + 2 * margin);
+  sort_inv[2] = (1 << SORTBITS) / (box.zhi - box.zlo + 2 * margin);
+}
+
+/* Morton or Hilbert index of a position, the Hilbert transform is the
+   one of J. Skilling, "Programming the Hilbert curve" (2004) */
+
+unsigned int Atom::sort_key(MMD_float xs, MMD_float ys, MMD_float zs)
+{
+  const unsigned int top = (1 << SORTBITS) - 1;
+  MMD_float c[3] = {xs, ys, zs};
+  unsigned int X[3];
+  int i, b;
+
+  for (i = 0; i < 3; i++) {
+    MMD_float cell = (c[i] - sort_lo[i]) * sort_inv[i];
+    X[i] = cell < 0 ? 0 : (cell > top ? top : static_cast<unsigned int>(cell));
+  }
+
+  if (sort_curve == 2) {
+    unsigned int P, Q, t;
+    for (Q = 1 << (SORTBITS - 1); Q > 1; Q >>= 1) {
+      P = Q - 1;
+      for (i = 0; i < 3; i++)
+        if (X[i] & Q) X[0] ^= P;
+        else {
+          t = (X[0] ^ X[i]) & P;
+          X[0] ^= t;
+          X[i] ^= t;
+        }
+    }
+    for (i = 1; i < 3; i++) X[i] ^= X[i-1];
+    t = 0;
+    for (Q = 1 << (SORTBITS - 1); Q > 1; Q >>= 1)
+      if (X[2] & Q) t ^= Q - 1;
+    for (i = 0; i < 3; i++) X[i] ^= t;
+  }
+
+  unsigned int key = 0;
+  for (b = SORTBITS - 1; b >= 0; b--)
+    for (i = 0; i < 3; i++)
+      key = (key << 1) | ((X[i] >> b) & 1);
+  return key;
+}
+
+/* reorder the owned atoms along the curve
+   called between exchange and borders, so the send lists are built
+   from the new order */
+
+void Atom::sort()
+{
+  int i;
+  uint64_t *order = new uint64_t[nlocal];
+  MMD_float3 *tmp = new MMD_float3[nlocal];
+
+  for (i = 0; i < nlocal; i++)
+    order[i] = (static_cast<uint64_t>(sort_key(x[i].x, x[i].y, x[i].z)) << 32) | i;
+  std::sort(order, order + nlocal);
+
+  MMD_float3 *arrays[4] = {x, v, f, vold};
+  for (int a = 0; a < 4; a++) {
+    MMD_float3 *array = arrays[a];
+    for (i = 0; i < nlocal; i++) tmp[i] = array[order[i] & 0xffffffff];
+    memcpy(array, tmp, nlocal * sizeof(MMD_float3));
+  }
+
+  delete[] tmp;
+  delete[] order;
+}
+
+/* order a border send list along the curve of the receiving partition,
+   the ghosts of a swap then arrive in bin order */
+
+void Atom::sort_list(int *list, int n, int *pbc_flags, Atom &recv)
+{
+  int i;
+  uint64_t *order = new uint64_t[n];
+
+  for (i = 0; i < n; i++) {
+    int j = list[i];
+    MMD_float xs = x[j].x + pbc_flags[1]*box.xprd;
+    MMD_float ys = x[j].y + pbc_flags[2]*box.yprd;
+    MMD_float zs = x[j].z + pbc_flags[3]*box.zprd;
+    order[i] = (static_cast<uint64_t>(recv.sort_key(xs, ys, zs)) << 32) | j;
+  }
+  std::sort(order, order + n);
+  for (i = 0; i < n; i++) list[i] = order[i] & 0xffffffff;
+
+  delete[] order;
+}
+
 /* realloc a 2-d MMD_float array */
 
 MMD_float **Atom::realloc_2d_MMD_float_array(MMD_float **array, 
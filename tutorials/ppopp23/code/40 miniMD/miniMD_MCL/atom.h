@@ -60,19 +60,29 @@ class Atom {
   cMCLData<MMD_float3, xx>* d_vold;
   MCLWrapper* mcl;
   int threads_per_atom;
+  int host_modified;                // host x/v newer than the device copies
+  int sort_curve;                   // reorder atoms: 0 off, 1 Morton, 2 Hilbert
 
   int comm_size,reverse_size,border_size;
 
   struct Box box;
+  MMD_float sort_lo[3];             // grid of the space-filling curve
+  MMD_float sort_inv[3];
 
   Atom();
   ~Atom();
   void addatom(MMD_float, MMD_float, MMD_float, MMD_float, MMD_float, MMD_float);
   void pbc();
   void growarray();
+  void grow_device();
 
   void copy(int, int);
 
+  void sort_setup(MMD_float);
+  unsigned int sort_key(MMD_float, MMD_float, MMD_float);
+  void sort();
+  void sort_list(int *, int, int *, Atom &);
+
   void pack_comm(int, int *, MMD_float *, int *);
   void unpack_comm(int, int, MMD_float *);
   void pack_reverse(int, int, MMD_float *);
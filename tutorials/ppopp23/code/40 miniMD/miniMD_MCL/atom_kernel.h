@@ -30,51 +30,172 @@
 ---------------------------------------------------------------------- */
 
 #include "precision.h"
+#include "kernel_params.h"
 //#define MMD_floatK3 float3;
 //#define MMD_float float;
 
-__kernel void atom_pack_comm(__global MMD_floatK3* x, __global MMD_float* buf, __global int* list, int offset, MMD_floatK3 pbc, int n)
+__kernel void atom_pack_comm(__global MMD_floatK3* x, __global MMD_float* buf, __global int* list, struct CommParams p)
 {
-	  list += offset;
+	  list += p.offset;
 	  int j = get_global_id(0);
-	  if(j<n)
+	  if(j<p.n)
 	  {
 		  int i=list[j];
 		  MMD_floatK3 xi=x[i];
-		  xi+=pbc;
+		  xi+=p.pbc;
 		  buf[3*j]=xi.x;
 		  buf[3*j+1]=xi.y;
 		  buf[3*j+2]=xi.z;
 	  }
 }
 
-__kernel void atom_unpack_comm(__global MMD_floatK3* x, __global MMD_float* buf, int first, int n)
+__kernel void atom_unpack_comm(__global MMD_floatK3* x, __global MMD_float* buf, struct CommParams p)
 {
 	  int i = get_global_id(0);
-	  if(i<n)
+	  if(i<p.n)
 	  {
 		  MMD_floatK3 xi;
 		  xi.x=buf[3*i];
 		  xi.y=buf[3*i+1];
 		  xi.z=buf[3*i+2];
-		  x[i+first]=xi;
+		  x[i+p.first]=xi;
 
 	  }
 
 }
 
-__kernel void atom_comm_self(__global MMD_floatK3* x, __global int* list, int offset, MMD_floatK3 pbc, int first, int n)
+__kernel void atom_comm_self(__global MMD_floatK3* x, __global int* list, struct CommParams p)
 {
-	  list += offset;
+	  list += p.offset;
 	  int j = get_global_id(0);
-	  if(j<n)
+	  if(j<p.n)
 	  {
 		  int i=list[j];
-		  x[j+first] = x[i];
-		  x[j+first] += pbc;
+		  x[j+p.first] = x[i];
+		  x[j+p.first] += p.pbc;
 
 	  }
 
 
 }
 
+/* pack and unpack in one pass: read the owner's positions through its
+   send list and write them straight into the receiver's ghost slots,
+   only used when both partitions live on the same device */
+
+__kernel void atom_gather_comm(__global MMD_floatK3* x, __global const MMD_floatK3* xs, __global int* list, struct CommParams p)
+{
+	  list += p.offset;
+	  int j = get_global_id(0);
+	  if(j<p.n)
+	  {
+		  x[j+p.first] = xs[list[j]] + p.pbc;
+	  }
+}
+
+/* all swaps of a stage: threads [0,n[0]) do the first, the rest the second
+   pack fills the send buffers of the owner, unpack runs on the receiver
+   and also copies its self swaps */
+
+__kernel void atom_pack_batch(__global MMD_floatK3* x, __global MMD_float* buf0, __global MMD_float* buf1, __global int* list, struct CommBatchParams p)
+{
+	  int j = get_global_id(0);
+	  int s = 0;
+	  if(j>=p.n[0]) { j-=p.n[0]; s=1; }
+	  if(j<p.n[s] && p.mode[s]==1)
+	  {
+		  MMD_floatK3 xi=x[list[p.offset[s]+j]]+p.pbc[s];
+		  __global MMD_float* buf = s ? buf1 : buf0;
+		  buf[3*j]=xi.x;
+		  buf[3*j+1]=xi.y;
+		  buf[3*j+2]=xi.z;
+	  }
+}
+
+__kernel void atom_unpack_batch(__global MMD_floatK3* x, __global MMD_float* buf0, __global MMD_float* buf1, __global int* list, struct CommBatchParams p)
+{
+	  int j = get_global_id(0);
+	  int s = 0;
+	  if(j>=p.n[0]) { j-=p.n[0]; s=1; }
+	  if(j<p.n[s])
+	  {
+		  if(p.mode[s]==1)
+		  {
+			  __global MMD_float* buf = s ? buf1 : buf0;
+			  MMD_floatK3 xi;
+			  xi.x=buf[3*j];
+			  xi.y=buf[3*j+1];
+			  xi.z=buf[3*j+2];
+			  x[j+p.first[s]]=xi;
+		  }
+		  else if(p.mode[s]==2)
+			  x[j+p.first[s]]=x[list[p.offset[s]+j]]+p.pbc[s];
+	  }
+}
+
+/* reverse communication: fold the forces of ghost atoms back into
+   the atoms they are images of */
+
+__kernel void atom_pack_reverse(__global MMD_floatK3* f, __global MMD_float* buf, struct CommParams p)
+{
+	  int i = get_global_id(0);
+	  if(i<p.n)
+	  {
+		  MMD_floatK3 fi=f[i+p.first];
+		  buf[3*i]=fi.x;
+		  buf[3*i+1]=fi.y;
+		  buf[3*i+2]=fi.z;
+	  }
+}
+
+__kernel void atom_unpack_reverse(__global MMD_floatK3* f, __global MMD_float* buf, __global int* list, struct CommParams p)
+{
+	  list += p.offset;
+	  int j = get_global_id(0);
+	  if(j<p.n)
+	  {
+		  int i=list[j];
+		  MMD_floatK3 fj;
+		  fj.x=buf[3*j];
+		  fj.y=buf[3*j+1];
+		  fj.z=buf[3*j+2];
+		  f[i]+=fj;
+	  }
+}
+
+__kernel void atom_reverse_self(__global MMD_floatK3* f, __global int* list, struct CommParams p)
+{
+	  list += p.offset;
+	  int j = get_global_id(0);
+	  if(j<p.n)
+	  {
+		  int i=list[j];
+		  f[i] += f[j+p.first];
+	  }
+}
+
+/* forward communication of one value per atom, e.g. the EAM embedding
+   derivative, along the send lists of the position communication */
+
+__kernel void atom_pack_scalar(__global MMD_float* q, __global MMD_float* buf, __global int* list, struct CommParams p)
+{
+	  list += p.offset;
+	  int j = get_global_id(0);
+	  if(j<p.n)
+		  buf[j]=q[list[j]];
+}
+
+__kernel void atom_unpack_scalar(__global MMD_float* q, __global MMD_float* buf, struct CommParams p)
+{
+	  int i = get_global_id(0);
+	  if(i<p.n)
+		  q[i+p.first]=buf[i];
+}
+
+__kernel void atom_scalar_self(__global MMD_float* q, __global int* list, struct CommParams p)
+{
+	  list += p.offset;
+	  int j = get_global_id(0);
+	  if(j<p.n)
+		  q[j+p.first]=q[list[j]];
+}
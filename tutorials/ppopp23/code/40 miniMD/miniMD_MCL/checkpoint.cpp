@@ -0,0 +1,275 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#include "stdio.h"
+#include "stdlib.h"
+#include <cstring>
+#include "checkpoint.h"
+#include "integrate.h"
+
+Checkpoint::Checkpoint()
+{
+  every = 0;
+  file = "miniMD.ckpt";
+  next = 0;
+}
+
+Checkpoint::~Checkpoint()
+{
+  finish();
+}
+
+/* snapshots are due at the multiples of every, also after a restart */
+
+void Checkpoint::setup(int first)
+{
+  next = first - first % every + every;
+}
+
+/* copy the state into image on this thread, the atoms move on right after,
+   and hand it to the writer once the previous snapshot is on disk */
+
+void Checkpoint::save(int step, Atom atom[], Neighbor neighbor[], Comm &comm, Integrate &integrate, int nparts)
+{
+  finish();
+
+  CheckpointHeader h;
+  memset(&h, 0, sizeof(h));
+  strncpy(h.magic, CKPT_MAGIC, sizeof(h.magic));
+  h.version = CKPT_VERSION;
+  h.float_size = sizeof(MMD_float);
+  h.step = step;
+  h.nparts = nparts;
+  h.natoms = atom[0].natoms;
+  h.nbuild = integrate.nbuild;
+  h.nbalance = integrate.nbalance;
+  h.nbin[0] = neighbor[0].nbinx;
+  h.nbin[1] = neighbor[0].nbiny;
+  h.nbin[2] = neighbor[0].nbinz;
+  h.nx = in.nx;
+  h.ny = in.ny;
+  h.nz = in.nz;
+  h.units = in.units;
+  h.forcetype = in.forcetype;
+  h.neigh_every = in.neigh_every;
+  h.thermo_nstat = in.thermo_nstat;
+  h.t_request = in.t_request;
+  h.rho = in.rho;
+  h.dt = in.dt;
+  h.force_cut = in.force_cut;
+  h.neigh_cut = in.neigh_cut;
+  for (int idim = 0; idim < 3; idim++) {
+    h.procgrid[idim] = comm.procgrid[idim];
+    h.prd[idim] = comm.prd[idim];
+  }
+
+  size_t bytes = sizeof(h);
+  for (int idim = 0; idim < 3; idim++)
+    bytes += (h.procgrid[idim] + 1) * sizeof(MMD_float);
+  for (int j = 0; j < nparts; j++)
+    bytes += sizeof(int) + 2 * atom[j].nlocal * sizeof(MMD_float3);
+  image.resize(bytes);
+
+  char* p = &image[0];
+  memcpy(p, &h, sizeof(h));
+  p += sizeof(h);
+  for (int idim = 0; idim < 3; idim++) {
+    memcpy(p, comm.cut[idim], (h.procgrid[idim] + 1) * sizeof(MMD_float));
+    p += (h.procgrid[idim] + 1) * sizeof(MMD_float);
+  }
+  for (int j = 0; j < nparts; j++) {
+    memcpy(p, &atom[j].nlocal, sizeof(int));
+    p += sizeof(int);
+    memcpy(p, atom[j].x, atom[j].nlocal * sizeof(MMD_float3));
+    p += atom[j].nlocal * sizeof(MMD_float3);
+    memcpy(p, atom[j].v, atom[j].nlocal * sizeof(MMD_float3));
+    p += atom[j].nlocal * sizeof(MMD_float3);
+  }
+
+  next = step - step % every + every;
+  writer = std::thread(write, &image, file);
+}
+
+/* wait for the snapshot in flight */
+
+void Checkpoint::finish()
+{
+  if (writer.joinable()) writer.join();
+}
+
+void Checkpoint::write(std::vector<char>* image, const char* file)
+{
+  char tmp[1024];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+
+  FILE* fp = fopen(tmp, "wb");
+  if (fp == NULL) {
+    printf("# Checkpoint: cannot open %s, snapshot skipped\n", tmp);
+    return;
+  }
+  size_t n = fwrite(&(*image)[0], 1, image->size(), fp);
+  if (fclose(fp) != 0 || n != image->size()) {
+    printf("# Checkpoint: writing %s failed, snapshot skipped\n", tmp);
+    remove(tmp);
+    return;
+  }
+  if (rename(tmp, file) != 0)
+    printf("# Checkpoint: cannot rename %s to %s\n", tmp, file);
+}
+
+/* read a snapshot and take over its input parameters, the step count
+   of the run stays the one given; returns 1 on error */
+
+int Checkpoint::load(const char* name, In &in_out, int nparts)
+{
+  FILE* fp = fopen(name, "rb");
+  if (fp == NULL) {
+    printf("ERROR: cannot open restart file %s\n", name);
+    return 1;
+  }
+  fseek(fp, 0, SEEK_END);
+  long bytes = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (bytes < (long) sizeof(CheckpointHeader)) {
+    printf("ERROR: %s is not a miniMD checkpoint\n", name);
+    fclose(fp);
+    return 1;
+  }
+  image.resize(bytes);
+  size_t n = fread(&image[0], 1, bytes, fp);
+  fclose(fp);
+
+  CheckpointHeader h;
+  memcpy(&h, &image[0], sizeof(h));
+  if (n != (size_t) bytes || strncmp(h.magic, CKPT_MAGIC, sizeof(h.magic)) || h.version != CKPT_VERSION) {
+    printf("ERROR: %s is not a miniMD checkpoint\n", name);
+    return 1;
+  }
+  if (h.float_size != (int) sizeof(MMD_float)) {
+    printf("ERROR: %s was written with %i byte floats, this build uses %i\n", name, h.float_size, (int) sizeof(MMD_float));
+    return 1;
+  }
+  if (h.nparts != nparts) {
+    printf("ERROR: %s holds %i partitions, run it with -np %i\n", name, h.nparts, h.nparts);
+    return 1;
+  }
+
+  /* walk the layout written by save, restore reads it unchecked */
+  size_t expect = sizeof(h);
+  for (int idim = 0; idim < 3; idim++) {
+    if (h.procgrid[idim] < 1 || h.procgrid[idim] > nparts) {
+      printf("ERROR: %s is corrupt\n", name);
+      return 1;
+    }
+    expect += (h.procgrid[idim] + 1) * sizeof(MMD_float);
+  }
+  long natoms = 0;
+  for (int j = 0; j < nparts; j++) {
+    int nlocal;
+    if (expect + sizeof(int) > (size_t) bytes) break;
+    memcpy(&nlocal, &image[expect], sizeof(int));
+    expect += sizeof(int);
+    if (nlocal < 0 || nlocal > h.natoms) {
+      expect = bytes + 1;
+      break;
+    }
+    expect += 2 * (size_t) nlocal * sizeof(MMD_float3);
+    natoms += nlocal;
+  }
+  if (expect != (size_t) bytes || natoms != h.natoms) {
+    printf("ERROR: %s is truncated or corrupt\n", name);
+    return 1;
+  }
+
+  in_out.nx = h.nx;
+  in_out.ny = h.ny;
+  in_out.nz = h.nz;
+  in_out.units = h.units;
+  in_out.forcetype = (ForceStyle) h.forcetype;
+  in_out.neigh_every = h.neigh_every;
+  in_out.thermo_nstat = h.thermo_nstat;
+  in_out.t_request = h.t_request;
+  in_out.rho = h.rho;
+  in_out.dt = h.dt;
+  in_out.force_cut = h.force_cut;
+  in_out.neigh_cut = h.neigh_cut;
+  return 0;
+}
+
+/* after Comm::setup, before the neighbor setup: cut planes, bin grid,
+   owned atoms and counters of the loaded snapshot, the image is released */
+
+void Checkpoint::restore(Atom atom[], Neighbor neighbor[], Comm &comm, Integrate &integrate, int nparts)
+{
+  CheckpointHeader h;
+  memcpy(&h, &image[0], sizeof(h));
+  const char* p = &image[0] + sizeof(h);
+
+  /* the grid follows from nparts and the box, so it matches unless
+     the partitioning code changed; the cuts are kept uniform then */
+  int same = 1;
+  for (int idim = 0; idim < 3; idim++)
+    if (h.procgrid[idim] != comm.procgrid[idim]) same = 0;
+  std::vector<MMD_float> planes[3];
+  for (int idim = 0; idim < 3; idim++) {
+    planes[idim].resize(h.procgrid[idim] + 1);
+    memcpy(&planes[idim][0], p, (h.procgrid[idim] + 1) * sizeof(MMD_float));
+    p += (h.procgrid[idim] + 1) * sizeof(MMD_float);
+  }
+  if (same)
+    comm.set_cuts(&planes[0][0], &planes[1][0], &planes[2][0], atom);
+  else
+    printf("# Restart: partition grid %i %i %i differs, cut planes reset\n", h.procgrid[0], h.procgrid[1], h.procgrid[2]);
+
+  /* the image has no alignment guarantees for MMD_float3 */
+  for (int j = 0; j < nparts; j++) {
+    neighbor[j].nbinx = h.nbin[0];
+    neighbor[j].nbiny = h.nbin[1];
+    neighbor[j].nbinz = h.nbin[2];
+    int nlocal;
+    memcpy(&nlocal, p, sizeof(int));
+    p += sizeof(int);
+    atom[j].natoms = h.natoms;
+    atom[j].nlocal = 0;
+    for (int i = 0; i < nlocal; i++) {
+      MMD_float3 x, v;
+      memcpy(&x, p + i * sizeof(MMD_float3), sizeof(MMD_float3));
+      memcpy(&v, p + (nlocal + i) * sizeof(MMD_float3), sizeof(MMD_float3));
+      atom[j].addatom(x.x, x.y, x.z, v.x, v.y, v.z);
+    }
+    p += 2 * nlocal * sizeof(MMD_float3);
+  }
+
+  integrate.first = h.step;
+  integrate.nbuild = h.nbuild;
+  integrate.nbalance = h.nbalance;
+  std::vector<char>().swap(image);
+}
@@ -0,0 +1,98 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+#include <thread>
+#include "ljs.h"
+#include "atom.h"
+#include "neighbor.h"
+#include "comm.h"
+#include "precision.h"
+
+class Integrate;
+
+/* binary snapshot of a run, taken at the end of a reneighboring step:
+   input parameters, box, cut planes, bin grid, the step and reneighboring counters
+   and x/v of the owned atoms of every partition in their current order.
+   Setup then reproduces the ghosts, lists and forces of that step exactly,
+   so a restart continues bit-identically. The image is copied on the
+   calling thread and written by a background thread to <file>.tmp, which
+   is renamed over <file> once complete */
+
+#define CKPT_MAGIC "MMDCKPT"
+#define CKPT_VERSION 1
+
+struct CheckpointHeader {
+  char magic[8];
+  int version;
+  int float_size;                  // sizeof(MMD_float) of the writer
+  int step;
+  int nparts;
+  int natoms;
+  int nbuild, nbalance;            // reneighboring counters of Integrate
+  int procgrid[3];
+  int nbin[3];                     // neighbor bin grid, the list order depends on it
+  int nx, ny, nz;
+  int units, forcetype;
+  int neigh_every, thermo_nstat;
+  MMD_float t_request, rho, dt;
+  MMD_float force_cut, neigh_cut;
+  MMD_float prd[3];
+};
+
+class Checkpoint {
+ public:
+  int every;                       // write one every this many steps, 0: off
+  const char* file;
+  In in;                           // input parameters as given, before potential setup
+
+  Checkpoint();
+  ~Checkpoint();
+  void setup(int first);
+  int due(int step) {return every > 0 && step >= next;};
+  void save(int step, Atom[], Neighbor[], Comm &, Integrate &, int nparts);
+  void finish();
+
+  int load(const char* file, In &, int nparts);
+  void restore(Atom[], Neighbor[], Comm &, Integrate &, int nparts);
+
+ private:
+  int next;                        // first step the next snapshot is due at
+  std::vector<char> image;         // snapshot being written, or the one loaded
+  std::thread writer;
+
+  static void write(std::vector<char>* image, const char* file);
+};
+
+#endif
@@ -0,0 +1,280 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+/* cluster pair path for SIMD CPUs (Neighbor::cluster)
+   the atoms of a bin are split into clusters of CLUSTER consecutive bin
+   entries, cluster ci covers entries (ci%cpb)*CLUSTER.. of bin ci/cpb.
+   The pair list holds cluster ids, forces are computed as CLUSTER x CLUSTER
+   tiles with the i-cluster in one vector register per coordinate. */
+
+#include "precision.h"
+#include "kernel_params.h"
+
+#ifndef CLUSTER
+#define CLUSTER 4
+#endif
+
+#if MDPREC == 2
+#if CLUSTER == 8
+typedef double8 MMD_floatCL;
+#else
+typedef double4 MMD_floatCL;
+#endif
+#else
+#if CLUSTER == 8
+typedef float8 MMD_floatCL;
+#else
+typedef float4 MMD_floatCL;
+#endif
+#endif
+
+#if CLUSTER == 8
+#define VLOAD(p) vload8(0, p)
+#define VSTORE(v, p) vstore8(v, 0, p)
+#else
+#define VLOAD(p) vload4(0, p)
+#define VSTORE(v, p) vstore4(v, 0, p)
+#endif
+
+/* padding lanes of an i-cluster sit here, out of range of everything */
+#define CLUSTER_FAR 1.0e10f
+
+inline void cluster_bbox(__global MMD_floatK3* x, __global int* bins, int first, int n, int nlocal,
+		MMD_floatK3* lo, MMD_floatK3* hi, int* owned)
+{
+	MMD_floatK3 xl = x[bins[first]];
+	*lo = xl;
+	*hi = xl;
+	*owned = bins[first] < nlocal;
+	for(int l = 1; l < n; l++)
+	{
+		int i = bins[first+l];
+		xl = x[i];
+		lo->x = xl.x < lo->x ? xl.x : lo->x;
+		lo->y = xl.y < lo->y ? xl.y : lo->y;
+		lo->z = xl.z < lo->z ? xl.z : lo->z;
+		hi->x = xl.x > hi->x ? xl.x : hi->x;
+		hi->y = xl.y > hi->y ? xl.y : hi->y;
+		hi->z = xl.z > hi->z ? xl.z : hi->z;
+		if(i < nlocal) *owned = 1;
+	}
+}
+
+inline MMD_float gap(MMD_float lo, MMD_float hi, MMD_float jlo, MMD_float jhi)
+{
+	MMD_float d = jlo - hi;
+	if(lo - jhi > d) d = lo - jhi;
+	return d > 0 ? d : 0;
+}
+
+/* atom indices (-1 for padding) and coordinates of the lanes of cluster ci */
+
+inline void cluster_load(__global MMD_floatK3* x, __global int* bincount, __global int* bins, int ci,
+		struct ClusterParams p, int* ia, MMD_float* tx, MMD_float* ty, MMD_float* tz)
+{
+	int ib = ci / p.cpb;
+	int c0 = (ci % p.cpb) * CLUSTER;
+	int cnt = min(bincount[ib], p.atoms_per_bin) - c0;
+	for(int l = 0; l < CLUSTER; l++)
+	{
+		ia[l] = l < cnt ? bins[ib*p.atoms_per_bin + c0 + l] : -1;
+		if(ia[l] >= 0)
+		{
+			MMD_floatK3 xl = x[ia[l]];
+			tx[l] = xl.x;
+			ty[l] = xl.y;
+			tz[l] = xl.z;
+		}
+		else tx[l] = ty[l] = tz[l] = CLUSTER_FAR;
+	}
+}
+
+/* cluster pairs whose bounding boxes are within the neighbor cutoff,
+   transposed like the atom lists, clusters without owned atoms get none */
+
+__kernel void cluster_pairs(__global MMD_floatK3* x, __global int* bincount, __global int* bins,
+		__global int* stencil, __global int* ncpairs, __global int* cpairs, __global int* flag,
+		int nstencil, struct ClusterParams p)
+{
+	int ci = get_global_id(0);
+	if(ci >= p.nclusters) return;
+	int ib = ci / p.cpb;
+	int c0 = (ci % p.cpb) * CLUSTER;
+	int cnt = min(bincount[ib], p.atoms_per_bin) - c0;
+
+	MMD_floatK3 lo, hi, jlo, jhi;
+	int owned = 0;
+	if(cnt > 0)
+		cluster_bbox(x, bins, ib*p.atoms_per_bin + c0, min(cnt, CLUSTER), p.nlocal, &lo, &hi, &owned);
+	if(!owned)
+	{
+		ncpairs[ci] = 0;
+		return;
+	}
+
+	int n = 0;
+	for(int k = 0; k < nstencil; k++)
+	{
+		int jb = ib + stencil[k];
+		int jn = min(bincount[jb], p.atoms_per_bin);
+		for(int c = 0; c*CLUSTER < jn; c++)
+		{
+			int jowned;
+			cluster_bbox(x, bins, jb*p.atoms_per_bin + c*CLUSTER, min(jn - c*CLUSTER, CLUSTER), p.nlocal, &jlo, &jhi, &jowned);
+			MMD_float dx = gap(lo.x, hi.x, jlo.x, jhi.x);
+			MMD_float dy = gap(lo.y, hi.y, jlo.y, jhi.y);
+			MMD_float dz = gap(lo.z, hi.z, jlo.z, jhi.z);
+			if(dx*dx + dy*dy + dz*dz <= p.cutneighsq)
+			{
+				if(n < p.maxpairs) cpairs[n*p.nclusters + ci] = jb*p.cpb + c;
+				n++;
+			}
+		}
+	}
+	ncpairs[ci] = n;
+	if(n > p.maxpairs) flag[0] = 1;
+}
+
+/* one work item per i-cluster, the j-cluster atoms are broadcast one at a
+   time against the whole i-cluster vector; the self pair has rsq == 0 */
+
+__kernel void force_cluster(__global MMD_floatK3* x, __global MMD_floatK3* f, __global int* bincount, __global int* bins,
+		__global int* ncpairs, __global int* cpairs, struct ClusterParams p)
+{
+	int ci = get_global_id(0);
+	if(ci >= p.nclusters) return;
+	int n = min(ncpairs[ci], p.maxpairs);
+	if(n == 0) return;
+
+	int ia[CLUSTER];
+	MMD_float tx[CLUSTER], ty[CLUSTER], tz[CLUSTER];
+	cluster_load(x, bincount, bins, ci, p, ia, tx, ty, tz);
+	MMD_floatCL xi = VLOAD(tx);
+	MMD_floatCL yi = VLOAD(ty);
+	MMD_floatCL zi = VLOAD(tz);
+	MMD_floatCL zero = (MMD_floatCL)((MMD_float)0);
+	MMD_floatCL fx = zero, fy = zero, fz = zero;
+
+	for(int k = 0; k < n; k++)
+	{
+		int cj = cpairs[k*p.nclusters + ci];
+		int jb = cj / p.cpb;
+		int jfirst = jb*p.atoms_per_bin + (cj % p.cpb)*CLUSTER;
+		int jcnt = min(min(bincount[jb], p.atoms_per_bin) - (cj % p.cpb)*CLUSTER, CLUSTER);
+		for(int l = 0; l < jcnt; l++)
+		{
+			MMD_floatK3 xj = x[bins[jfirst+l]];
+			MMD_floatCL dx = xi - xj.x;
+			MMD_floatCL dy = yi - xj.y;
+			MMD_floatCL dz = zi - xj.z;
+			MMD_floatCL rsq = dx*dx + dy*dy + dz*dz;
+			MMD_floatCL sr2 = select(zero, (MMD_floatCL)((MMD_float)1)/rsq, (rsq < p.cutforcesq) & (rsq > (MMD_float)0));
+			MMD_floatCL sr6 = sr2*sr2*sr2;
+			MMD_floatCL force = (MMD_float)48*sr6*(sr6-(MMD_float)0.5)*sr2;
+			fx += force*dx;
+			fy += force*dy;
+			fz += force*dz;
+		}
+	}
+
+	VSTORE(fx, tx);
+	VSTORE(fy, ty);
+	VSTORE(fz, tz);
+	for(int l = 0; l < CLUSTER; l++)
+	{
+		if(ia[l] < 0 || ia[l] >= p.nlocal) continue;
+		MMD_floatK3 fl;
+		fl.x = tx[l];
+		fl.y = ty[l];
+		fl.z = tz[l];
+		f[ia[l]] = fl;
+	}
+}
+
+/* thermo counterpart of force_cluster, per block sums of energy and virial
+   over the owned atoms, reduced like energy_virial */
+
+__kernel void energy_cluster(__global MMD_floatK3* x, __global int* bincount, __global int* bins,
+		__global int* ncpairs, __global int* cpairs, __global MMD_accK2* sum, __local MMD_accK2* temp,
+		struct ClusterParams p)
+{
+	int ci = get_global_id(0);
+	int tid = get_local_id(0);
+	temp[tid] = (MMD_accK2)(0.0f, 0.0f);
+
+	int n = ci < p.nclusters ? min(ncpairs[ci], p.maxpairs) : 0;
+	if(n > 0)
+	{
+		int ia[CLUSTER];
+		MMD_float tx[CLUSTER], ty[CLUSTER], tz[CLUSTER];
+		cluster_load(x, bincount, bins, ci, p, ia, tx, ty, tz);
+		MMD_floatCL xi = VLOAD(tx);
+		MMD_floatCL yi = VLOAD(ty);
+		MMD_floatCL zi = VLOAD(tz);
+		MMD_floatCL zero = (MMD_floatCL)((MMD_float)0);
+		MMD_floatCL e = zero, w = zero;
+
+		for(int k = 0; k < n; k++)
+		{
+			int cj = cpairs[k*p.nclusters + ci];
+			int jb = cj / p.cpb;
+			int jfirst = jb*p.atoms_per_bin + (cj % p.cpb)*CLUSTER;
+			int jcnt = min(min(bincount[jb], p.atoms_per_bin) - (cj % p.cpb)*CLUSTER, CLUSTER);
+			for(int l = 0; l < jcnt; l++)
+			{
+				MMD_floatK3 xj = x[bins[jfirst+l]];
+				MMD_floatCL dx = xi - xj.x;
+				MMD_floatCL dy = yi - xj.y;
+				MMD_floatCL dz = zi - xj.z;
+				MMD_floatCL rsq = dx*dx + dy*dy + dz*dz;
+				MMD_floatCL sr2 = select(zero, (MMD_floatCL)((MMD_float)1)/rsq, (rsq < p.cutforcesq) & (rsq > (MMD_float)0));
+				MMD_floatCL sr6 = sr2*sr2*sr2;
+				e += (MMD_float)4*sr6*(sr6-(MMD_float)1);
+				w += rsq*(MMD_float)48*sr6*(sr6-(MMD_float)0.5)*sr2;
+			}
+		}
+
+		VSTORE(e, tx);
+		VSTORE(w, ty);
+		MMD_accK2 ei = (MMD_accK2)(0.0f, 0.0f);
+		for(int l = 0; l < CLUSTER; l++)
+			if(ia[l] >= 0 && ia[l] < p.nlocal)
+				ei += (MMD_accK2)(tx[l], ty[l]);
+		temp[tid] = ei;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int s = get_local_size(0)/2; s > 0; s = s>>1) {
+		if(tid < s) temp[tid] += temp[tid + s];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if(tid == 0) sum[get_group_id(0)] = temp[0];
+}
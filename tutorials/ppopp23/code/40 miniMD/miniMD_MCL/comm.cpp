@@ -31,6 +31,7 @@
 
 #include <algorithm>
 #include <iterator>
+#include <vector>
 #include "stdio.h"
 #include "stdlib.h"
 #include "comm.h"
@@ -40,6 +41,8 @@
 #define BUFEXTRA 100
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define BALANCE_BINS 64
+#define BALANCE_TOL 1.05
 
 
 void Comm::get_my_loc(int my_loc[], int id){
@@ -62,6 +65,16 @@ int Comm::neighbor(int my_loc[], int dim, int dir){
 Comm::Comm()
 {
   maxsend = NULL;
+  use_fused = 0;
+  use_gather = 0;
+  use_batch = 0;
+  nhdls = 0;
+  nfused = 0;
+  device_exchange = 0;
+  lists_on_device = 0;
+  balance_every = 0;
+  imbalance = 1.0;
+  cut[0] = cut[1] = cut[2] = NULL;
 
 }
 
@@ -74,14 +87,11 @@ Comm::~Comm()
 int Comm::setup(MMD_float cutneigh, Atom atom[], int nparts)
 {
   int i;
-  int periods[3];
-  MMD_float prd[3];
-  int myloc[3];
-  double lo,hi;
-  int ineed,idim,nbox;
-  
+  int idim;
+
   npatitions = nparts;
   
+  this->cutneigh = cutneigh;
   prd[0] = atom[0].box.xprd;
   prd[1] = atom[0].box.yprd;
   prd[2] = atom[0].box.zprd;
@@ -133,16 +143,14 @@ int Comm::setup(MMD_float cutneigh, Atom atom[], int nparts)
   /* determine where I am and my neighboring procs in 3d grid of procs */
   /* lo/hi = my local box bounds */
 
-  for(i = 0; i < nparts; i++){
-    get_my_loc(myloc, i);
-    atom[i].box.xlo = myloc[0] * prd[0] / procgrid[0];
-    atom[i].box.xhi = (myloc[0]+1) * prd[0] / procgrid[0];
-    atom[i].box.ylo = myloc[1] * prd[1] / procgrid[1];
-    atom[i].box.yhi = (myloc[1]+1) * prd[1] / procgrid[1];
-    atom[i].box.zlo = myloc[2] * prd[2] / procgrid[2];
-    atom[i].box.zhi = (myloc[2]+1) * prd[2] / procgrid[2];
+  /* cut planes of the grid, uniform until the first balance */
+
+  for (idim = 0; idim < 3; idim++) {
+    cut[idim] = (MMD_float *) malloc((procgrid[idim]+1)*sizeof(MMD_float));
+    for (i = 0; i <= procgrid[idim]; i++)
+      cut[idim][i] = i * prd[idim] / procgrid[idim];
   }
-  
+
 
   /* need = # of boxes I need atoms from in each dimension */
 
@@ -162,6 +170,34 @@ int Comm::setup(MMD_float cutneigh, Atom atom[], int nparts)
   pbc_flagy = (int *) malloc(nparts*maxswap*sizeof(int));
   pbc_flagz = (int *) malloc(nparts*maxswap*sizeof(int));
   recvproc = (int *) malloc(nparts*maxswap*sizeof(int));
+  sendproc = (int *) malloc(nparts*maxswap*sizeof(int));
+
+  k_pack = mcl->Kernel("atom_kernel.h", "atom_pack_comm");
+  k_unpack = mcl->Kernel("atom_kernel.h", "atom_unpack_comm");
+  k_self = mcl->Kernel("atom_kernel.h", "atom_comm_self");
+  k_gather = mcl->Kernel("atom_kernel.h", "atom_gather_comm");
+  k_pack_batch = mcl->Kernel("atom_kernel.h", "atom_pack_batch");
+  k_unpack_batch = mcl->Kernel("atom_kernel.h", "atom_unpack_batch");
+  k_pack_reverse = mcl->Kernel("atom_kernel.h", "atom_pack_reverse");
+  k_unpack_reverse = mcl->Kernel("atom_kernel.h", "atom_unpack_reverse");
+  k_reverse_self = mcl->Kernel("atom_kernel.h", "atom_reverse_self");
+  k_pack_scalar = mcl->Kernel("atom_kernel.h", "atom_pack_scalar");
+  k_unpack_scalar = mcl->Kernel("atom_kernel.h", "atom_unpack_scalar");
+  k_scalar_self = mcl->Kernel("atom_kernel.h", "atom_scalar_self");
+  k_pbc = mcl->Kernel("comm_kernel.h", "atom_pbc");
+  k_scan_blocks = mcl->Kernel("comm_kernel.h", "comm_scan_blocks");
+  k_scan_sums = mcl->Kernel("comm_kernel.h", "comm_scan_sums");
+  k_scan_fixup = mcl->Kernel("comm_kernel.h", "comm_scan_fixup");
+  k_exchange_mark = mcl->Kernel("comm_kernel.h", "exchange_mark");
+  k_exchange_pack = mcl->Kernel("comm_kernel.h", "exchange_pack");
+  k_exchange_fill = mcl->Kernel("comm_kernel.h", "exchange_fill");
+  k_recv_mark = mcl->Kernel("comm_kernel.h", "exchange_recv_mark");
+  k_exchange_unpack = mcl->Kernel("comm_kernel.h", "exchange_unpack");
+  k_border_mark = mcl->Kernel("comm_kernel.h", "border_mark");
+  k_border_pack = mcl->Kernel("comm_kernel.h", "border_pack");
+  k_border_unpack = mcl->Kernel("comm_kernel.h", "border_unpack");
+  k_fuse_clear = mcl->Kernel("comm_kernel.h", "fuse_clear");
+  k_fuse_slots = mcl->Kernel("comm_kernel.h", "fuse_slots");
 
   sendnum = (int *) malloc(nparts*maxswap*sizeof(int));
   recvnum = (int *) malloc(nparts*maxswap*sizeof(int));
@@ -179,8 +215,62 @@ int Comm::setup(MMD_float cutneigh, Atom atom[], int nparts)
   }
   maxsendlist = (int *) malloc(nparts*maxswap*sizeof(int));
   for (i = 0; i < nparts*maxswap; i++) maxsendlist[i] = BUFMIN;
+
+  d_fuseslot = (cMCLData<int, xx>**)malloc(sizeof(cMCLData<int, xx>*) * npatitions);
+  maxfuseslot = (int *) malloc(npatitions*sizeof(int));
+  for(int j = 0; j < npatitions; j++){
+    d_fuseslot[j] = NULL;
+    maxfuseslot[j] = 0;
+  }
+
+  d_scanflag = (cMCLData<int, xx>**)malloc(sizeof(cMCLData<int, xx>*) * npatitions);
+  d_scanpos = (cMCLData<int, xx>**)malloc(sizeof(cMCLData<int, xx>*) * npatitions);
+  d_holes = (cMCLData<int, xx>**)malloc(sizeof(cMCLData<int, xx>*) * npatitions);
+  d_scanblock = (cMCLData<int, xx>**)malloc(sizeof(cMCLData<int, xx>*) * npatitions);
+  d_counts = (cMCLData<int, xx>**)malloc(sizeof(cMCLData<int, xx>*) * npatitions);
+  maxscan = (int *) malloc(npatitions*sizeof(int));
+  chain = (mcl_handle **) malloc(npatitions*sizeof(mcl_handle*));
+  for(int j = 0; j < npatitions; j++){
+    d_scanflag[j] = d_scanpos[j] = d_holes[j] = d_scanblock[j] = NULL;
+    chain[j] = NULL;
+    maxscan[j] = 0;
+    d_counts[j] = new cMCLData<int, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_OUTPUT, 2, 0, 0);
+  }
   
 
+  temp_buffers = new cMCLData<MMD_float, xx>**[nparts];
+  maxsend = new int[nparts];
+  set_bounds(atom);
+  for(i = 0; i < nparts; i++){
+    maxsend[i] = BUFMIN;
+    temp_buffers[i] = new cMCLData<MMD_float, xx>*[nswap];
+    for(int j = 0; j < nswap; j++)
+      temp_buffers[i][j] = new cMCLData<MMD_float, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, maxsend[i], 0, 0);
+  }
+
+  return 0;
+}
+
+/* box bounds of all partitions and the slabs they send at each swap,
+   recomputed from the cut planes whenever the grid is balanced */
+
+void Comm::set_bounds(Atom atom[])
+{
+  int i;
+  int myloc[3];
+  double lo,hi;
+  int ineed,idim,nbox;
+
+  for(i = 0; i < npatitions; i++){
+    get_my_loc(myloc, i);
+    atom[i].box.xlo = cut[0][myloc[0]];
+    atom[i].box.xhi = cut[0][myloc[0]+1];
+    atom[i].box.ylo = cut[1][myloc[1]];
+    atom[i].box.yhi = cut[1][myloc[1]+1];
+    atom[i].box.zlo = cut[2][myloc[2]];
+    atom[i].box.zhi = cut[2][myloc[2]+1];
+  }
+
   /* setup 4 parameters for each exchange: (spart,rpart,slablo,slabhi)
      recvproc(nswap) = proc to recv from at each swap
      slablo/slabhi(nswap) = slab boundaries (in correct dimension) of atoms
@@ -194,10 +284,7 @@ int Comm::setup(MMD_float cutneigh, Atom atom[], int nparts)
                           =  1 -> add box-length to position when sending
                           = -1 -> subtract box-length from pos when sending */
 
-  temp_buffers = new cMCLData<MMD_float, xx>**[nparts];
-  maxsend = new int[nparts];
-  for(i = 0; i < nparts; i++){
-    maxsend[i] = BUFMIN;
+  for(i = 0; i < npatitions; i++){
     get_my_loc(myloc, i);
 
     nswap = 0;
@@ -210,13 +297,14 @@ int Comm::setup(MMD_float cutneigh, Atom atom[], int nparts)
 
         if (ineed % 2 == 0) {
           recvproc[(i*maxswap) + nswap] = neighbor(myloc, idim, 1);
+          sendproc[(i*maxswap) + nswap] = neighbor(myloc, idim, -1);
 
           nbox = myloc[idim] + ineed/2;
-          lo = nbox * prd[idim] / procgrid[idim];
+          lo = plane(idim, nbox);
           if (idim == 0) hi = atom[i].box.xlo + cutneigh;
           if (idim == 1) hi = atom[i].box.ylo + cutneigh;
           if (idim == 2) hi = atom[i].box.zlo + cutneigh;
-          hi = MIN(hi,(nbox+1) * prd[idim] / procgrid[idim]);
+          hi = MIN(hi,plane(idim, nbox+1));
           if (myloc[idim] == 0) {
             pbc_any[(i*maxswap) + nswap] = 1;
             if (idim == 0) pbc_flagx[(i*maxswap) + nswap] = 1;
@@ -225,13 +313,14 @@ int Comm::setup(MMD_float cutneigh, Atom atom[], int nparts)
           }
         } else {
           recvproc[(i*maxswap) + nswap] = neighbor(myloc, idim, -1);
-          
+          sendproc[(i*maxswap) + nswap] = neighbor(myloc, idim, 1);
+
           nbox = myloc[idim] - ineed/2;
-          hi = (nbox+1) * prd[idim] / procgrid[idim];
+          hi = plane(idim, nbox+1);
           if (idim == 0) lo = atom[i].box.xhi - cutneigh;
           if (idim == 1) lo = atom[i].box.yhi - cutneigh;
           if (idim == 2) lo = atom[i].box.zhi - cutneigh;
-          lo = MAX(lo,nbox * prd[idim] / procgrid[idim]);
+          lo = MAX(lo,plane(idim, nbox));
           if (myloc[idim] == procgrid[idim]-1) {
             pbc_any[(i*maxswap) + nswap] = 1;
             if (idim == 0) pbc_flagx[(i*maxswap) + nswap] = -1;
@@ -245,14 +334,108 @@ int Comm::setup(MMD_float cutneigh, Atom atom[], int nparts)
         nswap++;
       }
     }
-    temp_buffers[i] = new cMCLData<MMD_float, xx>*[nswap];
-    for(int j = 0; j < nswap; j++)
-      temp_buffers[i][j] = new cMCLData<MMD_float, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, maxsend[i], 0, 0);
   }
+}
+
+/* position of cut plane k of a dimension, planes outside the grid
+   are the periodic images of the ones inside */
+
+MMD_float Comm::plane(int idim, int k)
+{
+  MMD_float shift = 0.0;
+  while (k < 0) {
+    k += procgrid[idim];
+    shift -= prd[idim];
+  }
+  while (k > procgrid[idim]) {
+    k -= procgrid[idim];
+    shift += prd[idim];
+  }
+  return cut[idim][k] + shift;
+}
 
+/* shift the cut planes of the grid so every slice of a dimension owns
+   the same number of atoms, the grid topology and swap pattern stay as
+   they are, so the ghost exchange is unchanged
+   a plane never moves past its old neighbors, so exchange() only has to
+   move atoms one partition, and no slice gets thinner than cutneigh/need,
+   so the need[] swaps still cover the ghost cutoff
+   returns 1 if the bounds changed, the caller rebuilds bins and sort grid */
 
+int Comm::balance(Atom atom[])
+{
+  int i,j,k,idim,nbin,natoms,nmax;
 
-  return 0;
+  natoms = nmax = 0;
+  for(j = 0; j < npatitions; j++){
+    natoms += atom[j].nlocal;
+    nmax = MAX(nmax, atom[j].nlocal);
+  }
+  imbalance = natoms ? (MMD_float) nmax * npatitions / natoms : 1.0;
+  if (imbalance < BALANCE_TOL) return 0;
+
+  for (idim = 0; idim < 3; idim++) {
+    int ngrid = procgrid[idim];
+    if (ngrid == 1) continue;
+
+    /* histogram of the atom coordinates in this dimension */
+
+    nbin = BALANCE_BINS * ngrid;
+    std::vector<double> hist(nbin+1, 0.0);
+    for(j = 0; j < npatitions; j++){
+      MMD_float3* x = atom[j].x;
+      for (i = 0; i < atom[j].nlocal; i++) {
+        MMD_float xdim = idim == 0 ? x[i].x : (idim == 1 ? x[i].y : x[i].z);
+        int ibin = static_cast<int>(xdim * nbin / prd[idim]);
+        hist[MIN(MAX(ibin,0),nbin-1)+1] += 1.0;
+      }
+    }
+    for (i = 0; i < nbin; i++) hist[i+1] += hist[i];
+
+    /* new plane k sits where the cumulative count reaches k/ngrid of the atoms,
+       interpolated inside the bin, then clamped by the old planes and width */
+
+    MMD_float minwidth = cutneigh / need[idim];
+    MMD_float binwidth = prd[idim] / nbin;
+    std::vector<MMD_float> shifted(cut[idim], cut[idim] + ngrid + 1);
+    int ibin = 0;
+    for (k = 1; k < ngrid; k++) {
+      double target = hist[nbin] * k / ngrid;
+      while (ibin < nbin-1 && hist[ibin+1] < target) ibin++;
+      double count = hist[ibin+1] - hist[ibin];
+      MMD_float pos = binwidth * (ibin + (count > 0.0 ? (target - hist[ibin]) / count : 0.5));
+      MMD_float lo = MAX(shifted[k-1], cut[idim][k-1]) + minwidth;
+      MMD_float hi = cut[idim][k+1] - minwidth;
+      shifted[k] = MIN(MAX(pos,lo),hi);
+    }
+    std::copy(shifted.begin(), shifted.end(), cut[idim]);
+  }
+
+  set_bounds(atom);
+  return 1;
+}
+
+/* partition whose box holds a point inside the global box */
+
+int Comm::owner(MMD_float x, MMD_float y, MMD_float z)
+{
+  MMD_float c[3] = {x, y, z};
+  int loc[3];
+  for (int idim = 0; idim < 3; idim++) {
+    MMD_float* hi = std::upper_bound(cut[idim] + 1, cut[idim] + procgrid[idim], c[idim]);
+    loc[idim] = hi - cut[idim] - 1;
+  }
+  return (loc[0] * procgrid[1] + loc[1]) * procgrid[2] + loc[2];
+}
+
+/* take over cut planes saved by a checkpoint of the same grid */
+
+void Comm::set_cuts(const MMD_float* cx, const MMD_float* cy, const MMD_float* cz, Atom atom[])
+{
+  std::copy(cx, cx + procgrid[0] + 1, cut[0]);
+  std::copy(cy, cy + procgrid[1] + 1, cut[1]);
+  std::copy(cz, cz + procgrid[2] + 1, cut[2]);
+  set_bounds(atom);
 }
 
 /* communication of atom info every timestep */
@@ -262,9 +445,26 @@ mcl_handle** Comm::communicate(Atom atom[], int i, mcl_handle** waitlist)
   int partition, iswap;
   int pbc_flags[4];
   MMD_float *buf;
+  if (use_batch) return communicate_batch(atom, i, waitlist);
+
   mcl_handle** hdls = new mcl_handle*[npatitions * nswap];
   mcl_handle** hdls_2 = new mcl_handle*[npatitions * nswap];
-  uint64_t rewrite = i == 0 ? MCL_ARG_REWRITE : 0;
+  uint64_t rewrite = (i == 0 && !lists_on_device) ? MCL_ARG_REWRITE : 0;
+  nhdls = nswap;
+
+  /* swaps between partitions provably on one device skip the send buffer,
+     the receiver gathers them, gathered[] is indexed by the owner; every
+     other swap keeps the pack/unpack path */
+  std::vector<char> gathered(npatitions * maxswap, 0);
+  if (use_gather) {
+    for(partition = 0; partition < npatitions; partition++)
+      for (iswap = nfused; iswap < nswap; iswap++) {
+        int recv = recvproc[(partition * maxswap) + iswap];
+        if (recv != partition && mcl->SameDevice(partition, recv))
+          gathered[(recv * maxswap) + iswap] = 1;
+      }
+  }
+
   //fprintf(stderr, "Starting communicate..."); 
   for(partition = 0; partition < npatitions; partition++){
     for (iswap = 0; iswap < nswap; iswap++) {
@@ -285,50 +485,89 @@ mcl_handle** Comm::communicate(Atom atom[], int i, mcl_handle** waitlist)
       /* exchange with another proc
         if self, set recv buffer to send buffer */
 
+      /* already packed by integrate_pack, the integrate handle stands in */
+      if (iswap < nfused) {
+        hdls[(partition * maxswap) + iswap] = waitlist[partition];
+        continue;
+      }
+      if (gathered[(partition * maxswap) + iswap]) {
+        hdls[(partition * maxswap) + iswap] = NULL;
+        continue;
+      }
+
+      CommParams p;
+      p.pbc = pbc;
+      p.offset = offset;
+      p.first = firstrecv[(partition * maxswap) + iswap];
+      p.n = sendnum[(partition * maxswap) + iswap];
+      p.pad = 0;
+
       if (recvproc[(partition * maxswap) + iswap] != partition) {
-        hdls[(partition * maxswap) + iswap] = mcl->LaunchKernel("atom_kernel.h", "atom_pack_comm", sendnum[(partition * maxswap) + iswap], 1, &waitlist[partition], 6,
+        hdls[(partition * maxswap) + iswap] = mcl->LaunchKernel(k_pack, p.n, 1, &waitlist[partition], &p, sizeof(p), 3,
             atom[partition].d_x->devData(),atom[partition].d_x->devSize(),atom[partition].d_x->mclFlags(),
             temp_buffers[partition][iswap]->devData(),temp_buffers[partition][iswap]->devSize(),temp_buffers[partition][iswap]->mclFlags(),
-            d_sendlist[partition]->devData(),d_sendlist[partition]->devSize(),d_sendlist[partition]->mclFlags() | rewrite,
-            &offset,sizeof(offset), MCL_ARG_SCALAR,
-            &pbc,sizeof(pbc), MCL_ARG_SCALAR, 
-            &sendnum[(partition * maxswap) + iswap],sizeof(sendnum[(partition * maxswap) + iswap]), MCL_ARG_SCALAR
+            d_sendlist[partition]->devData(),d_sendlist[partition]->devSize(),d_sendlist[partition]->mclFlags() | rewrite
         );
       } else {
         //atom[partition].cpu_comm_self(d_sendlist[partition]->devData(), offset, pbc, firstrecv[(partition*maxswap) + iswap], sendnum[(partition*maxswap) + iswap]);
-        hdls[(partition * maxswap) + iswap] = mcl->LaunchKernel("atom_kernel.h", "atom_comm_self", sendnum[(partition * maxswap) + iswap], 1, &waitlist[partition], 6,
+        hdls[(partition * maxswap) + iswap] = mcl->LaunchKernel(k_self, p.n, 1, &waitlist[partition], &p, sizeof(p), 2,
             atom[partition].d_x->devData(),atom[partition].d_x->devSize(),atom[partition].d_x->mclFlags(),
-            d_sendlist[partition]->devData(),d_sendlist[partition]->devSize(),d_sendlist[partition]->mclFlags() | rewrite,
-            &offset,sizeof(offset), MCL_ARG_SCALAR,
-            &pbc,sizeof(pbc), MCL_ARG_SCALAR, 
-            &firstrecv[(partition * maxswap) + iswap],sizeof(firstrecv[(partition * maxswap) + iswap]), MCL_ARG_SCALAR,
-            &sendnum[(partition * maxswap) + iswap],sizeof(sendnum[(partition * maxswap) + iswap]), MCL_ARG_SCALAR);
+            d_sendlist[partition]->devData(),d_sendlist[partition]->devSize(),d_sendlist[partition]->mclFlags() | rewrite);
       }
     }
   }
 
+  /* last handle that wrote x of every partition, a gather of a later swap
+     can read ghosts the owner received in an earlier one */
+  std::vector<mcl_handle*> last(waitlist, waitlist + npatitions);
   for (iswap = 0; iswap < nswap; iswap++) {
+    std::vector<mcl_handle*> prev(last);
     for(partition = 0; partition < npatitions; partition++){
       int recv = recvproc[(partition * maxswap) + iswap];
-      if (recv != partition) {
+      if (gathered[(recv * maxswap) + iswap]) {
+        mcl_handle* wait[2] = {prev[recv], last[partition]};
+        CommParams p;
+        p.pbc.x = atom[recv].box.xprd*pbc_flagx[(recv*maxswap) + iswap];
+        p.pbc.y = atom[recv].box.yprd*pbc_flagy[(recv*maxswap) + iswap];
+        p.pbc.z = atom[recv].box.zprd*pbc_flagz[(recv*maxswap) + iswap];
+        p.offset = iswap * maxsendlist[(recv*maxswap)];
+        p.first = firstrecv[(partition * maxswap) + iswap];
+        p.n = recvnum[(partition * maxswap) + iswap];
+        p.pad = 0;
+        hdls_2[(partition * maxswap) + iswap] = mcl->LaunchKernel(k_gather, p.n, 2, wait, &p, sizeof(p), 3,
+            atom[partition].d_x->devData(),atom[partition].d_x->devSize(),atom[partition].d_x->mclFlags(),
+            atom[recv].d_x->devData(),atom[recv].d_x->devSize(),atom[recv].d_x->mclFlags(),
+            d_sendlist[recv]->devData(),d_sendlist[recv]->devSize(),d_sendlist[recv]->mclFlags() | rewrite
+        );
+      } else if (recv != partition) {
         mcl_handle** wait = &hdls[(recv * maxswap) + iswap];
-        hdls_2[(partition * maxswap) + iswap] =  mcl->LaunchKernel("atom_kernel.h", "atom_unpack_comm", recvnum[(partition * maxswap) + iswap], 1, wait, 4,
+        CommParams p;
+        p.pbc.x = p.pbc.y = p.pbc.z = 0;
+        p.offset = 0;
+        p.first = firstrecv[(partition * maxswap) + iswap];
+        p.n = recvnum[(partition * maxswap) + iswap];
+        p.pad = 0;
+        hdls_2[(partition * maxswap) + iswap] =  mcl->LaunchKernel(k_unpack, p.n, 1, wait, &p, sizeof(p), 2,
             atom[partition].d_x->devData(),atom[partition].d_x->devSize(),atom[partition].d_x->mclFlags(),
-            temp_buffers[recv][iswap]->devData(),temp_buffers[recv][iswap]->devSize(),temp_buffers[recv][iswap]->mclFlags(),
-            &firstrecv[(partition * maxswap) + iswap],sizeof(firstrecv[(partition * maxswap) + iswap]),MCL_ARG_SCALAR,
-            &recvnum[(partition * maxswap) + iswap],sizeof(recvnum[(partition * maxswap) + iswap]),MCL_ARG_SCALAR
+            temp_buffers[recv][iswap]->devData(),temp_buffers[recv][iswap]->devSize(),temp_buffers[recv][iswap]->mclFlags()
         );
       } else {
         hdls_2[(partition * maxswap) + iswap] =  hdls[(recv * maxswap) + iswap];
         hdls[(recv * maxswap) + iswap] = NULL;
       }
+      last[partition] = hdls_2[(partition * maxswap) + iswap];
     }
   }
   for (iswap = 0; iswap < nswap; iswap++) {
     for(partition = 0; partition < npatitions; partition++) {
+      if (iswap < nfused) {
+        if (recvproc[(partition * maxswap) + iswap] != partition)
+          mcl->Retire(hdls_2[(partition * maxswap) + iswap]);
+        continue;
+      }
       if(hdls[(partition * maxswap) + iswap])
-        to_free.push_back(hdls[(partition * maxswap) + iswap]);
-      to_free.push_back(hdls_2[(partition * maxswap) + iswap]);  
+        mcl->Retire(hdls[(partition * maxswap) + iswap]);
+      mcl->Retire(hdls_2[(partition * maxswap) + iswap]);
     }
   }
   //fprintf(stderr, "done.\n");
@@ -337,12 +576,262 @@ mcl_handle** Comm::communicate(Atom atom[], int i, mcl_handle** waitlist)
   return hdls_2;
 }
 
+/* communicate with one pack launch per owner and one unpack launch per
+   receiver for every stage, the two swaps of a dimension and hop
+   a stage packs atoms the partition received in earlier stages, so it
+   waits on the partition's previous unpack; every receiver ends with a
+   single handle that covers all of its ghosts */
+
+mcl_handle** Comm::communicate_batch(Atom atom[], int i, mcl_handle** waitlist)
+{
+  int partition, first, s;
+  mcl_handle** hdls = new mcl_handle*[npatitions * maxswap];
+  std::vector<mcl_handle*> last(waitlist, waitlist + npatitions);
+  std::vector<mcl_handle*> packed(npatitions);
+  uint64_t rewrite = (i == 0 && !lists_on_device) ? MCL_ARG_REWRITE : 0;
+
+  for (first = 0; first < nswap; first += STAGE_SWAPS) {
+    /* the stage of the leading swaps is already packed by integrate_pack */
+    int fused = first < nfused;
+
+    for(partition = 0; partition < npatitions; partition++){
+      packed[partition] = fused ? waitlist[partition] : NULL;
+      if (fused) continue;
+
+      CommBatchParams p;
+      for (s = 0; s < STAGE_SWAPS; s++) {
+        int idx = (partition * maxswap) + first + s;
+        p.pbc[s].x = atom[partition].box.xprd*pbc_flagx[idx];
+        p.pbc[s].y = atom[partition].box.yprd*pbc_flagy[idx];
+        p.pbc[s].z = atom[partition].box.zprd*pbc_flagz[idx];
+        p.offset[s] = (first + s) * maxsendlist[(partition*maxswap)];
+        p.first[s] = 0;
+        p.mode[s] = recvproc[idx] != partition;
+        p.n[s] = p.mode[s] ? sendnum[idx] : 0;
+      }
+      if (p.n[0] + p.n[1] == 0) continue;
+      packed[partition] = mcl->LaunchKernel(k_pack_batch, p.n[0] + p.n[1], 1, &last[partition], &p, sizeof(p), 4,
+          atom[partition].d_x->devData(),atom[partition].d_x->devSize(),atom[partition].d_x->mclFlags(),
+          temp_buffers[partition][first]->devData(),temp_buffers[partition][first]->devSize(),temp_buffers[partition][first]->mclFlags(),
+          temp_buffers[partition][first+1]->devData(),temp_buffers[partition][first+1]->devSize(),temp_buffers[partition][first+1]->mclFlags(),
+          d_sendlist[partition]->devData(),d_sendlist[partition]->devSize(),d_sendlist[partition]->mclFlags() | rewrite);
+      mcl->Retire(packed[partition]);
+    }
+
+    for(partition = 0; partition < npatitions; partition++){
+      CommBatchParams p;
+      cMCLData<MMD_float, xx>* buf[STAGE_SWAPS];
+      mcl_handle* wait[1 + STAGE_SWAPS];
+      int nwait = 0;
+      if (last[partition]) wait[nwait++] = last[partition];
+      for (s = 0; s < STAGE_SWAPS; s++) {
+        int idx = (partition * maxswap) + first + s;
+        int src = recvproc[idx];
+        buf[s] = temp_buffers[src][first + s];
+        p.pbc[s].x = atom[partition].box.xprd*pbc_flagx[idx];
+        p.pbc[s].y = atom[partition].box.yprd*pbc_flagy[idx];
+        p.pbc[s].z = atom[partition].box.zprd*pbc_flagz[idx];
+        p.offset[s] = (first + s) * maxsendlist[(partition*maxswap)];
+        p.first[s] = firstrecv[idx];
+        if (src != partition) {
+          p.mode[s] = 1;
+          p.n[s] = recvnum[idx];
+          if (packed[src] && (nwait == 0 || wait[nwait-1] != packed[src]))
+            wait[nwait++] = packed[src];
+        } else {
+          p.mode[s] = fused ? 0 : 2;
+          p.n[s] = fused ? 0 : sendnum[idx];
+        }
+      }
+      if (p.n[0] + p.n[1] == 0) continue;
+      last[partition] = mcl->LaunchKernel(k_unpack_batch, p.n[0] + p.n[1], nwait, wait, &p, sizeof(p), 4,
+          atom[partition].d_x->devData(),atom[partition].d_x->devSize(),atom[partition].d_x->mclFlags(),
+          buf[0]->devData(),buf[0]->devSize(),buf[0]->mclFlags(),
+          buf[1]->devData(),buf[1]->devSize(),buf[1]->mclFlags(),
+          d_sendlist[partition]->devData(),d_sendlist[partition]->devSize(),d_sendlist[partition]->mclFlags() | rewrite);
+      mcl->Retire(last[partition]);
+    }
+  }
+
+  for(partition = 0; partition < npatitions; partition++)
+    hdls[partition * maxswap] = last[partition];
+  nhdls = 1;
+  return hdls;
+}
+
 /* reverse communication of atom info every timestep */
       
-void Comm::reverse_communicate(Atom atom[])
+/* fold the forces accumulated on ghost atoms back into their owners,
+   swaps are undone in reverse order since later swaps can send ghosts
+   received in earlier ones
+   waitlist holds the force handle of every partition, the returned
+   array the last handle that updated f of every partition */
+
+mcl_handle** Comm::reverse_communicate(Atom atom[], int reneigh, mcl_handle** waitlist)
 {
-  // Unimplemented: Needed for half neighbor
-  throw "Not Implemented";
+  int partition, iswap;
+  mcl_handle** last = new mcl_handle*[npatitions];
+  mcl_handle** packed = new mcl_handle*[npatitions];
+  uint64_t rewrite = (reneigh && !lists_on_device) ? MCL_ARG_REWRITE : 0;
+
+  for(partition = 0; partition < npatitions; partition++)
+    last[partition] = waitlist[partition];
+
+  for (iswap = nswap - 1; iswap >= 0; iswap--) {
+    for(partition = 0; partition < npatitions; partition++) {
+      int recv = recvproc[(partition * maxswap) + iswap];
+      CommParams p;
+      p.pbc.x = p.pbc.y = p.pbc.z = 0;
+      p.offset = iswap * maxsendlist[(partition*maxswap)];
+      p.first = firstrecv[(partition * maxswap) + iswap];
+      p.n = recvnum[(partition * maxswap) + iswap];
+      p.pad = 0;
+
+      if (recv != partition) {
+        packed[partition] = mcl->LaunchKernel(k_pack_reverse, p.n, 1, &last[partition], &p, sizeof(p), 2,
+            atom[partition].d_f->devData(),atom[partition].d_f->devSize(),atom[partition].d_f->mclFlags(),
+            temp_buffers[recv][iswap]->devData(),temp_buffers[recv][iswap]->devSize(),temp_buffers[recv][iswap]->mclFlags());
+        last[partition] = packed[partition];
+      } else {
+        packed[partition] = NULL;
+        last[partition] = mcl->LaunchKernel(k_reverse_self, p.n, 1, &last[partition], &p, sizeof(p), 2,
+            atom[partition].d_f->devData(),atom[partition].d_f->devSize(),atom[partition].d_f->mclFlags(),
+            d_sendlist[partition]->devData(),d_sendlist[partition]->devSize(),d_sendlist[partition]->mclFlags() | rewrite);
+      }
+      mcl->Retire(last[partition]);
+    }
+
+    /* the buffer packed by partition goes back to the partition it came from */
+    for(partition = 0; partition < npatitions; partition++) {
+      int recv = recvproc[(partition * maxswap) + iswap];
+      if (recv == partition) continue;
+
+      mcl_handle* wait[2];
+      wait[0] = packed[partition];
+      wait[1] = last[recv];
+      CommParams p;
+      p.pbc.x = p.pbc.y = p.pbc.z = 0;
+      p.offset = iswap * maxsendlist[(recv*maxswap)];
+      p.first = 0;
+      p.n = sendnum[(recv * maxswap) + iswap];
+      p.pad = 0;
+      last[recv] = mcl->LaunchKernel(k_unpack_reverse, p.n, 2, wait, &p, sizeof(p), 3,
+          atom[recv].d_f->devData(),atom[recv].d_f->devSize(),atom[recv].d_f->mclFlags(),
+          temp_buffers[recv][iswap]->devData(),temp_buffers[recv][iswap]->devSize(),temp_buffers[recv][iswap]->mclFlags(),
+          d_sendlist[recv]->devData(),d_sendlist[recv]->devSize(),d_sendlist[recv]->mclFlags() | rewrite);
+      mcl->Retire(last[recv]);
+    }
+  }
+
+  delete[] packed;
+  return last;
+}
+
+/* forward communication of one value per atom (q[partition], sized like x)
+   to the ghost atoms, swap by swap like communicate
+   waitlist holds the handle that produced q of every partition, the
+   returned array the last handle that updated q of every partition
+   the swap buffers are shared with communicate, so a partition only packs
+   once the partition reading its buffer is past the last task of waitlist */
+
+mcl_handle** Comm::communicate_scalar(Atom atom[], cMCLData<MMD_float, xx>** q, int reneigh, mcl_handle** waitlist)
+{
+  int partition, iswap;
+  mcl_handle** last = new mcl_handle*[npatitions];
+  mcl_handle** packed = new mcl_handle*[npatitions];
+  int* reader = new int[npatitions];
+  uint64_t rewrite = (reneigh && !lists_on_device) ? MCL_ARG_REWRITE : 0;
+
+  for(partition = 0; partition < npatitions; partition++)
+    last[partition] = waitlist[partition];
+
+  for (iswap = 0; iswap < nswap; iswap++) {
+    for(partition = 0; partition < npatitions; partition++)
+      reader[recvproc[(partition * maxswap) + iswap]] = partition;
+
+    for(partition = 0; partition < npatitions; partition++) {
+      CommParams p;
+      p.pbc.x = p.pbc.y = p.pbc.z = 0;
+      p.offset = iswap * maxsendlist[(partition*maxswap)];
+      p.first = firstrecv[(partition * maxswap) + iswap];
+      p.n = sendnum[(partition * maxswap) + iswap];
+      p.pad = 0;
+
+      if (recvproc[(partition * maxswap) + iswap] != partition) {
+        mcl_handle* wait[2];
+        wait[0] = last[partition];
+        wait[1] = last[reader[partition]];
+        packed[partition] = mcl->LaunchKernel(k_pack_scalar, p.n, 2, wait, &p, sizeof(p), 3,
+            q[partition]->devData(),q[partition]->devSize(),q[partition]->mclFlags(),
+            temp_buffers[partition][iswap]->devData(),temp_buffers[partition][iswap]->devSize(),temp_buffers[partition][iswap]->mclFlags(),
+            d_sendlist[partition]->devData(),d_sendlist[partition]->devSize(),d_sendlist[partition]->mclFlags() | rewrite);
+        mcl->Retire(packed[partition]);
+      } else {
+        packed[partition] = NULL;
+        last[partition] = mcl->LaunchKernel(k_scalar_self, p.n, 1, &last[partition], &p, sizeof(p), 2,
+            q[partition]->devData(),q[partition]->devSize(),q[partition]->mclFlags(),
+            d_sendlist[partition]->devData(),d_sendlist[partition]->devSize(),d_sendlist[partition]->mclFlags() | rewrite);
+        mcl->Retire(last[partition]);
+      }
+    }
+
+    for(partition = 0; partition < npatitions; partition++) {
+      int recv = recvproc[(partition * maxswap) + iswap];
+      if (recv == partition) continue;
+
+      mcl_handle* wait[2];
+      wait[0] = packed[recv];
+      wait[1] = last[partition];
+      CommParams p;
+      p.pbc.x = p.pbc.y = p.pbc.z = 0;
+      p.offset = 0;
+      p.first = firstrecv[(partition * maxswap) + iswap];
+      p.n = recvnum[(partition * maxswap) + iswap];
+      p.pad = 0;
+      last[partition] = mcl->LaunchKernel(k_unpack_scalar, p.n, 2, wait, &p, sizeof(p), 2,
+          q[partition]->devData(),q[partition]->devSize(),q[partition]->mclFlags(),
+          temp_buffers[recv][iswap]->devData(),temp_buffers[recv][iswap]->devSize(),temp_buffers[recv][iswap]->mclFlags());
+      mcl->Retire(last[partition]);
+    }
+  }
+
+  delete[] packed;
+  delete[] reader;
+  return last;
+}
+
+/* communicate for the native backend: ghost positions are packed and
+   unpacked on the host, swap by swap since later swaps forward ghosts
+   received in earlier ones, partitions are handled by their owner thread */
+
+void Comm::communicate_native(Atom atom[], ThreadPool &pool)
+{
+  for (int iswap = 0; iswap < nswap; iswap++) {
+    pool.run([&](int tid) {
+      int lo, hi;
+      for (int partition = 0; partition < npatitions; partition++) {
+        pool.range(tid, partition, npatitions, 1, lo, hi);
+        if (lo == hi) continue;
+        int pbc_flags[4];
+        pbc_flags[0] = pbc_any[(partition*maxswap) + iswap];
+        pbc_flags[1] = pbc_flagx[(partition*maxswap) + iswap];
+        pbc_flags[2] = pbc_flagy[(partition*maxswap) + iswap];
+        pbc_flags[3] = pbc_flagz[(partition*maxswap) + iswap];
+        atom[partition].pack_comm(sendnum[(partition*maxswap) + iswap], sendlist[partition][iswap],
+                                  temp_buffers[partition][iswap]->hostData(), pbc_flags);
+      }
+    });
+    pool.run([&](int tid) {
+      int lo, hi;
+      for (int partition = 0; partition < npatitions; partition++) {
+        pool.range(tid, partition, npatitions, 1, lo, hi);
+        if (lo == hi) continue;
+        int recv = recvproc[(partition*maxswap) + iswap];
+        atom[partition].unpack_comm(recvnum[(partition*maxswap) + iswap], firstrecv[(partition*maxswap) + iswap],
+                                    temp_buffers[recv][iswap]->hostData());
+      }
+    });
+  }
 }
 
 /* exchange:
@@ -536,6 +1025,14 @@ void Comm::borders(Atom* atom)
             sendlist[j][iswap][nsend[j]++] = i;
           }
         }
+
+        /* send in curve order of the receiver, its ghosts end up sorted */
+        if (atom[j].sort_curve && nsend[j]) {
+          atom[j].sort_list(sendlist[j][iswap], nsend[j], pbc_flags, atom[sendproc[(j*maxswap) + iswap]]);
+          m = 0;
+          for (i = 0; i < nsend[j]; i++)
+            m += atom[j].pack_border(sendlist[j][iswap][i], &buf_send[m], pbc_flags);
+        }
       }
 
       for(j = 0; j < npatitions; j++) {
@@ -561,10 +1058,425 @@ void Comm::borders(Atom* atom)
     }
   }
 
+  /* only the filled heads of the lists go to the staging buffer */
+
   for(j = 0; j < npatitions; j++){
+    for(iswap = 0; iswap < nswap; iswap++)
+      d_sendlist[j]->touch(0, sendnum[(j*maxswap) + iswap]);
     d_sendlist[j]->upload();
   }
+  lists_on_device = 0;
+
+  /* invert the send lists of the leading swaps for integrate_pack,
+     they scan local atoms only (idim 0 starts before any ghosts exist) */
+
+  nfused = 0;
+  if (use_fused) {
+    nfused = nswap < FUSED_SWAPS ? nswap : FUSED_SWAPS;
+    for(j = 0; j < npatitions; j++){
+      n = FUSED_SWAPS * atom[j].nlocal;
+      if (n > maxfuseslot[j]) growfuseslot(j, n);
+      int* slot = d_fuseslot[j]->hostData();
+      for (i = 0; i < n; i++) slot[i] = -1;
+      for (iswap = 0; iswap < nfused; iswap++)
+        for (i = 0; i < sendnum[(j*maxswap) + iswap]; i++)
+          slot[FUSED_SWAPS * sendlist[j][iswap][i] + iswap] = i;
+      d_fuseslot[j]->upload();
+    }
+  }
+
+  delete[] nlast;
+  delete[] nfirst;
+  delete[] nsend;
+}
+
+/* exchange and borders on the device, see comm_kernel.h
+   the atoms to move are flagged and compacted with a prefix sum, only the
+   per swap counts come back to the host which sizes the next launch
+   the tasks of a partition run as one chain (chain[j]), a task of another
+   partition is only waited for where its send buffer is read or packed
+   again; the host waits for the scan that writes a count, for all chains
+   before a buffer grows, and once at the end of borders_device */
+
+static void box_bounds(Atom &atom, int idim, MMD_float &lo, MMD_float &hi)
+{
+  if (idim == 0) {
+    lo = atom.box.xlo;
+    hi = atom.box.xhi;
+  } else if (idim == 1) {
+    lo = atom.box.ylo;
+    hi = atom.box.yhi;
+  } else {
+    lo = atom.box.zlo;
+    hi = atom.box.zhi;
+  }
+}
+
+static void clear_params(ExchangeParams &p)
+{
+  p.shift.x = p.shift.y = p.shift.z = 0;
+  p.lo = p.hi = 0;
+  p.idim = p.first = p.n = p.nkeep = p.offset = p.slot = 0;
+}
+
+/* waitlist of the tasks a, b and c, NULLs left out, returns its length */
+
+static int waitlist(mcl_handle** list, mcl_handle* a, mcl_handle* b, mcl_handle* c)
+{
+  int n = 0;
+  if (a) list[n++] = a;
+  if (b && b != a) list[n++] = b;
+  if (c && c != a && c != b) list[n++] = c;
+  return n;
+}
+
+/* wait for the exchange/borders tasks of all partitions */
+
+void Comm::drain()
+{
+  for (int j = 0; j < npatitions; j++)
+    if (chain[j]) mcl_wait(chain[j]);
+}
+
+/* comm_scan_blocks/sums/fixup of the n flags of a partition after its
+   chain, the total goes to d_counts[slot]; returns the comm_scan_sums task
+   so the host can wait for the count while the fixup still runs */
+
+mcl_handle* Comm::scan(int partition, int n, int slot)
+{
+  ExchangeParams p;
+  clear_params(p);
+  p.n = n;
+  p.slot = slot;
+  mcl_handle** prev = &chain[partition];
+  if (n) {
+    chain[partition] = mcl->LaunchKernel(k_scan_blocks, n, *prev ? 1 : 0, *prev ? prev : NULL, &p, sizeof(p), 4,
+        d_scanflag[partition]->devData(),d_scanflag[partition]->devSize(),d_scanflag[partition]->mclFlags(),
+        d_scanpos[partition]->devData(),d_scanpos[partition]->devSize(),d_scanpos[partition]->mclFlags(),
+        d_scanblock[partition]->devData(),d_scanblock[partition]->devSize(),d_scanblock[partition]->mclFlags(),
+        NULL,sizeof(int)*mcl->blockdim, MCL_ARG_LOCAL);
+    mcl->Retire(chain[partition]);
+  }
+
+  p.n = (n + mcl->blockdim - 1) / mcl->blockdim;
+  mcl_handle* sums = mcl->LaunchKernel(k_scan_sums, mcl->blockdim, *prev ? 1 : 0, *prev ? prev : NULL, &p, sizeof(p), 3,
+      d_scanblock[partition]->devData(),d_scanblock[partition]->devSize(),d_scanblock[partition]->mclFlags(),
+      d_counts[partition]->devData(),d_counts[partition]->devSize(),d_counts[partition]->mclFlags(),
+      NULL,sizeof(int)*mcl->blockdim, MCL_ARG_LOCAL);
+  mcl->Retire(sums);
+  chain[partition] = sums;
+
+  if (n) {
+    p.n = n;
+    chain[partition] = mcl->LaunchKernel(k_scan_fixup, n, 1, &sums, &p, sizeof(p), 2,
+        d_scanpos[partition]->devData(),d_scanpos[partition]->devSize(),d_scanpos[partition]->mclFlags(),
+        d_scanblock[partition]->devData(),d_scanblock[partition]->devSize(),d_scanblock[partition]->mclFlags());
+    mcl->Retire(chain[partition]);
+  }
+  return sums;
+}
+
+/* same result as exchange() up to the order of the owned atoms:
+   leaving atoms below the new nlocal are replaced by staying ones above
+   the last tasks stay in chain, borders_device goes on from there */
+
+void Comm::exchange_device(Atom atom[])
+{
+  int j,idim,dir,nrecv,n;
+  int* nsend = new int[npatitions];
+  mcl_handle** sums = new mcl_handle*[npatitions];
+  mcl_handle** sent = new mcl_handle*[npatitions];      // pack of this dimension
+  mcl_handle** read = new mcl_handle*[2 * npatitions];  // last reader of a send buffer, per direction
+  mcl_handle* wait[3];
+  int myloc[3];
+  ExchangeParams p;
+
+  for(j = 0; j < npatitions; j++){
+    chain[j] = NULL;
+    read[2*j] = read[2*j+1] = NULL;
+  }
+
+  /* enforce PBC */
+
+  for(j = 0; j < npatitions; j++){
+    clear_params(p);
+    p.shift.x = atom[j].box.xprd;
+    p.shift.y = atom[j].box.yprd;
+    p.shift.z = atom[j].box.zprd;
+    p.n = atom[j].nlocal;
+    if (!p.n) continue;
+    chain[j] = mcl->LaunchKernel(k_pbc, p.n, 0, NULL, &p, sizeof(p), 1,
+        atom[j].d_x->devData(),atom[j].d_x->devSize(),atom[j].d_x->mclFlags());
+    mcl->Retire(chain[j]);
+  }
+
+  for (idim = 0; idim < 3; idim++) {
+
+    if (procgrid[idim] == 1) continue;
+
+    /* flag and count atoms leaving my box */
+
+    for(j = 0; j < npatitions; j++){
+      clear_params(p);
+      box_bounds(atom[j], idim, p.lo, p.hi);
+      p.idim = idim;
+      p.n = atom[j].nlocal;
+      growscan(j, p.n);
+      if (p.n) {
+        chain[j] = mcl->LaunchKernel(k_exchange_mark, p.n, chain[j] ? 1 : 0, chain[j] ? &chain[j] : NULL, &p, sizeof(p), 2,
+            atom[j].d_x->devData(),atom[j].d_x->devSize(),atom[j].d_x->mclFlags(),
+            d_scanflag[j]->devData(),d_scanflag[j]->devSize(),d_scanflag[j]->mclFlags());
+        mcl->Retire(chain[j]);
+      }
+      sums[j] = scan(j, p.n, 0);
+    }
+
+    /* pack them and fill their holes with staying atoms from the tail,
+       the receivers of the last dimension may still read the send buffer */
+
+    for(j = 0; j < npatitions; j++){
+      mcl_wait(sums[j]);
+      nsend[j] = d_counts[j]->hostData()[0];
+      sent[j] = NULL;
+      if (!nsend[j]) continue;
+      if (6 * nsend[j] + 6 >= maxsend[j]) {
+        drain();
+        growsend(6 * nsend[j] + 6, j, 0);
+      }
+
+      clear_params(p);
+      p.n = atom[j].nlocal;
+      p.nkeep = atom[j].nlocal - nsend[j];
+      n = waitlist(wait, chain[j], read[2*j], read[2*j+1]);
+      sent[j] = mcl->LaunchKernel(k_exchange_pack, p.n, n, wait, &p, sizeof(p), 6,
+          atom[j].d_x->devData(),atom[j].d_x->devSize(),atom[j].d_x->mclFlags(),
+          atom[j].d_v->devData(),atom[j].d_v->devSize(),atom[j].d_v->mclFlags(),
+          d_scanflag[j]->devData(),d_scanflag[j]->devSize(),d_scanflag[j]->mclFlags(),
+          d_scanpos[j]->devData(),d_scanpos[j]->devSize(),d_scanpos[j]->mclFlags(),
+          d_holes[j]->devData(),d_holes[j]->devSize(),d_holes[j]->mclFlags(),
+          temp_buffers[j][0]->devData(),temp_buffers[j][0]->devSize(),temp_buffers[j][0]->mclFlags());
+      mcl->Retire(sent[j]);
+      chain[j] = mcl->LaunchKernel(k_exchange_fill, nsend[j], 1, &sent[j], &p, sizeof(p), 5,
+          atom[j].d_x->devData(),atom[j].d_x->devSize(),atom[j].d_x->mclFlags(),
+          atom[j].d_v->devData(),atom[j].d_v->devSize(),atom[j].d_v->mclFlags(),
+          d_scanflag[j]->devData(),d_scanflag[j]->devSize(),d_scanflag[j]->mclFlags(),
+          d_scanpos[j]->devData(),d_scanpos[j]->devSize(),d_scanpos[j]->mclFlags(),
+          d_holes[j]->devData(),d_holes[j]->devSize(),d_holes[j]->mclFlags());
+      mcl->Retire(chain[j]);
+      read[2*j] = read[2*j+1] = NULL;
+      atom[j].nlocal = p.nkeep;
+    }
+
+    /* check incoming atoms to see if they are in my box
+       if they are, append them to my atoms */
+
+    for (dir = -1; dir <= 1; dir += 2) {
+      if (dir == 1 && procgrid[idim] <= 2) break;
+
+      for(j = 0; j < npatitions; j++){
+        get_my_loc(myloc, j);
+        int src = neighbor(myloc, idim, dir);
+        clear_params(p);
+        box_bounds(atom[j], idim, p.lo, p.hi);
+        p.idim = idim;
+        p.n = nsend[src];
+        growscan(j, p.n);
+        if (p.n) {
+          n = waitlist(wait, chain[j], sent[src], NULL);
+          chain[j] = mcl->LaunchKernel(k_recv_mark, p.n, n, wait, &p, sizeof(p), 2,
+              temp_buffers[src][0]->devData(),temp_buffers[src][0]->devSize(),temp_buffers[src][0]->mclFlags(),
+              d_scanflag[j]->devData(),d_scanflag[j]->devSize(),d_scanflag[j]->mclFlags());
+          mcl->Retire(chain[j]);
+        }
+        sums[j] = scan(j, p.n, 1);
+      }
+
+      for(j = 0; j < npatitions; j++){
+        get_my_loc(myloc, j);
+        int src = neighbor(myloc, idim, dir);
+        mcl_wait(sums[j]);
+        nrecv = d_counts[j]->hostData()[1];
+        if (nrecv) {
+          if (atom[j].nlocal + nrecv > atom[j].nmax) drain();
+          while (atom[j].nlocal + nrecv > atom[j].nmax) atom[j].grow_device();
+
+          clear_params(p);
+          p.first = atom[j].nlocal;
+          p.n = nsend[src];
+          chain[j] = mcl->LaunchKernel(k_exchange_unpack, p.n, 1, &chain[j], &p, sizeof(p), 5,
+              atom[j].d_x->devData(),atom[j].d_x->devSize(),atom[j].d_x->mclFlags(),
+              atom[j].d_v->devData(),atom[j].d_v->devSize(),atom[j].d_v->mclFlags(),
+              temp_buffers[src][0]->devData(),temp_buffers[src][0]->devSize(),temp_buffers[src][0]->mclFlags(),
+              d_scanflag[j]->devData(),d_scanflag[j]->devSize(),d_scanflag[j]->mclFlags(),
+              d_scanpos[j]->devData(),d_scanpos[j]->devSize(),d_scanpos[j]->mclFlags());
+          mcl->Retire(chain[j]);
+          atom[j].nlocal += nrecv;
+        }
+        if (nsend[src]) read[2*src + (dir > 0)] = chain[j];
+      }
+    }
+  }
 
+  delete[] read;
+  delete[] sent;
+  delete[] sums;
+  delete[] nsend;
+}
+
+/* same swaps as borders(), the send lists and the integrate_pack slot map
+   stay on the device (lists_on_device)
+   a send list that outgrows its buffer restarts the swaps, growlist()
+   drops the lists built so far */
+
+void Comm::borders_device(Atom* atom)
+{
+  int j,n,iswap,idim,ineed,nrecv,grown;
+  int* nsend = new int[npatitions];
+  int* nfirst = new int[npatitions];
+  int* nlast = new int[npatitions];
+  mcl_handle** sums = new mcl_handle*[npatitions];
+  mcl_handle** sent = new mcl_handle*[npatitions];
+  mcl_handle* wait[3];
+  ExchangeParams p;
+
+  do {
+    grown = 0;
+    for(j = 0; j < npatitions; j++) atom[j].nghost = 0;
+    for(j = 0; j < npatitions; j++) nfirst[j] = 0;
+    iswap = 0;
+
+    for (idim = 0; idim < 3 && !grown; idim++) {
+      for(j = 0; j < npatitions; j++) nlast[j] = 0;
+      for (ineed = 0; ineed < 2*need[idim]; ineed++) {
+
+        /* flag and count atoms (own & ghost) within slab boundaries lo/hi */
+
+        for(j = 0; j < npatitions; j++){
+          if (ineed % 2 == 0) {
+            nfirst[j] = nlast[j];
+            nlast[j] = atom[j].nlocal + atom[j].nghost;
+          }
+          clear_params(p);
+          p.lo = slablo[(j*maxswap) + iswap];
+          p.hi = slabhi[(j*maxswap) + iswap];
+          p.idim = idim;
+          p.first = nfirst[j];
+          p.n = nlast[j] - nfirst[j];
+          growscan(j, p.n);
+          if (p.n) {
+            chain[j] = mcl->LaunchKernel(k_border_mark, p.n, chain[j] ? 1 : 0, chain[j] ? &chain[j] : NULL, &p, sizeof(p), 2,
+                atom[j].d_x->devData(),atom[j].d_x->devSize(),atom[j].d_x->mclFlags(),
+                d_scanflag[j]->devData(),d_scanflag[j]->devSize(),d_scanflag[j]->mclFlags());
+            mcl->Retire(chain[j]);
+          }
+          sums[j] = scan(j, p.n, 0);
+        }
+
+        /* a count being back means the earlier tasks of its partition,
+           which used the send list, are done */
+
+        for(j = 0; j < npatitions; j++){
+          mcl_wait(sums[j]);
+          nsend[j] = d_counts[j]->hostData()[0];
+          if (nsend[j] > maxsendlist[(j*maxswap) + iswap]) {
+            growlist(iswap, nsend[j], j);
+            grown = 1;
+          }
+        }
+        if (grown) break;
+
+        /* earlier swaps of other partitions may still read the send buffers */
+
+        for(j = 0; j < npatitions; j++){
+          nrecv = nsend[recvproc[(j*maxswap) + iswap]];
+          if (3 * nsend[j] + 3 >= maxsend[j] || atom[j].nlocal + atom[j].nghost + nrecv > atom[j].nmax) drain();
+          if (3 * nsend[j] + 3 >= maxsend[j]) growsend(3 * nsend[j] + 3, j, iswap);
+          while (atom[j].nlocal + atom[j].nghost + nrecv > atom[j].nmax) atom[j].grow_device();
+        }
+
+        /* pack send buffer and send list */
+
+        for(j = 0; j < npatitions; j++){
+          clear_params(p);
+          p.shift.x = atom[j].box.xprd * pbc_flagx[(j*maxswap) + iswap];
+          p.shift.y = atom[j].box.yprd * pbc_flagy[(j*maxswap) + iswap];
+          p.shift.z = atom[j].box.zprd * pbc_flagz[(j*maxswap) + iswap];
+          p.first = nfirst[j];
+          p.n = nlast[j] - nfirst[j];
+          p.offset = iswap * maxsendlist[(j*maxswap)];
+          sent[j] = NULL;
+          if (!nsend[j]) continue;
+          sent[j] = mcl->LaunchKernel(k_border_pack, p.n, 1, &chain[j], &p, sizeof(p), 5,
+              atom[j].d_x->devData(),atom[j].d_x->devSize(),atom[j].d_x->mclFlags(),
+              d_scanflag[j]->devData(),d_scanflag[j]->devSize(),d_scanflag[j]->mclFlags(),
+              d_scanpos[j]->devData(),d_scanpos[j]->devSize(),d_scanpos[j]->mclFlags(),
+              d_sendlist[j]->devData(),d_sendlist[j]->devSize(),d_sendlist[j]->mclFlags(),
+              temp_buffers[j][iswap]->devData(),temp_buffers[j][iswap]->devSize(),temp_buffers[j][iswap]->mclFlags());
+          mcl->Retire(sent[j]);
+          chain[j] = sent[j];
+        }
+
+        /* unpack buffer, set all pointers & counters */
+
+        for(j = 0; j < npatitions; j++){
+          int recv = recvproc[(j*maxswap) + iswap];
+          nrecv = nsend[recv];
+          sendnum[(j*maxswap) + iswap] = nsend[j];
+          recvnum[(j*maxswap) + iswap] = nrecv;
+          firstrecv[(j*maxswap) + iswap] = atom[j].nlocal + atom[j].nghost;
+          if (nrecv) {
+            n = waitlist(wait, chain[j], sent[recv], NULL);
+            clear_params(p);
+            p.first = firstrecv[(j*maxswap) + iswap];
+            p.n = nrecv;
+            chain[j] = mcl->LaunchKernel(k_border_unpack, nrecv, n, wait, &p, sizeof(p), 2,
+                atom[j].d_x->devData(),atom[j].d_x->devSize(),atom[j].d_x->mclFlags(),
+                temp_buffers[recv][iswap]->devData(),temp_buffers[recv][iswap]->devSize(),temp_buffers[recv][iswap]->mclFlags());
+            mcl->Retire(chain[j]);
+          }
+          atom[j].nghost += nrecv;
+        }
+
+        iswap++;
+      }
+    }
+  } while (grown);
+
+  /* integrate_pack slot map, built from the device send lists */
+
+  nfused = 0;
+  if (use_fused) {
+    nfused = nswap < FUSED_SWAPS ? nswap : FUSED_SWAPS;
+    for(j = 0; j < npatitions; j++){
+      n = FUSED_SWAPS * atom[j].nlocal;
+      if (!n) continue;
+      if (n > maxfuseslot[j]) growfuseslot(j, n);
+      clear_params(p);
+      p.n = atom[j].nlocal;
+      chain[j] = mcl->LaunchKernel(k_fuse_clear, n, chain[j] ? 1 : 0, chain[j] ? &chain[j] : NULL, &p, sizeof(p), 1,
+          d_fuseslot[j]->devData(),d_fuseslot[j]->devSize(),d_fuseslot[j]->mclFlags());
+      mcl->Retire(chain[j]);
+      for (iswap = 0; iswap < nfused; iswap++) {
+        clear_params(p);
+        p.idim = iswap;
+        p.n = sendnum[(j*maxswap) + iswap];
+        p.offset = iswap * maxsendlist[(j*maxswap)];
+        if (!p.n) continue;
+        chain[j] = mcl->LaunchKernel(k_fuse_slots, p.n, 1, &chain[j], &p, sizeof(p), 2,
+            d_sendlist[j]->devData(),d_sendlist[j]->devSize(),d_sendlist[j]->mclFlags(),
+            d_fuseslot[j]->devData(),d_fuseslot[j]->devSize(),d_fuseslot[j]->mclFlags());
+        mcl->Retire(chain[j]);
+      }
+    }
+  }
+  lists_on_device = 1;
+
+  /* the neighbor build is launched without a waitlist */
+  drain();
+  for(j = 0; j < npatitions; j++) chain[j] = NULL;
+
+  delete[] sent;
+  delete[] sums;
   delete[] nlast;
   delete[] nfirst;
   delete[] nsend;
@@ -587,6 +1499,65 @@ MMD_float* Comm::growsend(int n, int partition, int iswap)
   return temp_buffers[partition][iswap]->hostData();
 }
 
+/* realloc the integrate_pack slot map of a partition with BUFFACTOR */
+
+void Comm::growfuseslot(int partition, int n)
+{
+  maxfuseslot[partition] = static_cast<int>(BUFFACTOR * n);
+  if (d_fuseslot[partition]) {
+    mcl_unregister_buffer(d_fuseslot[partition]->devData());
+    delete d_fuseslot[partition];
+  }
+  d_fuseslot[partition] = new cMCLData<int, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC | MCL_ARG_INPUT, maxfuseslot[partition], 0, 0);
+}
+
+/* realloc the compaction scratch of a partition with BUFFACTOR,
+   only the tasks in the chain of the partition use it */
+
+void Comm::growscan(int partition, int n)
+{
+  if (n <= maxscan[partition]) return;
+  if (chain[partition]) mcl_wait(chain[partition]);
+  maxscan[partition] = MAX(static_cast<int>(BUFFACTOR * n), BUFMIN);
+  if (d_scanflag[partition]) {
+    mcl_unregister_buffer(d_scanflag[partition]->devData());
+    mcl_unregister_buffer(d_scanpos[partition]->devData());
+    mcl_unregister_buffer(d_holes[partition]->devData());
+    mcl_unregister_buffer(d_scanblock[partition]->devData());
+    delete d_scanflag[partition];
+    delete d_scanpos[partition];
+    delete d_holes[partition];
+    delete d_scanblock[partition];
+  }
+  d_scanflag[partition] = new cMCLData<int, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, maxscan[partition], 0, 0);
+  d_scanpos[partition] = new cMCLData<int, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, maxscan[partition], 0, 0);
+  d_holes[partition] = new cMCLData<int, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, maxscan[partition], 0, 0);
+  d_scanblock[partition] = new cMCLData<int, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC,
+      (maxscan[partition] + mcl->blockdim - 1) / mcl->blockdim, 0, 0);
+}
+
+/* scalar block of integrate_pack for the fused swaps of a partition,
+   dt/dtforce/nlocal are filled in by the caller */
+
+void Comm::pack_params(Atom &atom, int partition, IntegratePackParams &p)
+{
+  p.nswap = nfused;
+  for (int iswap = 0; iswap < FUSED_SWAPS; iswap++) {
+    int idx = (partition * maxswap) + iswap;
+    if (iswap < nfused) {
+      p.pbc[iswap].x = atom.box.xprd * pbc_flagx[idx];
+      p.pbc[iswap].y = atom.box.yprd * pbc_flagy[idx];
+      p.pbc[iswap].z = atom.box.zprd * pbc_flagz[idx];
+      p.first[iswap] = firstrecv[idx];
+      p.self[iswap] = recvproc[idx] == partition;
+    } else {
+      p.pbc[iswap].x = p.pbc[iswap].y = p.pbc[iswap].z = 0;
+      p.first[iswap] = 0;
+      p.self[iswap] = 0;
+    }
+  }
+}
+
 /* realloc the size of the iswap sendlist as needed with BUFFACTOR */
 
 int** Comm::growlist(int iswapa, int n, int partition)
@@ -608,5 +1579,5 @@ int** Comm::growlist(int iswapa, int n, int partition)
 
 void Comm::free()
 {
-    for(auto hdl : to_free) mcl_hdl_free(hdl);
+    mcl->ReleaseRetired();
 }
@@ -37,6 +37,8 @@
 #include "atom.h"
 #include "precision.h"
 #include "mcl_data.h"
+#include "kernel_params.h"
+#include "threadpool.h"
 
 class Comm {
  public:
@@ -44,11 +46,21 @@ class Comm {
   ~Comm();
   int setup(MMD_float, Atom[], int);
   mcl_handle** communicate(Atom[], int, mcl_handle** waitlist);
-  void reverse_communicate(Atom[]);
+  mcl_handle** communicate_batch(Atom[], int, mcl_handle** waitlist);
+  mcl_handle** reverse_communicate(Atom[], int, mcl_handle** waitlist);
+  mcl_handle** communicate_scalar(Atom[], cMCLData<MMD_float, xx>**, int, mcl_handle** waitlist);
   void exchange(Atom[]);
   void borders(Atom[]);
+  void exchange_device(Atom[]);
+  void communicate_native(Atom[], ThreadPool &);
+  void borders_device(Atom[]);
   MMD_float* growsend(int, int, int);
   int** growlist(int, int, int);
+  void growfuseslot(int, int);
+  void pack_params(Atom &, int, IntegratePackParams &);
+  int balance(Atom[]);
+  void set_cuts(const MMD_float*, const MMD_float*, const MMD_float*, Atom[]);
+  int owner(MMD_float, MMD_float, MMD_float);
   void free();
 
  public:
@@ -62,7 +74,7 @@ class Comm {
   int *pbc_flagy;                   // same in y
   int *pbc_flagz;                   // same in z
   int *sendnum,*recvnum;            // # of atoms to send/recv in each swap
-  int *sendproc,*recvproc;          // proc to send/recv with at each swap
+  int *sendproc,*recvproc;          // partition that reads this swap / that this swap reads from
 
   int *firstrecv;                   // where to put 1st recv atom in each swap
   int ***sendlist;                   // list of atoms to send in each swap
@@ -75,15 +87,52 @@ class Comm {
   int* maxsend;
 
   int procgrid[3];                  // # of procs in each dim
+  MMD_float prd[3];                 // global box size
+  MMD_float cutneigh;               // ghost cutoff the swaps cover
+  MMD_float *cut[3];                // procgrid+1 cut planes in each dim
   int need[3];                      // how many procs away needed in each dim
   MMD_float *slablo,*slabhi;           // bounds of slabs to send to other procs
  
   int do_safeexchange;
+
+  int k_pack, k_unpack, k_self;     // registered comm kernel ids
+  int k_gather, k_pack_batch, k_unpack_batch;
+  int k_pack_reverse, k_unpack_reverse, k_reverse_self;
+  int k_pack_scalar, k_unpack_scalar, k_scalar_self;
+
+  int use_fused;                    // pack the first swaps in integrate_pack
+  int use_gather;                   // receivers read the owner's x directly, single device only
+  int use_batch;                    // one pack and one unpack launch per stage of swaps
+  int nhdls;                        // handles per partition in the array communicate returns
+  int nfused;                       // # of swaps packed by integrate_pack
+  cMCLData<int, xx>** d_fuseslot;   // per local atom: position in each fused send list
+  int* maxfuseslot;
+
+  int device_exchange;              // run exchange/borders on the device
+  int lists_on_device;              // send lists/slot map built by borders_device
+  int k_pbc, k_scan_blocks, k_scan_sums, k_scan_fixup;
+  int k_exchange_mark, k_exchange_pack, k_exchange_fill;
+  int k_recv_mark, k_exchange_unpack, k_border_mark, k_border_pack;
+  int k_border_unpack, k_fuse_clear, k_fuse_slots;
+  cMCLData<int, xx>** d_scanflag;   // per partition scratch of the compaction
+  cMCLData<int, xx>** d_scanpos;
+  cMCLData<int, xx>** d_holes;
+  cMCLData<int, xx>** d_scanblock;  // chunk totals, then chunk offsets of comm_scan_*
+  cMCLData<int, xx>** d_counts;     // totals of comm_scan, read back by the host
+  int* maxscan;
+  mcl_handle** chain;               // last exchange/borders task of each partition
+
+  int balance_every;                // shift the cut planes every this many reneighborings
+  MMD_float imbalance;              // max/average owned atoms before the last balance
   
 protected:
    int neighbor(int[], int, int);
    void get_my_loc(int my_loc[], int id);
-   std::vector<mcl_handle*> to_free;
+   void set_bounds(Atom[]);
+   MMD_float plane(int idim, int k);
+   mcl_handle* scan(int partition, int n, int slot);
+   void growscan(int partition, int n);
+   void drain();
 };
 
 #endif
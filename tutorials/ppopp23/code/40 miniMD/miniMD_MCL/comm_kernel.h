@@ -0,0 +1,256 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+/* exchange and borders on the device
+   atoms are selected with a flag per atom and compacted with an exclusive
+   prefix sum, only the totals are read back by the host */
+
+#include "precision.h"
+#include "kernel_params.h"
+
+inline MMD_float coord(MMD_floatK3 x, int idim)
+{
+  return idim == 0 ? x.x : (idim == 1 ? x.y : x.z);
+}
+
+/* exclusive prefix sum of flag[0..n) into pos, total into count[slot]
+   in three launches of blockdim sized work groups (Comm::scan)
+   comm_scan_blocks: every work group scans its own chunk of flag and
+                     leaves the chunk total in bsum[group]
+   comm_scan_sums:   one work group scans the n/blockdim chunk totals in
+                     place and writes the grand total
+   comm_scan_fixup:  adds the offset of its chunk to every pos */
+
+inline int scan_group(__local int* tmp, int v)
+{
+  int tid = get_local_id(0);
+  int nt = get_local_size(0);
+  tmp[tid] = v;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for(int off = 1; off < nt; off <<= 1)
+  {
+    int t = tid >= off ? tmp[tid-off] : 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    tmp[tid] += t;
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  return tmp[tid];
+}
+
+__kernel void comm_scan_blocks(__global int* flag, __global int* pos, __global int* bsum, __local int* tmp, struct ExchangeParams p)
+{
+  int i = get_global_id(0);
+  int v = i < p.n ? flag[i] : 0;
+  int sum = scan_group(tmp, v);
+  if(i < p.n) pos[i] = sum - v;
+  if(get_local_id(0) == 0) bsum[get_group_id(0)] = tmp[get_local_size(0)-1];
+}
+
+__kernel void comm_scan_sums(__global int* bsum, __global int* count, __local int* tmp, struct ExchangeParams p)
+{
+  int tid = get_local_id(0);
+  int nt = get_local_size(0);
+  int carry = 0;
+
+  for(int base = 0; base < p.n; base += nt)
+  {
+    int i = base + tid;
+    int v = i < p.n ? bsum[i] : 0;
+    int sum = scan_group(tmp, v);
+    if(i < p.n) bsum[i] = carry + sum - v;
+    carry += tmp[nt-1];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if(tid == 0) count[p.slot] = carry;
+}
+
+__kernel void comm_scan_fixup(__global int* pos, __global int* bsum, struct ExchangeParams p)
+{
+  int i = get_global_id(0);
+  if(i < p.n) pos[i] += bsum[get_group_id(0)];
+}
+
+/* Atom::pbc */
+
+__kernel void atom_pbc(__global MMD_floatK3* x, struct ExchangeParams p)
+{
+  int i = get_global_id(0);
+  if(i < p.n)
+  {
+    MMD_floatK3 xi = x[i];
+    if (xi.x < 0.0f) xi.x += p.shift.x;
+    if (xi.x >= p.shift.x) xi.x -= p.shift.x;
+    if (xi.y < 0.0f) xi.y += p.shift.y;
+    if (xi.y >= p.shift.y) xi.y -= p.shift.y;
+    if (xi.z < 0.0f) xi.z += p.shift.z;
+    if (xi.z >= p.shift.z) xi.z -= p.shift.z;
+    x[i] = xi;
+  }
+}
+
+/* pulls x and v back to the host when launched with MCL_ARG_OUTPUT */
+
+__kernel void atom_sync(__global MMD_floatK3* x, __global MMD_floatK3* v, int n)
+{
+}
+
+__kernel void exchange_mark(__global MMD_floatK3* x, __global int* flag, struct ExchangeParams p)
+{
+  int i = get_global_id(0);
+  if(i < p.n)
+  {
+    MMD_float xd = coord(x[i], p.idim);
+    flag[i] = (xd < p.lo || xd >= p.hi);
+  }
+}
+
+/* leaving atoms go to the send buffer, those below nkeep leave a hole */
+
+__kernel void exchange_pack(__global MMD_floatK3* x, __global MMD_floatK3* v, __global int* flag, __global int* pos,
+                            __global int* holes, __global MMD_float* buf, struct ExchangeParams p)
+{
+  int i = get_global_id(0);
+  if(i < p.n && flag[i])
+  {
+    int k = pos[i];
+    MMD_floatK3 xi = x[i];
+    MMD_floatK3 vi = v[i];
+    buf[6*k] = xi.x;
+    buf[6*k+1] = xi.y;
+    buf[6*k+2] = xi.z;
+    buf[6*k+3] = vi.x;
+    buf[6*k+4] = vi.y;
+    buf[6*k+5] = vi.z;
+    if(i < p.nkeep) holes[k] = i;
+  }
+}
+
+/* the staying atoms at or above nkeep are exactly as many as the holes
+   below it, the r-th of them moves into the r-th hole */
+
+__kernel void exchange_fill(__global MMD_floatK3* x, __global MMD_floatK3* v, __global int* flag, __global int* pos,
+                            __global int* holes, struct ExchangeParams p)
+{
+  int i = p.nkeep + get_global_id(0);
+  if(i < p.n && !flag[i])
+  {
+    int r = (i - p.nkeep) - (pos[i] - pos[p.nkeep]);
+    int j = holes[r];
+    x[j] = x[i];
+    v[j] = v[i];
+  }
+}
+
+__kernel void exchange_recv_mark(__global MMD_float* buf, __global int* flag, struct ExchangeParams p)
+{
+  int m = get_global_id(0);
+  if(m < p.n)
+  {
+    MMD_float value = buf[6*m+p.idim];
+    flag[m] = (value >= p.lo && value < p.hi);
+  }
+}
+
+__kernel void exchange_unpack(__global MMD_floatK3* x, __global MMD_floatK3* v, __global MMD_float* buf,
+                              __global int* flag, __global int* pos, struct ExchangeParams p)
+{
+  int m = get_global_id(0);
+  if(m < p.n && flag[m])
+  {
+    int i = p.first + pos[m];
+    MMD_floatK3 xi, vi;
+    xi.x = buf[6*m];
+    xi.y = buf[6*m+1];
+    xi.z = buf[6*m+2];
+    vi.x = buf[6*m+3];
+    vi.y = buf[6*m+4];
+    vi.z = buf[6*m+5];
+    x[i] = xi;
+    v[i] = vi;
+  }
+}
+
+/* borders: flag[k] refers to atom first+k */
+
+__kernel void border_mark(__global MMD_floatK3* x, __global int* flag, struct ExchangeParams p)
+{
+  int k = get_global_id(0);
+  if(k < p.n)
+  {
+    MMD_float xd = coord(x[p.first+k], p.idim);
+    flag[k] = (xd >= p.lo && xd < p.hi);
+  }
+}
+
+__kernel void border_pack(__global MMD_floatK3* x, __global int* flag, __global int* pos, __global int* list,
+                          __global MMD_float* buf, struct ExchangeParams p)
+{
+  int k = get_global_id(0);
+  if(k < p.n && flag[k])
+  {
+    int i = p.first + k;
+    int m = pos[k];
+    MMD_floatK3 xi = x[i] + p.shift;
+    list[p.offset+m] = i;
+    buf[3*m] = xi.x;
+    buf[3*m+1] = xi.y;
+    buf[3*m+2] = xi.z;
+  }
+}
+
+__kernel void border_unpack(__global MMD_floatK3* x, __global MMD_float* buf, struct ExchangeParams p)
+{
+  int m = get_global_id(0);
+  if(m < p.n)
+  {
+    MMD_floatK3 xi;
+    xi.x = buf[3*m];
+    xi.y = buf[3*m+1];
+    xi.z = buf[3*m+2];
+    x[p.first+m] = xi;
+  }
+}
+
+/* integrate_pack slot map (see Comm::borders)
+   fuse_clear: p.n local atoms, fuse_slots: p.n entries of swap p.idim */
+
+__kernel void fuse_clear(__global int* slot, struct ExchangeParams p)
+{
+  int i = get_global_id(0);
+  if(i < FUSED_SWAPS*p.n) slot[i] = -1;
+}
+
+__kernel void fuse_slots(__global int* list, __global int* slot, struct ExchangeParams p)
+{
+  int k = get_global_id(0);
+  if(k < p.n)
+    slot[FUSED_SWAPS*list[p.offset+k]+p.idim] = k;
+}
@@ -31,54 +31,414 @@
 
 #include "stdio.h"
 #include "math.h"
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include "string.h"
+#include <vector>
 #include "force.h"
+#include "force_eam.h"
 
-Force::Force() {}
-Force::~Force() {}
+Force::Force()
+{
+  k_compute = -1;
+  use_sse = 0;
+  pool = NULL;
+  eam = NULL;
+  pair_style = PAIR_LJ;
+  pair_coeff[0] = pair_coeff[1] = 1.0;
+  pair_coeff[2] = 0.0;
+  d_ptab = NULL;
+  ntab = 0;
+  etab = NULL;
+}
+Force::~Force()
+{
+  delete d_ptab;
+  delete[] etab;
+}
+
+/* the pair style is compiled into force_kernel.h and thermo_kernel.h,
+   so this has to run before the first force or thermo launch */
 
 void Force::setup()
 {
   cutforcesq = cutforce*cutforce;
+
+  char opts[512];
+  pair_options(opts);
+  mcl->SourceOptions("force_kernel.h", opts);
+  mcl->SourceOptions("thermo_kernel.h", opts);
+
+  if(pair_style == PAIR_TABLE)
+    d_ptab = ForceEAM::interpolate(mcl, ntab, dtab, etab);
+  else
+    d_ptab = new cMCLData<MMD_float, xx>(mcl, MCL_ARG_INPUT | MCL_ARG_RESIDENT | MCL_ARG_BUFFER | MCL_ARG_RDONLY, 7);
 }
 
-mcl_handle* Force::compute(Atom &atom, Neighbor &neighbor, int nwait, mcl_handle** waitlist)
+/* select the pair style (lj, ljsf, morse, buck or table), 1 on error
+   coeffs: "eps,sigma" for lj/ljsf (default 1,1), "D0,alpha,r0" for morse,
+   "A,rho,C" for buck; table reads "r E(r)" lines with equally spaced r
+   from file, the last point sets the force cutoff */
+
+int Force::pair(const char* style, const char* coeffs, const char* file)
+{
+  const char* names[] = {"lj", "ljsf", "morse", "buck", "table"};
+  pair_style = -1;
+  for(int i = 0; i < 5; i++)
+    if(strcmp(style, names[i]) == 0) pair_style = i;
+  if(pair_style < 0) {
+    printf("ERROR: Unknown pair style %s\n", style);
+    return 1;
+  }
+
+  int n = coeffs ? sscanf(coeffs, "%lg,%lg,%lg", &pair_coeff[0], &pair_coeff[1], &pair_coeff[2]) : 0;
+  if((pair_style == PAIR_MORSE || pair_style == PAIR_BUCK) && n != 3) {
+    printf("ERROR: Pair style %s needs --pair_coeff with 3 values\n", style);
+    return 1;
+  }
+  if((pair_style == PAIR_LJ || pair_style == PAIR_LJSF) && n != 0 && n != 2) {
+    printf("ERROR: Pair style %s takes --pair_coeff eps,sigma\n", style);
+    return 1;
+  }
+  if(pair_style != PAIR_TABLE) return 0;
+
+  FILE* fptr = fopen(file, "r");
+  if(fptr == NULL) {
+    printf("ERROR: Cannot open pair table %s\n", file);
+    return 1;
+  }
+  std::vector<double> r, e;
+  char line[256];
+  while(fgets(line, 256, fptr)) {
+    double rv, ev;
+    if(line[0] == '#' || sscanf(line, "%lg %lg", &rv, &ev) != 2) continue;
+    r.push_back(rv);
+    e.push_back(ev);
+  }
+  fclose(fptr);
+
+  ntab = r.size();
+  if(ntab < 4) {
+    printf("ERROR: Pair table %s needs at least 4 points\n", file);
+    return 1;
+  }
+  rtab = r[0];
+  dtab = (r[ntab-1] - r[0]) / (ntab - 1);
+  for(int k = 1; k < ntab; k++)
+    if(dtab <= 0 || fabs(r[k] - rtab - k*dtab) > 1e-4*dtab) {
+      printf("ERROR: Pair table %s is not equally spaced in r\n", file);
+      return 1;
+    }
+  etab = new MMD_float[ntab + 1];
+  for(int k = 0; k < ntab; k++) etab[k+1] = e[k];
+  cutforce = r[ntab-1];
+  return 0;
+}
+
+/* -D build options of the pair style, coefficients as literals of
+   MMD_float precision (see pair_kernel.h for their meaning) */
+
+void Force::pair_options(char* opts)
+{
+  double c[7] = {0, 0, 0, 0, 0, 0, 0};
+  int nc = 3;
+
+  if(pair_style == PAIR_LJ || pair_style == PAIR_LJSF) {
+    double eps = pair_coeff[0], s6 = pow(pair_coeff[1], 6.0);
+    c[0] = 48.0*eps*s6*s6;
+    c[1] = 24.0*eps*s6;
+    c[2] = 4.0*eps*s6*s6;
+    c[3] = 4.0*eps*s6;
+    nc = 4;
+    if(pair_style == PAIR_LJSF) {
+      double sr2 = 1.0/(cutforce*cutforce);
+      double sr6 = sr2*sr2*sr2;
+      c[4] = sr6*(c[0]*sr6 - c[1])*sr2*cutforce;
+      c[5] = sr6*(c[2]*sr6 - c[3]);
+      c[6] = cutforce;
+      nc = 7;
+    }
+  } else if(pair_style == PAIR_MORSE) {
+    c[0] = pair_coeff[0];
+    c[1] = pair_coeff[1];
+    c[2] = pair_coeff[2];
+  } else if(pair_style == PAIR_BUCK) {
+    c[0] = pair_coeff[0];
+    c[1] = 1.0/pair_coeff[1];
+    c[2] = pair_coeff[2];
+  } else {
+    c[0] = rtab;
+    c[1] = 1.0/dtab;
+    c[2] = ntab;
+  }
+
+  int len = sprintf(opts, "-DPAIR_STYLE=%i", pair_style);
+  for(int i = 0; i < nc; i++)
+    len += sprintf(opts + len, sizeof(MMD_float) == 4 ? " -DPAIR_C%i=%.9ef" : " -DPAIR_C%i=%.17e", i, c[i]);
+}
+
+void Force::find_kernels()
+{
+  k_compute = mcl->Kernel("force_kernel.h", "force_compute");
+  k_loop = mcl->Kernel("force_kernel.h", "force_compute_loop");
+  k_split = mcl->Kernel("force_kernel.h", "force_compute_split");
+  k_integrate = mcl->Kernel("force_kernel.h", "force_integrate");
+  k_clear = mcl->Kernel("force_kernel.h", "force_clear");
+  k_half = mcl->Kernel("force_kernel.h", "force_compute_half");
+  k_cluster = mcl->Kernel("cluster_kernel.h", "force_cluster");
+  k_ev = mcl->Kernel("force_kernel.h", "force_compute_ev");
+}
+
+void Force::set_params(ForceParams &p, Atom &atom, Neighbor &neighbor)
+{
+  p.cutforcesq = cutforcesq;
+  p.dtforce = 0;
+  p.maxneighs = neighbor.maxneighs;
+  p.nlocal = atom.nlocal;
+  p.nall = atom.nlocal + atom.nghost;
+  p.threads_per_atom = atom.threads_per_atom;
+  p.ghost_newton = neighbor.ghost_newton;
+  p.compress = neighbor.compress;
+}
+
+/* with ev (only if can_tally) the pair energy and virial of the step are
+   tallied into ev, one partial sum per block of mcl->blockdim atoms */
+
+mcl_handle* Force::compute(Atom &atom, Neighbor &neighbor, int nwait, mcl_handle** waitlist, cMCLData<MMD_acc, xx>* ev)
 {
   mcl_handle* hdl;
-	if(atom.threads_per_atom<0)
-	    hdl = mcl->LaunchKernel("force_kernel.h", "force_compute_loop",-(atom.nlocal-atom.threads_per_atom-1)/atom.threads_per_atom, nwait, waitlist, 8,
+  if(k_compute<0) find_kernels();
+
+  ForceParams p;
+  set_params(p, atom, neighbor);
+
+	if(neighbor.cluster) {
+	    /* CLUSTER x CLUSTER tiles over the cluster pair list, see cluster_kernel.h */
+	    ClusterParams cp;
+	    neighbor.cluster_params(cp, atom);
+	    cp.cutforcesq = cutforcesq;
+	    hdl = mcl->LaunchKernel(k_cluster,cp.nclusters, nwait, waitlist, &cp, sizeof(cp), 6,
+	    		atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags(),
+	    		atom.d_f->devData(),atom.d_f->devSize(), atom.d_f->mclFlags(),
+	    		neighbor.d_bincount->devData(),neighbor.d_bincount->devSize(), neighbor.d_bincount->mclFlags(),
+	    		neighbor.d_bins->devData(),neighbor.d_bins->devSize(), neighbor.d_bins->mclFlags(),
+	    		neighbor.d_ncpairs->devData(),neighbor.d_ncpairs->devSize(), neighbor.d_ncpairs->mclFlags(),
+	    		neighbor.d_cpairs->devData(),neighbor.d_cpairs->devSize(), neighbor.d_cpairs->mclFlags());
+	}
+	else if(neighbor.halfneigh) {
+	    /* reaction forces are scattered to j, so f has to be zeroed first */
+	    mcl_handle* clear = mcl->LaunchKernel(k_clear, p.nall, nwait, waitlist, &p, sizeof(p), 1,
+	    		atom.d_f->devData(),atom.d_f->devSize(), atom.d_f->mclFlags());
+	    mcl->Retire(clear);
+	    hdl = mcl->LaunchKernel(k_half,atom.nlocal, 1, &clear, &p, sizeof(p), 5,
 	    		atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags(),
 	    		atom.d_f->devData(),atom.d_f->devSize(), atom.d_f->mclFlags(),
 	    		neighbor.d_numneigh->devData(),neighbor.d_numneigh->devSize(), neighbor.d_numneigh->mclFlags(),
 	    		neighbor.d_neighbors->devData(),neighbor.d_neighbors->devSize(), neighbor.d_neighbors->mclFlags(),
-	    		&neighbor.maxneighs,sizeof(neighbor.maxneighs), MCL_ARG_SCALAR,
-          &atom.nlocal,sizeof(atom.nlocal), MCL_ARG_SCALAR,
-	    		&cutforcesq,sizeof(cutforcesq), MCL_ARG_SCALAR,
-          &atom.threads_per_atom,sizeof(atom.threads_per_atom), MCL_ARG_SCALAR);
+	    		d_ptab->devData(),d_ptab->devSize(), d_ptab->mclFlags());
+	}
+	else if(atom.threads_per_atom<0)
+	    hdl = mcl->LaunchKernel(k_loop,-(atom.nlocal-atom.threads_per_atom-1)/atom.threads_per_atom, nwait, waitlist, &p, sizeof(p), 5,
+	    		atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags(),
+	    		atom.d_f->devData(),atom.d_f->devSize(), atom.d_f->mclFlags(),
+	    		neighbor.d_numneigh->devData(),neighbor.d_numneigh->devSize(), neighbor.d_numneigh->mclFlags(),
+	    		neighbor.d_neighbors->devData(),neighbor.d_neighbors->devSize(), neighbor.d_neighbors->mclFlags(),
+	    		d_ptab->devData(),d_ptab->devSize(), d_ptab->mclFlags());
 	else if(atom.threads_per_atom>1)
-	    hdl = mcl->LaunchKernel("force_kernel.h", "force_compute_split",atom.nlocal*atom.threads_per_atom, nwait, waitlist, 9,
+	    hdl = mcl->LaunchKernel(k_split,atom.nlocal*atom.threads_per_atom, nwait, waitlist, &p, sizeof(p), 6,
 	    		atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags(),
 	    		atom.d_f->devData(),atom.d_f->devSize(), atom.d_f->mclFlags(),
 	    		neighbor.d_numneigh->devData(),neighbor.d_numneigh->devSize(), neighbor.d_numneigh->mclFlags(),
 	    		neighbor.d_neighbors->devData(),neighbor.d_neighbors->devSize(), neighbor.d_neighbors->mclFlags(),
-	    		&neighbor.maxneighs,sizeof(neighbor.maxneighs), MCL_ARG_SCALAR,
-          &atom.nlocal,sizeof(atom.nlocal), MCL_ARG_SCALAR,
-	    		&cutforcesq,sizeof(cutforcesq), MCL_ARG_SCALAR,
-          &atom.threads_per_atom,sizeof(atom.threads_per_atom), MCL_ARG_SCALAR,
-	    		NULL,sizeof(MMD_float3)*mcl->blockdim, MCL_ARG_LOCAL);
+	    		NULL,4*sizeof(MMD_acc)*mcl->blockdim, MCL_ARG_LOCAL,
+	    		d_ptab->devData(),d_ptab->devSize(), d_ptab->mclFlags());
 	else if(atom.use_tex)
       //Unsupported image type
       throw "Use TEX unsupported.";
+  else if(ev)
+      hdl = mcl->LaunchKernel(k_ev,atom.nlocal, nwait, waitlist, &p, sizeof(p), 7,
+              atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags(),
+              atom.d_f->devData(),atom.d_f->devSize(), atom.d_f->mclFlags(),
+              neighbor.d_numneigh->devData(),neighbor.d_numneigh->devSize(), neighbor.d_numneigh->mclFlags(),
+              neighbor.d_neighbors->devData(),neighbor.d_neighbors->devSize(), neighbor.d_neighbors->mclFlags(),
+              d_ptab->devData(),d_ptab->devSize(), d_ptab->mclFlags(),
+              ev->devData(),ev->devSize(), ev->mclFlags(),
+              NULL,2*sizeof(MMD_acc)*mcl->blockdim, MCL_ARG_LOCAL);
   else {
       // fprintf(stderr, "Launching handle for force compute, nlocal: %d\n", atom.nlocal);
-      hdl = mcl->LaunchKernel("force_kernel.h", "force_compute",atom.nlocal, nwait, waitlist, 7,
+      hdl = mcl->LaunchKernel(k_compute,atom.nlocal, nwait, waitlist, &p, sizeof(p), 5,
               atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags(),
               atom.d_f->devData(),atom.d_f->devSize(), atom.d_f->mclFlags(),
               neighbor.d_numneigh->devData(),neighbor.d_numneigh->devSize(), neighbor.d_numneigh->mclFlags(),
               neighbor.d_neighbors->devData(),neighbor.d_neighbors->devSize(), neighbor.d_neighbors->mclFlags(),
-              &neighbor.maxneighs,sizeof(neighbor.maxneighs), MCL_ARG_SCALAR,
-              &atom.nlocal,sizeof(atom.nlocal), MCL_ARG_SCALAR,
-              &cutforcesq,sizeof(cutforcesq), MCL_ARG_SCALAR);
+              d_ptab->devData(),d_ptab->devSize(), d_ptab->mclFlags());
   }
 
   return hdl;
 }
+
+/* force_compute with the integrate_final velocity update folded in,
+   only for the one thread per atom kernel (see can_fuse) */
+
+mcl_handle* Force::compute_integrate(Atom &atom, Neighbor &neighbor, MMD_float dtforce, uint64_t vflags, int nwait, mcl_handle** waitlist)
+{
+  if(k_compute<0) find_kernels();
+
+  ForceParams p;
+  set_params(p, atom, neighbor);
+  p.dtforce = dtforce;
+
+  return mcl->LaunchKernel(k_integrate, atom.nlocal, nwait, waitlist, &p, sizeof(p), 6,
+          atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags(),
+          atom.d_f->devData(),atom.d_f->devSize(), atom.d_f->mclFlags(),
+          atom.d_v->devData(),atom.d_v->devSize(), atom.d_v->mclFlags() | vflags,
+          neighbor.d_numneigh->devData(),neighbor.d_numneigh->devSize(), neighbor.d_numneigh->mclFlags(),
+          neighbor.d_neighbors->devData(),neighbor.d_neighbors->devSize(), neighbor.d_neighbors->mclFlags(),
+          d_ptab->devData(),d_ptab->devSize(), d_ptab->mclFlags());
+}
+
+/* native backend: forces of owned atoms lo..hi-1 from the row major host
+   lists of Neighbor::build_native, neighbors are processed one vector of
+   gathered positions at a time, MMD_float3 is padded to 4 components */
+
+void Force::compute_native(Atom &atom, Neighbor &neighbor, int lo, int hi)
+{
+  MMD_float3* x = atom.x;
+  MMD_float3* f = atom.f;
+#if defined(__AVX2__) || defined(__AVX512F__)
+  const MMD_float* xb = (const MMD_float*) x;
+#endif
+  const int maxneighs = neighbor.maxneighs;
+
+  for (int i = lo; i < hi; i++) {
+    const int* neighs = &neighbor.neighbors[i * maxneighs];
+    const int numneighs = neighbor.numneigh[i];
+    const MMD_float xtmp = x[i].x;
+    const MMD_float ytmp = x[i].y;
+    const MMD_float ztmp = x[i].z;
+    MMD_acc fix = 0;
+    MMD_acc fiy = 0;
+    MMD_acc fiz = 0;
+    int k = 0;
+
+#if defined(__AVX512F__) && MDPREC != 2
+    __m512 xi = _mm512_set1_ps(xtmp), yi = _mm512_set1_ps(ytmp), zi = _mm512_set1_ps(ztmp);
+    __m512 cut = _mm512_set1_ps(cutforcesq);
+    __m512 fx = _mm512_setzero_ps(), fy = _mm512_setzero_ps(), fz = _mm512_setzero_ps();
+    for (; k + 16 <= numneighs; k += 16) {
+      __m512i j = _mm512_slli_epi32(_mm512_loadu_si512(&neighs[k]), 2);
+      __m512 delx = _mm512_sub_ps(xi, _mm512_i32gather_ps(j, xb, 4));
+      __m512 dely = _mm512_sub_ps(yi, _mm512_i32gather_ps(j, xb + 1, 4));
+      __m512 delz = _mm512_sub_ps(zi, _mm512_i32gather_ps(j, xb + 2, 4));
+      __m512 rsq = _mm512_fmadd_ps(delz, delz, _mm512_fmadd_ps(dely, dely, _mm512_mul_ps(delx, delx)));
+      __mmask16 in = _mm512_cmp_ps_mask(rsq, cut, _CMP_LT_OQ);
+      __m512 sr2 = _mm512_maskz_div_ps(in, _mm512_set1_ps(1.0f), rsq);
+      __m512 sr6 = _mm512_mul_ps(sr2, _mm512_mul_ps(sr2, sr2));
+      __m512 force = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(48.0f), sr6),
+                                   _mm512_mul_ps(_mm512_sub_ps(sr6, _mm512_set1_ps(0.5f)), sr2));
+      fx = _mm512_fmadd_ps(force, delx, fx);
+      fy = _mm512_fmadd_ps(force, dely, fy);
+      fz = _mm512_fmadd_ps(force, delz, fz);
+    }
+    fix += _mm512_reduce_add_ps(fx);
+    fiy += _mm512_reduce_add_ps(fy);
+    fiz += _mm512_reduce_add_ps(fz);
+#elif defined(__AVX512F__) && MDPREC == 2
+    __m512d xi = _mm512_set1_pd(xtmp), yi = _mm512_set1_pd(ytmp), zi = _mm512_set1_pd(ztmp);
+    __m512d cut = _mm512_set1_pd(cutforcesq);
+    __m512d fx = _mm512_setzero_pd(), fy = _mm512_setzero_pd(), fz = _mm512_setzero_pd();
+    for (; k + 8 <= numneighs; k += 8) {
+      __m256i j = _mm256_slli_epi32(_mm256_loadu_si256((const __m256i*) &neighs[k]), 2);
+      __m512d delx = _mm512_sub_pd(xi, _mm512_i32gather_pd(j, xb, 8));
+      __m512d dely = _mm512_sub_pd(yi, _mm512_i32gather_pd(j, xb + 1, 8));
+      __m512d delz = _mm512_sub_pd(zi, _mm512_i32gather_pd(j, xb + 2, 8));
+      __m512d rsq = _mm512_fmadd_pd(delz, delz, _mm512_fmadd_pd(dely, dely, _mm512_mul_pd(delx, delx)));
+      __mmask8 in = _mm512_cmp_pd_mask(rsq, cut, _CMP_LT_OQ);
+      __m512d sr2 = _mm512_maskz_div_pd(in, _mm512_set1_pd(1.0), rsq);
+      __m512d sr6 = _mm512_mul_pd(sr2, _mm512_mul_pd(sr2, sr2));
+      __m512d force = _mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(48.0), sr6),
+                                    _mm512_mul_pd(_mm512_sub_pd(sr6, _mm512_set1_pd(0.5)), sr2));
+      fx = _mm512_fmadd_pd(force, delx, fx);
+      fy = _mm512_fmadd_pd(force, dely, fy);
+      fz = _mm512_fmadd_pd(force, delz, fz);
+    }
+    fix += _mm512_reduce_add_pd(fx);
+    fiy += _mm512_reduce_add_pd(fy);
+    fiz += _mm512_reduce_add_pd(fz);
+#elif defined(__AVX2__) && MDPREC != 2
+    __m256 xi = _mm256_set1_ps(xtmp), yi = _mm256_set1_ps(ytmp), zi = _mm256_set1_ps(ztmp);
+    __m256 cut = _mm256_set1_ps(cutforcesq);
+    __m256 fx = _mm256_setzero_ps(), fy = _mm256_setzero_ps(), fz = _mm256_setzero_ps();
+    for (; k + 8 <= numneighs; k += 8) {
+      __m256i j = _mm256_slli_epi32(_mm256_loadu_si256((const __m256i*) &neighs[k]), 2);
+      __m256 delx = _mm256_sub_ps(xi, _mm256_i32gather_ps(xb, j, 4));
+      __m256 dely = _mm256_sub_ps(yi, _mm256_i32gather_ps(xb + 1, j, 4));
+      __m256 delz = _mm256_sub_ps(zi, _mm256_i32gather_ps(xb + 2, j, 4));
+      __m256 rsq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(delx, delx), _mm256_mul_ps(dely, dely)), _mm256_mul_ps(delz, delz));
+      __m256 in = _mm256_cmp_ps(rsq, cut, _CMP_LT_OQ);
+      __m256 sr2 = _mm256_and_ps(in, _mm256_div_ps(_mm256_set1_ps(1.0f), rsq));
+      __m256 sr6 = _mm256_mul_ps(sr2, _mm256_mul_ps(sr2, sr2));
+      __m256 force = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(48.0f), sr6),
+                                   _mm256_mul_ps(_mm256_sub_ps(sr6, _mm256_set1_ps(0.5f)), sr2));
+      fx = _mm256_add_ps(fx, _mm256_mul_ps(force, delx));
+      fy = _mm256_add_ps(fy, _mm256_mul_ps(force, dely));
+      fz = _mm256_add_ps(fz, _mm256_mul_ps(force, delz));
+    }
+    float sum[8];
+    _mm256_storeu_ps(sum, fx);
+    for (int l = 0; l < 8; l++) fix += sum[l];
+    _mm256_storeu_ps(sum, fy);
+    for (int l = 0; l < 8; l++) fiy += sum[l];
+    _mm256_storeu_ps(sum, fz);
+    for (int l = 0; l < 8; l++) fiz += sum[l];
+#elif defined(__AVX2__) && MDPREC == 2
+    __m256d xi = _mm256_set1_pd(xtmp), yi = _mm256_set1_pd(ytmp), zi = _mm256_set1_pd(ztmp);
+    __m256d cut = _mm256_set1_pd(cutforcesq);
+    __m256d fx = _mm256_setzero_pd(), fy = _mm256_setzero_pd(), fz = _mm256_setzero_pd();
+    for (; k + 4 <= numneighs; k += 4) {
+      __m128i j = _mm_slli_epi32(_mm_loadu_si128((const __m128i*) &neighs[k]), 2);
+      __m256d delx = _mm256_sub_pd(xi, _mm256_i32gather_pd(xb, j, 8));
+      __m256d dely = _mm256_sub_pd(yi, _mm256_i32gather_pd(xb + 1, j, 8));
+      __m256d delz = _mm256_sub_pd(zi, _mm256_i32gather_pd(xb + 2, j, 8));
+      __m256d rsq = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(delx, delx), _mm256_mul_pd(dely, dely)), _mm256_mul_pd(delz, delz));
+      __m256d in = _mm256_cmp_pd(rsq, cut, _CMP_LT_OQ);
+      __m256d sr2 = _mm256_and_pd(in, _mm256_div_pd(_mm256_set1_pd(1.0), rsq));
+      __m256d sr6 = _mm256_mul_pd(sr2, _mm256_mul_pd(sr2, sr2));
+      __m256d force = _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(48.0), sr6),
+                                    _mm256_mul_pd(_mm256_sub_pd(sr6, _mm256_set1_pd(0.5)), sr2));
+      fx = _mm256_add_pd(fx, _mm256_mul_pd(force, delx));
+      fy = _mm256_add_pd(fy, _mm256_mul_pd(force, dely));
+      fz = _mm256_add_pd(fz, _mm256_mul_pd(force, delz));
+    }
+    double sum[4];
+    _mm256_storeu_pd(sum, fx);
+    for (int l = 0; l < 4; l++) fix += sum[l];
+    _mm256_storeu_pd(sum, fy);
+    for (int l = 0; l < 4; l++) fiy += sum[l];
+    _mm256_storeu_pd(sum, fz);
+    for (int l = 0; l < 4; l++) fiz += sum[l];
+#endif
+
+    /* remainder, or everything without AVX2 */
+    for (; k < numneighs; k++) {
+      const int j = neighs[k];
+      const MMD_float delx = xtmp - x[j].x;
+      const MMD_float dely = ytmp - x[j].y;
+      const MMD_float delz = ztmp - x[j].z;
+      const MMD_float rsq = delx * delx + dely * dely + delz * delz;
+      if (rsq < cutforcesq) {
+        const MMD_float sr2 = 1.0 / rsq;
+        const MMD_float sr6 = sr2 * sr2 * sr2;
+        const MMD_float force = 48.0 * sr6 * (sr6 - 0.5) * sr2;
+        fix += delx * force;
+        fiy += dely * force;
+        fiz += delz * force;
+      }
+    }
+
+    f[i].x = fix;
+    f[i].y = fiy;
+    f[i].z = fiz;
+  }
+}
@@ -36,20 +36,48 @@
 #include "neighbor.h"
 #include "mcl_wrapper.h"
 #include "mcl_data.h"
+#include "kernel_params.h"
+#include "pair_kernel.h"
+#include "threadpool.h"
 #include "precision.h"
 
+class ForceEAM;
+
 class Force {
  public:
   MMD_float cutforce;
   MMD_float cutforcesq;
 
   MCLWrapper* mcl;
+  int k_compute, k_loop, k_split, k_integrate;  // registered kernel ids, looked up on first use
+  int k_clear, k_half, k_cluster, k_ev;
 
   Force();
   ~Force();
   void setup();
-  mcl_handle* compute(Atom &, Neighbor &, int nwait, mcl_handle** waitlist);
-  int use_sse;
+  mcl_handle* compute(Atom &, Neighbor &, int nwait, mcl_handle** waitlist, cMCLData<MMD_acc, xx>* ev = NULL);
+  mcl_handle* compute_integrate(Atom &, Neighbor &, MMD_float dtforce, uint64_t vflags, int nwait, mcl_handle** waitlist);
+  int can_fuse(Atom &atom, Neighbor &neighbor) {return atom.threads_per_atom==1 && !atom.use_tex && !neighbor.halfneigh && !neighbor.cluster && !eam;};
+  int can_tally(Atom &atom, Neighbor &neighbor) {return can_fuse(atom, neighbor);};  // compute() with ev, see Thermo::tally
+  int use_sse;                     // threads of the native CPU backend, 0: MCL kernels
+  ThreadPool* pool;                // set with use_sse
+  ForceEAM* eam;                   // set with --force eam, replaces compute(), see force_eam.h
+
+  int pair_style;                  // PAIR_* of pair_kernel.h, built into the kernels
+  double pair_coeff[3];            // --pair_coeff, see Force::pair
+  cMCLData<MMD_float, xx>* d_ptab; // PAIR_TABLE spline, a placeholder for the other styles
+  int pair(const char* style, const char* coeffs, const char* file);  // 1 on error
+  int pair_is_lj() {return pair_style==PAIR_LJ && pair_coeff[0]==1.0 && pair_coeff[1]==1.0;};
+
+  void compute_native(Atom &, Neighbor &, int lo, int hi);
+
+ private:
+  void find_kernels();
+  void set_params(ForceParams &, Atom &, Neighbor &);
+  void pair_options(char* opts);
+  int ntab;                        // PAIR_TABLE points, 1-based in etab
+  double rtab, dtab;               // r of the first point and spacing
+  MMD_float* etab;
 };
 
 #endif
@@ -0,0 +1,334 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+#include "force_eam.h"
+
+#define MAXLINE 1024
+#define BUFFACTOR 1.5
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+ForceEAM::ForceEAM()
+{
+  cutforce = 0.0;
+  cutforcesq = 0.0;
+  mass = 1.0;
+  k_density = -1;
+  nparts = 0;
+  frho = rhor = z2r = NULL;
+  funcfl.frho = funcfl.rhor = funcfl.zr = NULL;
+  d_frho_spline = d_rhor_spline = d_z2r_spline = NULL;
+  d_fp = NULL;
+  maxfp = NULL;
+}
+
+ForceEAM::~ForceEAM()
+{
+  delete[] funcfl.frho;
+  delete[] funcfl.rhor;
+  delete[] funcfl.zr;
+  delete[] frho;
+  delete[] rhor;
+  delete[] z2r;
+}
+
+/* read a DYNAMO funcfl file:
+   comment line, "element mass", "nrho drho nr dr cut",
+   then F(rho), Z(r) and rho(r) tabulated on the nrho/nr grids */
+
+int ForceEAM::coeff(const char* filename)
+{
+  Funcfl* file = &funcfl;
+  char line[MAXLINE];
+  int tmp;
+
+  FILE* fptr = fopen(filename, "r");
+  if(fptr == NULL) {
+    printf("ERROR: Cannot open EAM potential file %s\n", filename);
+    return 1;
+  }
+
+  fgets(line, MAXLINE, fptr);
+  fgets(line, MAXLINE, fptr);
+  sscanf(line, "%d %lg", &tmp, &file->mass);
+  fgets(line, MAXLINE, fptr);
+  sscanf(line, "%d %lg %d %lg %lg", &file->nrho, &file->drho, &file->nr, &file->dr, &file->cut);
+
+  file->frho = new MMD_float[file->nrho + 1];
+  file->rhor = new MMD_float[file->nr + 1];
+  file->zr = new MMD_float[file->nr + 1];
+  grab(fptr, file->nrho, &file->frho[1]);
+  grab(fptr, file->nr, &file->zr[1]);
+  grab(fptr, file->nr, &file->rhor[1]);
+  fclose(fptr);
+
+  mass = file->mass;
+  cutforce = file->cut;
+  cutforcesq = cutforce * cutforce;
+  return 0;
+}
+
+/* grab n values from the file, any number per line */
+
+void ForceEAM::grab(FILE* fptr, int n, MMD_float* list)
+{
+  char* ptr;
+  char line[MAXLINE];
+
+  int i = 0;
+  while(i < n) {
+    if(fgets(line, MAXLINE, fptr) == NULL) break;
+    ptr = strtok(line, " \t\n\r\f");
+    while(ptr && i < n) {
+      list[i++] = atof(ptr);
+      ptr = strtok(NULL, " \t\n\r\f");
+    }
+  }
+}
+
+/* spline tables and per partition fp arrays, after coeff() */
+
+void ForceEAM::setup(int partitions)
+{
+  nparts = partitions;
+  file2array();
+  array2spline();
+
+  k_density = mcl->Kernel("force_eam_kernel.h", "eam_density");
+  k_force = mcl->Kernel("force_eam_kernel.h", "eam_force");
+  k_energy = mcl->Kernel("force_eam_kernel.h", "eam_energy");
+
+  d_fp = new cMCLData<MMD_float, xx>*[nparts];
+  maxfp = new int[nparts];
+  for(int j = 0; j < nparts; j++) {
+    d_fp[j] = NULL;
+    maxfp[j] = 0;
+  }
+}
+
+/* interpolate the file tables to the grids of the splines
+   (a single funcfl file, so the grids are the ones of the file) */
+
+void ForceEAM::file2array()
+{
+  Funcfl* file = &funcfl;
+  double sixth = 1.0 / 6.0;
+  double r, p, cof1, cof2, cof3, cof4;
+  int k, m;
+
+  dr = file->dr;
+  drho = file->drho;
+  double rmax = (file->nr - 1) * file->dr;
+  double rhomax = (file->nrho - 1) * file->drho;
+
+  // 0.5 is for round-off in divide
+  nr = static_cast<int>(rmax / dr + 0.5);
+  nrho = static_cast<int>(rhomax / drho + 0.5);
+
+  frho = new MMD_float[nrho + 1];
+  for(m = 1; m <= nrho; m++) {
+    r = (m - 1) * drho;
+    p = r / file->drho + 1.0;
+    k = static_cast<int>(p);
+    k = MIN(k, file->nrho - 2);
+    k = MAX(k, 2);
+    p -= k;
+    p = MIN(p, 2.0);
+    cof1 = -sixth * p * (p - 1.0) * (p - 2.0);
+    cof2 = 0.5 * (p * p - 1.0) * (p - 2.0);
+    cof3 = -0.5 * p * (p + 1.0) * (p - 2.0);
+    cof4 = sixth * p * (p * p - 1.0);
+    frho[m] = cof1 * file->frho[k - 1] + cof2 * file->frho[k] +
+              cof3 * file->frho[k + 1] + cof4 * file->frho[k + 2];
+  }
+
+  rhor = new MMD_float[nr + 1];
+  z2r = new MMD_float[nr + 1];
+  for(m = 1; m <= nr; m++) {
+    r = (m - 1) * dr;
+    p = r / file->dr + 1.0;
+    k = static_cast<int>(p);
+    k = MIN(k, file->nr - 2);
+    k = MAX(k, 2);
+    p -= k;
+    p = MIN(p, 2.0);
+    cof1 = -sixth * p * (p - 1.0) * (p - 2.0);
+    cof2 = 0.5 * (p * p - 1.0) * (p - 2.0);
+    cof3 = -0.5 * p * (p + 1.0) * (p - 2.0);
+    cof4 = sixth * p * (p * p - 1.0);
+    rhor[m] = cof1 * file->rhor[k - 1] + cof2 * file->rhor[k] +
+              cof3 * file->rhor[k + 1] + cof4 * file->rhor[k + 2];
+
+    // z2r = Z(r)^2 converted from Hartree*Bohr to eV*Angstrom
+    double zri = cof1 * file->zr[k - 1] + cof2 * file->zr[k] +
+                 cof3 * file->zr[k + 1] + cof4 * file->zr[k + 2];
+    z2r[m] = 27.2 * 0.529 * zri * zri;
+  }
+}
+
+void ForceEAM::array2spline()
+{
+  rdr = 1.0 / dr;
+  rdrho = 1.0 / drho;
+
+  d_frho_spline = interpolate(mcl, nrho, drho, frho);
+  d_rhor_spline = interpolate(mcl, nr, dr, rhor);
+  d_z2r_spline = interpolate(mcl, nr, dr, z2r);
+}
+
+/* cubic spline through f[1..n], coefficients 3-6 give the value and
+   0-2 the derivative in the fraction p of a grid interval
+   (also used for the tabulated pair style of Force) */
+
+cMCLData<MMD_float, xx>* ForceEAM::interpolate(MCLWrapper* mcl, int n, MMD_float delta, MMD_float* f)
+{
+  cMCLData<MMD_float, xx>* d_spline = new cMCLData<MMD_float, xx>(mcl,
+      MCL_ARG_INPUT | MCL_ARG_RESIDENT | MCL_ARG_BUFFER | MCL_ARG_RDONLY, (n + 1) * 7);
+  MMD_float* spline = d_spline->hostData();
+
+  for(int m = 0; m < 7; m++) spline[m] = 0.0;
+  for(int m = 1; m <= n; m++) spline[m * 7 + 6] = f[m];
+
+  spline[1 * 7 + 5] = spline[2 * 7 + 6] - spline[1 * 7 + 6];
+  spline[2 * 7 + 5] = 0.5 * (spline[3 * 7 + 6] - spline[1 * 7 + 6]);
+  spline[(n - 1) * 7 + 5] = 0.5 * (spline[n * 7 + 6] - spline[(n - 2) * 7 + 6]);
+  spline[n * 7 + 5] = spline[n * 7 + 6] - spline[(n - 1) * 7 + 6];
+
+  for(int m = 3; m <= n - 2; m++)
+    spline[m * 7 + 5] = ((spline[(m - 2) * 7 + 6] - spline[(m + 2) * 7 + 6]) +
+                         8.0 * (spline[(m + 1) * 7 + 6] - spline[(m - 1) * 7 + 6])) / 12.0;
+
+  for(int m = 1; m <= n - 1; m++) {
+    spline[m * 7 + 4] = 3.0 * (spline[(m + 1) * 7 + 6] - spline[m * 7 + 6]) -
+                        2.0 * spline[m * 7 + 5] - spline[(m + 1) * 7 + 5];
+    spline[m * 7 + 3] = spline[m * 7 + 5] + spline[(m + 1) * 7 + 5] -
+                        2.0 * (spline[(m + 1) * 7 + 6] - spline[m * 7 + 6]);
+  }
+
+  spline[n * 7 + 4] = 0.0;
+  spline[n * 7 + 3] = 0.0;
+
+  for(int m = 1; m <= n; m++) {
+    spline[m * 7 + 2] = spline[m * 7 + 5] / delta;
+    spline[m * 7 + 1] = 2.0 * spline[m * 7 + 4] / delta;
+    spline[m * 7 + 0] = 3.0 * spline[m * 7 + 3] / delta;
+  }
+  return d_spline;
+}
+
+/* realloc the fp array of a partition with BUFFACTOR, only between steps */
+
+void ForceEAM::growfp(int partition, int n)
+{
+  maxfp[partition] = static_cast<int>(BUFFACTOR * n);
+  if (d_fp[partition]) {
+    mcl_unregister_buffer(d_fp[partition]->devData());
+    delete d_fp[partition];
+  }
+  d_fp[partition] = new cMCLData<MMD_float, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, maxfp[partition], 0, 0);
+}
+
+void ForceEAM::set_params(EAMParams &p, Atom &atom, Neighbor &neighbor)
+{
+  p.cutforcesq = cutforcesq;
+  p.rdr = rdr;
+  p.rdrho = rdrho;
+  p.nlocal = atom.nlocal;
+  p.nr = nr;
+  p.nrho = nrho;
+  p.compress = neighbor.compress;
+  p.pad = 0;
+}
+
+/* density -> forward communication of fp -> force for all partitions
+   waitlist: handles of Comm::communicate (nswap per partition, stride
+   maxswap) or NULL, hdls receives the force handle of every partition
+   nothing waits on the host, so a partition whose ghosts are complete
+   starts on its forces while others are still computing densities */
+
+void ForceEAM::compute(Atom atom[], Neighbor neighbor[], Comm &comm, int reneigh, mcl_handle** waitlist, mcl_handle** hdls)
+{
+  mcl_handle** density = new mcl_handle*[nparts];
+  EAMParams* p = new EAMParams[nparts];
+
+  for(int j = 0; j < nparts; j++) {
+    if(atom[j].nmax > maxfp[j]) growfp(j, atom[j].nmax);
+    set_params(p[j], atom[j], neighbor[j]);
+    density[j] = mcl->LaunchKernel(k_density, atom[j].nlocal, waitlist ? comm.nhdls : 0, waitlist ? &waitlist[j * comm.maxswap] : NULL, &p[j], sizeof(EAMParams), 6,
+        atom[j].d_x->devData(), atom[j].d_x->devSize(), atom[j].d_x->mclFlags(),
+        neighbor[j].d_numneigh->devData(), neighbor[j].d_numneigh->devSize(), neighbor[j].d_numneigh->mclFlags(),
+        neighbor[j].d_neighbors->devData(), neighbor[j].d_neighbors->devSize(), neighbor[j].d_neighbors->mclFlags(),
+        d_fp[j]->devData(), d_fp[j]->devSize(), d_fp[j]->mclFlags(),
+        d_rhor_spline->devData(), d_rhor_spline->devSize(), d_rhor_spline->mclFlags(),
+        d_frho_spline->devData(), d_frho_spline->devSize(), d_frho_spline->mclFlags());
+    mcl->Retire(density[j]);
+  }
+
+  mcl_handle** ghosts = comm.communicate_scalar(atom, d_fp, reneigh, density);
+
+  for(int j = 0; j < nparts; j++)
+    hdls[j] = mcl->LaunchKernel(k_force, atom[j].nlocal, 1, &ghosts[j], &p[j], sizeof(EAMParams), 7,
+        atom[j].d_x->devData(), atom[j].d_x->devSize(), atom[j].d_x->mclFlags(),
+        atom[j].d_f->devData(), atom[j].d_f->devSize(), atom[j].d_f->mclFlags(),
+        neighbor[j].d_numneigh->devData(), neighbor[j].d_numneigh->devSize(), neighbor[j].d_numneigh->mclFlags(),
+        neighbor[j].d_neighbors->devData(), neighbor[j].d_neighbors->devSize(), neighbor[j].d_neighbors->mclFlags(),
+        d_fp[j]->devData(), d_fp[j]->devSize(), d_fp[j]->mclFlags(),
+        d_rhor_spline->devData(), d_rhor_spline->devSize(), d_rhor_spline->mclFlags(),
+        d_z2r_spline->devData(), d_z2r_spline->devSize(), d_z2r_spline->mclFlags());
+
+  delete[] ghosts;
+  delete[] density;
+  delete[] p;
+}
+
+/* energy/virial block partials of a partition into d_ev for Thermo::launch,
+   one per blockdim atoms; fp (ghosts included) is the one of the last
+   compute(), so the waitlist has to cover its force task */
+
+mcl_handle* ForceEAM::energy(Atom &atom, Neighbor &neighbor, int partition, cMCLData<MMD_acc, xx>* d_ev, int nwait, mcl_handle** waitlist)
+{
+  EAMParams p;
+  set_params(p, atom, neighbor);
+  return mcl->LaunchKernel(k_energy, atom.nlocal, nwait, waitlist, &p, sizeof(EAMParams), 9,
+      atom.d_x->devData(), atom.d_x->devSize(), atom.d_x->mclFlags(),
+      neighbor.d_numneigh->devData(), neighbor.d_numneigh->devSize(), neighbor.d_numneigh->mclFlags(),
+      neighbor.d_neighbors->devData(), neighbor.d_neighbors->devSize(), neighbor.d_neighbors->mclFlags(),
+      d_fp[partition]->devData(), d_fp[partition]->devSize(), d_fp[partition]->mclFlags(),
+      d_rhor_spline->devData(), d_rhor_spline->devSize(), d_rhor_spline->mclFlags(),
+      d_frho_spline->devData(), d_frho_spline->devSize(), d_frho_spline->mclFlags(),
+      d_z2r_spline->devData(), d_z2r_spline->devSize(), d_z2r_spline->mclFlags(),
+      d_ev->devData(), d_ev->devSize(), d_ev->mclFlags(),
+      NULL, mcl->blockdim * 2 * sizeof(MMD_acc), MCL_ARG_BUFFER | MCL_ARG_LOCAL);
+}
@@ -0,0 +1,94 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#ifndef FORCE_EAM_H
+#define FORCE_EAM_H
+
+#include "atom.h"
+#include "neighbor.h"
+#include "comm.h"
+#include "mcl_wrapper.h"
+#include "mcl_data.h"
+#include "kernel_params.h"
+#include "precision.h"
+
+/* single element EAM potential in the DYNAMO funcfl format of LAMMPS
+   (e.g. Cu_u6.eam), arrays are 1-based like in the file */
+
+struct Funcfl {
+  double mass;
+  int nrho, nr;
+  double drho, dr, cut;
+  MMD_float *frho, *rhor, *zr;
+};
+
+/* EAM forces as a chain of MCL tasks per partition, see force_eam_kernel.h
+   the spline tables are uploaded once and stay resident on the device */
+
+class ForceEAM {
+ public:
+  MMD_float cutforce;
+  MMD_float cutforcesq;
+  MMD_float mass;
+
+  MCLWrapper* mcl;
+  int k_density, k_force, k_energy;  // registered kernel ids
+
+  ForceEAM();
+  ~ForceEAM();
+  int coeff(const char*);          // read a funcfl file, 1 on error
+  void setup(int nparts);
+  void compute(Atom[], Neighbor[], Comm &, int reneigh, mcl_handle** waitlist, mcl_handle** hdls);
+  mcl_handle* energy(Atom &, Neighbor &, int partition, cMCLData<MMD_acc, xx>* d_ev, int nwait, mcl_handle** waitlist);
+  static cMCLData<MMD_float, xx>* interpolate(MCLWrapper*, int, MMD_float, MMD_float*);
+
+ private:
+  Funcfl funcfl;
+  int nparts;
+
+  int nrho, nr;                    // spline grid
+  MMD_float drho, dr, rdr, rdrho;
+  MMD_float *frho, *rhor, *z2r;
+  cMCLData<MMD_float, xx>* d_frho_spline;  // 7 coefficients per point, 1-based
+  cMCLData<MMD_float, xx>* d_rhor_spline;
+  cMCLData<MMD_float, xx>* d_z2r_spline;
+
+  cMCLData<MMD_float, xx>** d_fp;  // per partition: F'(rho) of local and ghost atoms
+  int* maxfp;
+
+  void grab(FILE*, int, MMD_float*);
+  void file2array();
+  void array2spline();
+  void growfp(int partition, int n);
+  void set_params(EAMParams &, Atom &, Neighbor &);
+};
+
+#endif
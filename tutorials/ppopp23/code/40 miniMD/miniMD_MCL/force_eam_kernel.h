@@ -0,0 +1,184 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+/* EAM forces as a three stage pipeline (ForceEAM::compute)
+   eam_density: electron density of every owned atom and the derivative
+                of its embedding energy fp = F'(rho)
+   (Comm::communicate_scalar copies fp to the ghost atoms)
+   eam_force:   pair and embedding forces from fp of both atoms
+   eam_energy:  energy and virial of a thermo step (Thermo::launch)
+   the splines hold 7 coefficients per point, 0-2 for the derivative and
+   3-6 for the value, see ForceEAM::interpolate */
+
+#include "precision.h"
+#include "kernel_params.h"
+#include "neighbor_codec.h"
+
+__kernel void eam_density(__global MMD_floatK3* x, __global int* numneigh, __global int* neighbors,
+                          __global MMD_float* fp, __global const MMD_float* rhor_spline,
+                          __global const MMD_float* frho_spline, struct EAMParams p)
+{
+  int nlocal = p.nlocal;
+  int i = get_global_id(0);
+  if(i<nlocal)
+  {
+    int pos = 0, j = i;
+    MMD_floatK3 xi = x[i];
+    MMD_acc rhoi = 0.0f;
+    for (int k = 0; k < numneigh[i]; k++) {
+      j = neigh_at(neighbors, i, k, nlocal, p.compress, &pos, j);
+      MMD_floatK3 delx = xi - x[j];
+
+      MMD_float rsq = delx.x*delx.x + delx.y*delx.y + delx.z*delx.z;
+      if (rsq < p.cutforcesq) {
+        MMD_float r = sqrt(rsq) * p.rdr + 1.0f;
+        int m = min((int) r, p.nr - 1);
+        r = min(r - m, (MMD_float) 1.0f);
+        __global const MMD_float* c = &rhor_spline[m*7];
+        rhoi += ((c[3]*r + c[4])*r + c[5])*r + c[6];
+      }
+    }
+
+    MMD_float q = rhoi * p.rdrho + 1.0f;
+    int m = clamp((int) q, 1, p.nrho - 1);
+    q = min(q - m, (MMD_float) 1.0f);
+    __global const MMD_float* c = &frho_spline[m*7];
+    fp[i] = (c[0]*q + c[1])*q + c[2];
+  }
+}
+
+__kernel void eam_force(__global MMD_floatK3* x, __global MMD_floatK3* f, __global int* numneigh,
+                        __global int* neighbors, __global MMD_float* fp, __global const MMD_float* rhor_spline,
+                        __global const MMD_float* z2r_spline, struct EAMParams p)
+{
+  int nlocal = p.nlocal;
+  int i = get_global_id(0);
+  if(i<nlocal)
+  {
+    int pos = 0, j = i;
+    MMD_floatK3 xi = x[i];
+    MMD_float fpi = fp[i];
+    MMD_accK3 fi = (MMD_accK3)(0.0f,0.0f,0.0f);
+    for (int k = 0; k < numneigh[i]; k++) {
+      j = neigh_at(neighbors, i, k, nlocal, p.compress, &pos, j);
+      MMD_floatK3 delx = xi - x[j];
+
+      MMD_float rsq = delx.x*delx.x + delx.y*delx.y + delx.z*delx.z;
+      if (rsq < p.cutforcesq) {
+        MMD_float r = sqrt(rsq);
+        MMD_float q = r * p.rdr + 1.0f;
+        int m = min((int) q, p.nr - 1);
+        q = min(q - m, (MMD_float) 1.0f);
+        __global const MMD_float* c = &rhor_spline[m*7];
+        __global const MMD_float* z = &z2r_spline[m*7];
+
+        // rhoip: d rho/dr, the same for both atoms of a single element
+        // z2 = phi*r, z2p = (phi*r)'
+        MMD_float rhoip = (c[0]*q + c[1])*q + c[2];
+        MMD_float z2p = (z[0]*q + z[1])*q + z[2];
+        MMD_float z2 = ((z[3]*q + z[4])*q + z[5])*q + z[6];
+
+        MMD_float recip = 1.0f/r;
+        MMD_float phi = z2*recip;
+        MMD_float phip = z2p*recip - phi*recip;
+        MMD_float psip = (fpi + fp[j])*rhoip + phip;
+        fi += ACC3((-psip*recip) * delx);
+      }
+    }
+    f[i] = FLT3(fi);
+  }
+}
+
+/* block partials of (2 F(rho_i) + sum_j phi_ij, sum_j r_ij . f_ij) over the
+   full list, so Thermo::output's factors 0.5 give the energy and virial
+   like for energy_virial; reads fp of the preceding force pass */
+
+__kernel void eam_energy(__global MMD_floatK3* x, __global int* numneigh, __global int* neighbors,
+                         __global MMD_float* fp, __global const MMD_float* rhor_spline,
+                         __global const MMD_float* frho_spline, __global const MMD_float* z2r_spline,
+                         __global MMD_accK2* sum, __local MMD_accK2* temp, struct EAMParams p)
+{
+  int nlocal = p.nlocal;
+  int i = get_global_id(0);
+  int tid = get_local_id(0);
+  int block_dim = get_local_size(0);
+  temp[tid] = (MMD_accK2)(0.0f,0.0f);
+
+  if(i<nlocal)
+  {
+    int pos = 0, j = i;
+    MMD_floatK3 xi = x[i];
+    MMD_float fpi = fp[i];
+    MMD_acc rhoi = 0.0f;
+    MMD_accK2 ei = (MMD_accK2)(0.0f,0.0f);
+    for (int k = 0; k < numneigh[i]; k++) {
+      j = neigh_at(neighbors, i, k, nlocal, p.compress, &pos, j);
+      MMD_floatK3 delx = xi - x[j];
+
+      MMD_float rsq = delx.x*delx.x + delx.y*delx.y + delx.z*delx.z;
+      if (rsq < p.cutforcesq) {
+        MMD_float r = sqrt(rsq);
+        MMD_float q = r * p.rdr + 1.0f;
+        int m = min((int) q, p.nr - 1);
+        q = min(q - m, (MMD_float) 1.0f);
+        __global const MMD_float* c = &rhor_spline[m*7];
+        __global const MMD_float* z = &z2r_spline[m*7];
+
+        MMD_float rhoip = (c[0]*q + c[1])*q + c[2];
+        MMD_float z2p = (z[0]*q + z[1])*q + z[2];
+        MMD_float z2 = ((z[3]*q + z[4])*q + z[5])*q + z[6];
+        rhoi += ((c[3]*q + c[4])*q + c[5])*q + c[6];
+
+        MMD_float recip = 1.0f/r;
+        MMD_float phi = z2*recip;
+        MMD_float phip = z2p*recip - phi*recip;
+        MMD_float psip = (fpi + fp[j])*rhoip + phip;
+        ei += (MMD_accK2)(phi, -psip*r);
+      }
+    }
+
+    MMD_float q = rhoi * p.rdrho + 1.0f;
+    int m = clamp((int) q, 1, p.nrho - 1);
+    q = min(q - m, (MMD_float) 1.0f);
+    __global const MMD_float* c = &frho_spline[m*7];
+    ei.x += 2.0f * (((c[3]*q + c[4])*q + c[5])*q + c[6]);
+    temp[tid] = ei;
+  }
+
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for(int s=block_dim/2; s>0; s=s>>1) {
+    if (tid < s) {
+      temp[tid] += temp[tid + s];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (tid == 0) sum[get_group_id(0)] = temp[0];
+}
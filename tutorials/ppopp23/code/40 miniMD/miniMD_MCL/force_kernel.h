@@ -37,6 +37,40 @@
  */
 
 #include "precision.h"
+#include "kernel_params.h"
+#include "neighbor_codec.h"
+#include "pair_kernel.h"
+
+/* no native floating point atomics in OpenCL 1.x, use compare and swap */
+
+#if MDPREC == 2
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+inline void atomic_add_float(volatile __global MMD_float* addr, MMD_float val)
+{
+  ulong old_val, new_val;
+  do {
+    old_val = as_ulong(*addr);
+    new_val = as_ulong(as_double(old_val) + val);
+  } while(atom_cmpxchg((volatile __global ulong*)addr, old_val, new_val) != old_val);
+}
+#else
+inline void atomic_add_float(volatile __global MMD_float* addr, MMD_float val)
+{
+  uint old_val, new_val;
+  do {
+    old_val = as_uint(*addr);
+    new_val = as_uint(as_float(old_val) + val);
+  } while(atomic_cmpxchg((volatile __global uint*)addr, old_val, new_val) != old_val);
+}
+#endif
+
+inline void atomic_add_float3(__global MMD_floatK3* f, MMD_floatK3 val)
+{
+  volatile __global MMD_float* fp = (volatile __global MMD_float*) f;
+  atomic_add_float(&fp[0], val.x);
+  atomic_add_float(&fp[1], val.y);
+  atomic_add_float(&fp[2], val.z);
+}
 //#define MMD_floatK3 float3;
 //#define MMD_float float;
 
@@ -44,29 +78,149 @@
 __inline float4 fetch_tex(__read_only image2d_t I,int i,int size) {return read_imagef(I,TEXMODE,(int2)(i%size,i/size));};*/
 
 __kernel void force_compute(__global MMD_floatK3* x, __global MMD_floatK3* f, __global int* numneigh,
-		  	  	  	  	  	  __global int* neighbors, int maxneighs, int nlocal, MMD_float cutforcesq)
+		  	  	  	  	  	  __global int* neighbors, __global const MMD_float* ptab, struct ForceParams p)
 {
+  int nlocal = p.nlocal;
+  MMD_float cutforcesq = p.cutforcesq;
   int i = get_global_id(0);
   if(i<nlocal)
   {
 
-  	__global int* neighs = neighbors + i;
+  	int pos = 0, j = i;
     MMD_floatK3 ftmp;
     MMD_floatK3 xi = x[i];
-    MMD_floatK3 fi = {0.0f,0.0f,0.0f};
+    MMD_accK3 fi = (MMD_accK3)(0.0f,0.0f,0.0f);
     for (int k = 0; k < numneigh[i]; k++) {
-      int j = neighs[k*nlocal];
+      j = neigh_at(neighbors, i, k, nlocal, p.compress, &pos, j);
+      MMD_floatK3 delx = xi - x[j];
+
+      MMD_float rsq = delx.x*delx.x + delx.y*delx.y + delx.z*delx.z;
+      if (rsq < cutforcesq) {
+        MMD_float force, e;
+        pair_eval(rsq, ptab, &force, &e);
+        fi += ACC3(force * delx);
+      }
+    }
+    f[i] = FLT3(fi);
+ }
+}
+
+/* force_compute that also tallies pair energy and virial on thermo steps,
+   one partial sum per work group is written to ev like energy_virial */
+
+__kernel void force_compute_ev(__global MMD_floatK3* x, __global MMD_floatK3* f, __global int* numneigh,
+		  	  	  	  	  	  __global int* neighbors, __global const MMD_float* ptab, __global MMD_accK2* ev,
+		  	  	  	  	  	  __local MMD_accK2* temp, struct ForceParams p)
+{
+  int nlocal = p.nlocal;
+  MMD_float cutforcesq = p.cutforcesq;
+  int i = get_global_id(0);
+  int tid = get_local_id(0);
+  MMD_accK2 ei = (MMD_accK2)(0.0f,0.0f);
+  if(i<nlocal)
+  {
+
+  	int pos = 0, j = i;
+    MMD_floatK3 xi = x[i];
+    MMD_accK3 fi = (MMD_accK3)(0.0f,0.0f,0.0f);
+    for (int k = 0; k < numneigh[i]; k++) {
+      j = neigh_at(neighbors, i, k, nlocal, p.compress, &pos, j);
+      MMD_floatK3 delx = xi - x[j];
+
+      MMD_float rsq = delx.x*delx.x + delx.y*delx.y + delx.z*delx.z;
+      if (rsq < cutforcesq) {
+        MMD_float force, e;
+        pair_eval(rsq, ptab, &force, &e);
+        fi += ACC3(force * delx);
+        ei += (MMD_accK2)(e, rsq * force);
+      }
+    }
+    f[i] = FLT3(fi);
+  }
+
+  // every work item has to reach the barriers
+  temp[tid] = ei;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for(int s = get_local_size(0)/2; s > 0; s = s>>1) {
+    if(tid < s) temp[tid] += temp[tid + s];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if(tid == 0) ev[get_group_id(0)] = temp[0];
+}
+
+/* force_compute followed by the integrate_final velocity update,
+   applied while the new force is still in registers */
+
+__kernel void force_integrate(__global MMD_floatK3* x, __global MMD_floatK3* f, __global MMD_floatK3* v, __global int* numneigh,
+		  	  	  	  	  	  __global int* neighbors, __global const MMD_float* ptab, struct ForceParams p)
+{
+  int nlocal = p.nlocal;
+  MMD_float cutforcesq = p.cutforcesq;
+  int i = get_global_id(0);
+  if(i<nlocal)
+  {
+
+  	int pos = 0, j = i;
+    MMD_floatK3 xi = x[i];
+    MMD_accK3 fi = (MMD_accK3)(0.0f,0.0f,0.0f);
+    for (int k = 0; k < numneigh[i]; k++) {
+      j = neigh_at(neighbors, i, k, nlocal, p.compress, &pos, j);
       MMD_floatK3 delx = xi - x[j];
 
       MMD_float rsq = delx.x*delx.x + delx.y*delx.y + delx.z*delx.z;
       if (rsq < cutforcesq) {
-        MMD_float sr2 = 1.0f/rsq;
-        MMD_float sr6 = sr2*sr2*sr2;
-        MMD_float force = 48.0f*sr6*(sr6-0.5f)*sr2;
-        fi += force * delx;
+        MMD_float force, e;
+        pair_eval(rsq, ptab, &force, &e);
+        fi += ACC3(force * delx);
       }
     }
-    f[i] = fi;
+    f[i] = FLT3(fi);
+
+    if(fi.x > 0 || fi.y > 0 || fi.z > 0) {
+      MMD_floatK3 vi = v[i];
+      if(vi.x > 0 || vi.y > 0 || vi.z > 0)
+        v[i] = vi + p.dtforce*FLT3(fi);
+    }
+ }
+}
+
+__kernel void force_clear(__global MMD_floatK3* f, struct ForceParams p)
+{
+  int i = get_global_id(0);
+  if(i<p.nall)
+    f[i] = (MMD_floatK3)(0.0f,0.0f,0.0f);
+}
+
+/* half neighbor list: every pair is computed once and the reaction
+   force is added to j, ghost atoms only with ghost_newton (their
+   forces are then folded back by the reverse communication) */
+
+__kernel void force_compute_half(__global MMD_floatK3* x, __global MMD_floatK3* f, __global int* numneigh,
+		  	  	  	  	  	  __global int* neighbors, __global const MMD_float* ptab, struct ForceParams p)
+{
+  int nlocal = p.nlocal;
+  MMD_float cutforcesq = p.cutforcesq;
+  int i = get_global_id(0);
+  if(i<nlocal)
+  {
+
+  	int pos = 0, j = i;
+    MMD_floatK3 xi = x[i];
+    MMD_accK3 fi = (MMD_accK3)(0.0f,0.0f,0.0f);
+    for (int k = 0; k < numneigh[i]; k++) {
+      j = neigh_at(neighbors, i, k, nlocal, p.compress, &pos, j);
+      MMD_floatK3 delx = xi - x[j];
+
+      MMD_float rsq = delx.x*delx.x + delx.y*delx.y + delx.z*delx.z;
+      if (rsq < cutforcesq) {
+        MMD_float force, e;
+        pair_eval(rsq, ptab, &force, &e);
+        fi += ACC3(force * delx);
+        if (p.ghost_newton || j < nlocal)
+          atomic_add_float3(&f[j], -force * delx);
+      }
+    }
+    atomic_add_float3(&f[i], FLT3(fi));
  }
 }
 
@@ -104,42 +258,45 @@ __kernel void force_compute(__global MMD_floatK3* x, __global MMD_floatK3* f, __
 }*/
 
 __kernel void force_compute_loop(__global MMD_floatK3* x, __global MMD_floatK3* f, __global int* numneigh,
-		  	  	  	  	  	  __global int* neighbors, int maxneighs, int nlocal, MMD_float cutforcesq, int atoms_per_thread)
+		  	  	  	  	  	  __global int* neighbors, __global const MMD_float* ptab, struct ForceParams p)
 {
+  int nlocal = p.nlocal;
+  MMD_float cutforcesq = p.cutforcesq;
   int ii = get_global_id(0);
   for(int i=ii;i<nlocal;i+=get_global_size(0))
   if(i<nlocal)
   {
 
-  	__global int* neighs = neighbors + i;
+  	int pos = 0, j = i;
     MMD_floatK3 ftmp;
     MMD_floatK3 xi = x[i];
-    MMD_floatK3 fi = {0.0f,0.0f,0.0f};
+    MMD_accK3 fi = (MMD_accK3)(0.0f,0.0f,0.0f);
 
     for (int k = 0; k < numneigh[i]; k++) {
-      int j = neighs[k*nlocal];
+      j = neigh_at(neighbors, i, k, nlocal, p.compress, &pos, j);
       MMD_floatK3 delx = xi - x[j];
 
       MMD_float rsq = delx.x*delx.x + delx.y*delx.y + delx.z*delx.z;
       if (rsq < cutforcesq) {
-        MMD_float sr2 = 1.0f/rsq;
-        MMD_float sr6 = sr2*sr2*sr2;
-        MMD_float force = 48.0f*sr6*(sr6-0.5f)*sr2;
-	      fi += force * delx;
+        MMD_float force, e;
+        pair_eval(rsq, ptab, &force, &e);
+	      fi += ACC3(force * delx);
       }
     }
 
 
-    f[i] = fi;
+    f[i] = FLT3(fi);
 
  }
 
 }
 
 __kernel void force_compute_split(__global MMD_floatK3* x, __global MMD_floatK3* f, __global int* numneigh,
-		  	  	  	  	  	  __global int* neighbors, int maxneighs, int nlocal, MMD_float cutforcesq, int threads_per_atom,
-		  	  	  	  	  	  __local MMD_floatK3* sf)
+		  	  	  	  	  	  __global int* neighbors, __local MMD_accK3* sf, __global const MMD_float* ptab, struct ForceParams p)
 {
+  int nlocal = p.nlocal;
+  MMD_float cutforcesq = p.cutforcesq;
+  int threads_per_atom = p.threads_per_atom;
   int ii = get_global_id(0);
   int k = get_local_id(0);
   int nk = get_local_size(0);
@@ -149,21 +306,22 @@ __kernel void force_compute_split(__global MMD_floatK3* x, __global MMD_floatK3*
   if(i<nlocal)
   {
 
-  	__global int* neighs = neighbors + i;
+  	int pos = 0, j = i;
     MMD_floatK3 ftmp;
     MMD_floatK3 xi = x[i];
-    MMD_floatK3 fi = {0.0f,0.0f,0.0f};
+    MMD_accK3 fi = (MMD_accK3)(0.0f,0.0f,0.0f);
 
-    for (int jj = jl; jj < numneigh[i]; jj+=threads_per_atom) {
-      int j = neighs[jj*nlocal];
+    // a compressed list is decoded in order by every thread of the atom
+    for (int jj = p.compress ? 0 : jl; jj < numneigh[i]; jj += p.compress ? 1 : threads_per_atom) {
+      j = neigh_at(neighbors, i, jj, nlocal, p.compress, &pos, j);
+      if (jj % threads_per_atom != jl) continue;
       MMD_floatK3 delx = xi - x[j];
 
       MMD_float rsq = delx.x*delx.x + delx.y*delx.y + delx.z*delx.z;
       if (rsq < cutforcesq) {
-	MMD_float sr2 = 1.0f/rsq;
-	MMD_float sr6 = sr2*sr2*sr2;
-	MMD_float force = 48.0f*sr6*(sr6-0.5f)*sr2;
-	  fi += force * delx;
+	MMD_float force, e;
+	pair_eval(rsq, ptab, &force, &e);
+	  fi += ACC3(force * delx);
 
       }
 
@@ -176,7 +334,7 @@ __kernel void force_compute_split(__global MMD_floatK3* x, __global MMD_floatK3*
     	sf[k]+=sf[k+m];
     }
     if(jl==0)
-    f[i] = sf[k];
+    f[i] = FLT3(sf[k]);
 
  }
 
@@ -31,16 +31,24 @@
 
 #include "stdio.h"
 #include "integrate.h"
+#include "force_eam.h"
 #include <minos.h>
 #include <queue>
 #include <cstring>
-#include <chrono>
-#include <thread>
 
-#define NUM_SHARED_BUF 100
 using namespace std;
 
-Integrate::Integrate() {}
+Integrate::Integrate()
+{
+    use_graph = 0;
+    use_fused = 0;
+    sort_every = 1;
+    first = 0;
+    nbuild = 0;
+    nbalance = 0;
+    ckpt = NULL;
+    stream = NULL;
+}
 Integrate::~Integrate() {}
 
 void Integrate::setup(int partitions)
@@ -50,6 +58,10 @@ void Integrate::setup(int partitions)
     force_hdls = new mcl_handle *[partitions];
     integrate_final_hdls = new mcl_handle *[partitions];
     neighbor_hdls = new mcl_handle *[partitions];
+    params = new IntegrateParams[partitions];
+    k_initial = mcl->Kernel("integrate_kernel.h", "integrate_initial");
+    k_final = mcl->Kernel("integrate_kernel.h", "integrate_final");
+    k_pack = mcl->Kernel("integrate_kernel.h", "integrate_pack");
     
     for (int j = 0; j < partitions; j++)
     {
@@ -60,33 +72,94 @@ void Integrate::setup(int partitions)
     }
 }
 
+/* fill the scalar block shared by integrate_initial and integrate_final */
+
+void Integrate::set_params(IntegrateParams &p, Atom &atom)
+{
+    p.dt = dt;
+    p.dtforce = dtforce;
+    p.nlocal = atom.nlocal;
+    p.nmax = atom.nmax;
+}
+
+/* displacement check of all partitions after the last submitted step */
+
+int Integrate::rebuild_due(Atom atom[], Neighbor neighbor[], int partitions)
+{
+    int due = 0;
+    for (int j = 0; j < partitions; j++)
+        neighbor_hdls[j] = neighbor[j].displacement(atom[j], 1, &integrate_final_hdls[j]);
+    for (int j = 0; j < partitions; j++)
+    {
+        mcl_wait(neighbor_hdls[j]);
+        mcl_hdl_free(neighbor_hdls[j]);
+        neighbor_hdls[j] = NULL;
+        if (neighbor[j].rebuild_due())
+            due = 1;
+    }
+    return due;
+}
+
 void Integrate::run(Atom atom[], Force &force, Neighbor neighbor[],
-                    Comm &comm, Thermo &thermo, Timer &timer, int partitions, int share)
+                    Comm &comm, Thermo &thermo, Timer &timer, int partitions)
 {
     mcl_handle** comm_hdls;
 
-    MMD_float3** shared_mem;
-    mcl_handle** share_hdls;
-    char* shared_buf_name;
-    if(share){
-        shared_mem = new MMD_float3*[NUM_SHARED_BUF];
-        share_hdls = new mcl_handle*[ntimes * partitions];
-        shared_buf_name = (char*)malloc(strlen("mcl_pos_buffer_") + 7);
-    }
     int nwait = 0;
     mcl_handle **waitlist = NULL;
-    for (int n = 0; n < ntimes; n += neighbor[0].every)
+    // thermo reductions of the previous step, see Thermo::launch
+    mcl_handle **thermo_hdls = NULL;
+    // trajectory frame of the previous step, see TrajStream::launch
+    mcl_handle **frame_hdls = NULL;
+    // with the displacement check every is only the longest interval
+    int every = neighbor[0].check ? neighbor[0].max_every : neighbor[0].every;
+    int nsteps = every;
+    for (int n = first; n < ntimes; n += nsteps)
     {
-        for (int i = 0; i < neighbor[0].every - 1; i++)
+        int i;
+        for (i = 0; i < every - 1; i++)
         {
             //fprintf(stderr, "Starting iteration %d:%d\n", n, i);
+
+            /* end the interval early once an atom may have moved half the
+               skin, the reneighboring step below is the next step */
+            if (neighbor[0].check &&
+                (n + i + 1 >= ntimes || (i > 0 && i % neighbor[0].check == 0 && rebuild_due(atom, neighbor, partitions))))
+                break;
+
+            /* the DAG of a step only changes at reneighboring:
+               capture step 1 (step 0 rewrites the send lists) and
+               resubmit it for the rest of the interval */
+            if (use_graph && graph.valid)
+            {
+                graph.replay(mcl, thermo_hdls ? thermo_hdls : integrate_final_hdls, integrate_final_hdls);
+                thermo_hdls = thermo.launch(n + i + 1, atom, neighbor, force, timer, integrate_final_hdls);
+                continue;
+            }
+            if (use_graph && i == 1)
+            {
+                graph.begin(partitions, thermo_hdls ? thermo_hdls : integrate_final_hdls);
+                mcl->capture = &graph;
+            }
+
             for (int j = 0; j < partitions; j++)
             {
-                if(share && (n > 0) && (i > 0))
+                if (thermo_hdls && ((n > 0) || (i > 0)))
                 {
+                    // thermo still reads x and v of the previous step
                     nwait = 1;
-                    waitlist = &share_hdls[((n + i - 1) * partitions) + j];
-
+                    waitlist = &thermo_hdls[j];
+                }
+                else if (use_graph && (i > 0))
+                {
+                    nwait = 1;
+                    waitlist = &integrate_final_hdls[j];
+                }
+                else if (frame_hdls)
+                {
+                    // traj_pack still reads x of the previous step
+                    nwait = 1;
+                    waitlist = &frame_hdls[j];
                 }
                 else if ((n > 0) && (i > 0))
                 {
@@ -98,89 +171,121 @@ void Integrate::run(Atom atom[], Force &force, Neighbor neighbor[],
                     nwait = 0;
                     waitlist = NULL;
                 }
-                integrate_init_hdls[j] = mcl->LaunchKernel("integrate_kernel.h", "integrate_initial", atom[j].nlocal, nwait, waitlist, 7,
-                                                           atom[j].d_x->devData(), atom[j].d_x->devSize(), atom[j].d_x->mclFlags(),
-                                                           atom[j].d_v->devData(), atom[j].d_v->devSize(), atom[j].d_v->mclFlags(),
-                                                           atom[j].d_f->devData(), atom[j].d_f->devSize(), atom[j].d_f->mclFlags(),
-                                                           &atom[j].nlocal, sizeof(atom[j].nlocal), MCL_ARG_SCALAR,
-                                                           &dt, sizeof(dt), MCL_ARG_SCALAR,
-                                                           &dtforce, sizeof(dtforce), MCL_ARG_SCALAR,
-                                                           &atom[j].nmax, sizeof(atom[j].nmax), MCL_ARG_SCALAR);
+                set_params(params[j], atom[j]);
+                if (comm.nfused)
+                {
+                    // integrate_initial + packing of the first swaps
+                    IntegratePackParams p;
+                    comm.pack_params(atom[j], j, p);
+                    p.dt = dt;
+                    p.dtforce = dtforce;
+                    p.nlocal = atom[j].nlocal;
+                    cMCLData<MMD_float, xx>* buf0 = comm.temp_buffers[j][0];
+                    cMCLData<MMD_float, xx>* buf1 = comm.temp_buffers[j][comm.nfused - 1];
+                    uint64_t rewrite = (i == 0 && !comm.lists_on_device) ? MCL_ARG_REWRITE : 0;
+                    integrate_init_hdls[j] = mcl->LaunchKernel(k_pack, atom[j].nlocal, nwait, waitlist, &p, sizeof(p), 6,
+                                                               atom[j].d_x->devData(), atom[j].d_x->devSize(), atom[j].d_x->mclFlags(),
+                                                               atom[j].d_v->devData(), atom[j].d_v->devSize(), atom[j].d_v->mclFlags(),
+                                                               atom[j].d_f->devData(), atom[j].d_f->devSize(), atom[j].d_f->mclFlags(),
+                                                               comm.d_fuseslot[j]->devData(), comm.d_fuseslot[j]->devSize(), comm.d_fuseslot[j]->mclFlags() | rewrite,
+                                                               buf0->devData(), buf0->devSize(), buf0->mclFlags(),
+                                                               buf1->devData(), buf1->devSize(), buf1->mclFlags());
+                }
+                else
+                    integrate_init_hdls[j] = mcl->LaunchKernel(k_initial, atom[j].nlocal, nwait, waitlist, &params[j], sizeof(IntegrateParams), 3,
+                                                               atom[j].d_x->devData(), atom[j].d_x->devSize(), atom[j].d_x->mclFlags(),
+                                                               atom[j].d_v->devData(), atom[j].d_v->devSize(), atom[j].d_v->mclFlags(),
+                                                               atom[j].d_f->devData(), atom[j].d_f->devSize(), atom[j].d_f->mclFlags());
             }
 
             timer.stamp();
             comm_hdls = comm.communicate(atom, i, integrate_init_hdls);
             timer.stamp(TIME_COMM);
 
-            for (int j = 0; j < partitions; j++)
+            // thermo steps tally energy/virial in the force pass, not in a step that is captured
+            int tally = thermo.due(n + i + 1) && !mcl->capture;
+
+            // EAM needs fp of the ghosts in between, so all partitions at once
+            if (force.eam)
+                force.eam->compute(atom, neighbor, comm, i == 0, comm_hdls, force_hdls);
+            else
             {
-                //mcl_hdl_free(integrate_init_hdls[j]);
-                //integrate_init_hdls[j] = NULL;
-                //if (force_hdls[j])
-                //{
-                //    mcl_hdl_free(force_hdls[j]);
-                //    force_hdls[j] = NULL;
-                //    mcl_hdl_free(integrate_final_hdls[j]);
-                //    integrate_final_hdls[j] = NULL;
-                //}
-
-                force_hdls[j] = force.compute(atom[j], neighbor[j], comm.nswap, &comm_hdls[j * comm.maxswap]);
+                for (int j = 0; j < partitions; j++)
+                {
+                    //mcl_hdl_free(integrate_init_hdls[j]);
+                    //integrate_init_hdls[j] = NULL;
+                    //if (force_hdls[j])
+                    //{
+                    //    mcl_hdl_free(force_hdls[j]);
+                    //    force_hdls[j] = NULL;
+                    //    mcl_hdl_free(integrate_final_hdls[j]);
+                    //    integrate_final_hdls[j] = NULL;
+                    //}
+
+                    if (use_fused && force.can_fuse(atom[j], neighbor[j]) && !tally)
+                    {
+                        // force kernel does the integrate_final update itself
+                        integrate_final_hdls[j] = force.compute_integrate(atom[j], neighbor[j], dtforce, 0, comm.nhdls, &comm_hdls[j * comm.maxswap]);
+                        force_hdls[j] = NULL;
+                    }
+                    else
+                        force_hdls[j] = force.compute(atom[j], neighbor[j], comm.nhdls, &comm_hdls[j * comm.maxswap],
+                                                      tally && force.can_tally(atom[j], neighbor[j]) ? thermo.tally(j, atom[j].nlocal) : NULL);
+                }
             }
             delete[] comm_hdls;
 
+            // ghost forces of the half neighbor list go back to their owners
+            mcl_handle** reverse_hdls = NULL;
+            if (neighbor[0].halfneigh && neighbor[0].ghost_newton)
+                reverse_hdls = comm.reverse_communicate(atom, 0, force_hdls);
+
             for (int j = 0; j < partitions; j++)
             {
+                if (!force_hdls[j])
+                    continue;
                 nwait = 1;
-                waitlist = &force_hdls[j];
-                integrate_final_hdls[j] = mcl->LaunchKernel("integrate_kernel.h", "integrate_final", atom[j].nlocal, nwait, waitlist, 5,
+                waitlist = reverse_hdls ? &reverse_hdls[j] : &force_hdls[j];
+                integrate_final_hdls[j] = mcl->LaunchKernel(k_final, atom[j].nlocal, nwait, waitlist, &params[j], sizeof(IntegrateParams), 2,
                                                             atom[j].d_v->devData(), atom[j].d_v->devSize(), atom[j].d_v->mclFlags(),
-                                                            atom[j].d_f->devData(), atom[j].d_f->devSize(), atom[j].d_f->mclFlags(),
-                                                            &atom[j].nlocal, sizeof(atom[j].nlocal), MCL_ARG_SCALAR,
-                                                            &dtforce, sizeof(dtforce), MCL_ARG_SCALAR,
-                                                            &atom[j].nmax, sizeof(atom[j].nmax), MCL_ARG_SCALAR);
+                                                            atom[j].d_f->devData(), atom[j].d_f->devSize(), atom[j].d_f->mclFlags());
             }
-            // if(thermo.nstat) {
-            //   thermo.compute(n + i,atom,neighbor,force,timer,comm);
-            // }
-            if (share)
+            delete[] reverse_hdls;
+            if (mcl->capture)
             {
-                for (int j = 0; j < partitions; j++)
-                {
-                    int natoms = min(65536, atom[j].nlocal);
-                    int idx = ((n+i) * partitions) + j;
-                    int buf_idx = idx % NUM_SHARED_BUF;
-                    if(idx < NUM_SHARED_BUF) {
-                        sprintf(shared_buf_name, "mcl_pos_buffer_%05d", buf_idx);
-                        shared_mem[idx]  = (MMD_float3*)mcl_get_shared_buffer(shared_buf_name, 65536 * 3 * sizeof(float), 
-                                            MCL_ARG_DYNAMIC | MCL_SHARED_MEM_NEW | MCL_SHARED_MEM_DEL_OLD);
-                    }
-                    nwait = 1;
-                    waitlist = &integrate_final_hdls[j];
-                    share_hdls[idx] = mcl->LaunchKernelShared("share_kernel.h", "copy_atoms", atom[j].nlocal, nwait, waitlist, 3,
-                                                            atom[j].d_x->devData(), atom[j].d_x->devSize(), atom[j].d_x->mclFlags(),
-                                                            shared_mem[idx], natoms * 3 * sizeof(float),  MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_SHARED | MCL_ARG_DYNAMIC,
-                                                            &natoms, sizeof(natoms), MCL_ARG_SCALAR);
-                }
+                mcl->capture = NULL;
+                graph.end(partitions, integrate_final_hdls);
             }
-
+            frame_hdls = stream ? stream->launch(n + i + 1, atom, neighbor, integrate_final_hdls) : NULL;
+            thermo_hdls = thermo.launch(n + i + 1, atom, neighbor, force, timer,
+                                        frame_hdls ? frame_hdls : integrate_final_hdls);
         }
+        nsteps = i + 1;
         //mcl_wait_all();
-        //fprintf(stderr, "Starting iteration %d:%d\n", n, neighbor[0].every - 1);
+        //fprintf(stderr, "Starting iteration %d:%d\n", n, nsteps - 1);
+
+        // exchange/borders stay on the device, except for the last interval
+        // which leaves the host copies current at the end of the run,
+        // for steps that reorder the atoms on the host
+        // and for steps that move the partition bounds or are checkpointed
+        int sort_now = atom[0].sort_curve && (nbuild++ % sort_every == 0);
+        int balance_now = comm.balance_every && (++nbalance % comm.balance_every == 0);
+        int ckpt_now = ckpt && ckpt->due(n + nsteps);
+        int on_device = comm.device_exchange && !sort_now && !balance_now && !ckpt_now && (n + nsteps < ntimes);
+        uint64_t sync = on_device ? 0 : MCL_ARG_OUTPUT;
         for (int j = 0; j < partitions; j++)
         {
             nwait = 1;
-            waitlist = &integrate_final_hdls[j];
-            integrate_init_hdls[j] = mcl->LaunchKernel("integrate_kernel.h", "integrate_initial", atom[j].nlocal, nwait, waitlist, 7,
-                                                       atom[j].d_x->devData(), atom[j].d_x->devSize(), atom[j].d_x->mclFlags() | MCL_ARG_OUTPUT,
-                                                       atom[j].d_v->devData(), atom[j].d_v->devSize(), atom[j].d_v->mclFlags() | MCL_ARG_OUTPUT,
-                                                       atom[j].d_f->devData(), atom[j].d_f->devSize(), atom[j].d_f->mclFlags(),
-                                                       &atom[j].nlocal, sizeof(atom[j].nlocal), MCL_ARG_SCALAR,
-                                                       &dt, sizeof(dt), MCL_ARG_SCALAR,
-                                                       &dtforce, sizeof(dtforce), MCL_ARG_SCALAR,
-                                                       &atom[j].nmax, sizeof(atom[j].nmax), MCL_ARG_SCALAR);
+            waitlist = thermo_hdls ? &thermo_hdls[j] : frame_hdls ? &frame_hdls[j] : &integrate_final_hdls[j];
+            set_params(params[j], atom[j]);
+            integrate_init_hdls[j] = mcl->LaunchKernel(k_initial, atom[j].nlocal, nwait, waitlist, &params[j], sizeof(IntegrateParams), 3,
+                                                       atom[j].d_x->devData(), atom[j].d_x->devSize(), atom[j].d_x->mclFlags() | sync,
+                                                       atom[j].d_v->devData(), atom[j].d_v->devSize(), atom[j].d_v->mclFlags() | sync,
+                                                       atom[j].d_f->devData(), atom[j].d_f->devSize(), atom[j].d_f->mclFlags());
         }
         //fprintf(stderr, "Finished enqueing tasks.\n");
         mcl_wait_all();
+        mcl->ReleaseRetired();
         timer.stamp();
         //fprintf(stderr, "Finished all integrate initial tasks.\n");
 
@@ -188,21 +293,40 @@ void Integrate::run(Atom atom[], Force &force, Neighbor neighbor[],
         {
             mcl_hdl_free(integrate_init_hdls[j]);
             integrate_init_hdls[j] = NULL;
-            mcl_hdl_free(force_hdls[j]);
+            if (force_hdls[j])
+                mcl_hdl_free(force_hdls[j]);
             force_hdls[j] = NULL;
-            mcl_hdl_free(integrate_final_hdls[j]);
+            if (graph.nreplay == 0) // otherwise owned by the graph
+                mcl_hdl_free(integrate_final_hdls[j]);
             integrate_final_hdls[j] = NULL;
         }
+        graph.release();
+        graph.clear();
         //fprintf(stderr, "Freed all handles.\n");
 
-        for (int j = 0; j < partitions; j++)
+        if (on_device)
         {
-            atom[j].d_x->download();
-            atom[j].d_v->download();
+            comm.exchange_device(atom);
+            comm.borders_device(atom);
         }
+        else
+        {
+            for (int j = 0; j < partitions; j++)
+            {
+                atom[j].d_x->download();
+                atom[j].d_v->download();
+            }
 
-        comm.exchange(atom);
-        comm.borders(atom);
+            if (balance_now)
+                balance(atom, neighbor, comm);
+            comm.exchange(atom);
+            if (sort_now)
+                for (int j = 0; j < partitions; j++)
+                    atom[j].sort();
+            comm.borders(atom);
+        }
+        for (int j = 0; j < partitions; j++)
+            atom[j].host_modified = !on_device;
         timer.stamp(TIME_COMM);
 
         //fprintf(stderr, "Binning atoms.\n");
@@ -230,6 +354,7 @@ void Integrate::run(Atom atom[], Force &force, Neighbor neighbor[],
             }
         }
 
+        int tally = thermo.due(n + nsteps);
         for (int j = 0; j < partitions; j++)
         {
             mcl_wait(neighbor_hdls[j]);
@@ -237,9 +362,10 @@ void Integrate::run(Atom atom[], Force &force, Neighbor neighbor[],
             neighbor_hdls[j] = neighbor[j].reneigh(atom[j]);
             if (neighbor_hdls[j])
                 pending_list.push(j);
-            else
+            else if (!force.eam)
             {
-                force_hdls[j] = force.compute(atom[j], neighbor[j], 0, NULL);
+                force_hdls[j] = force.compute(atom[j], neighbor[j], 0, NULL,
+                                              tally && force.can_tally(atom[j], neighbor[j]) ? thermo.tally(j, atom[j].nlocal) : NULL);
             }
         }
 
@@ -252,61 +378,50 @@ void Integrate::run(Atom atom[], Force &force, Neighbor neighbor[],
             neighbor_hdls[j] = neighbor[j].reneigh(atom[j]);
             if (neighbor_hdls[j])
                 pending_list.push(j);
-            else
+            else if (!force.eam)
             {
-                force_hdls[j] = force.compute(atom[j], neighbor[j], 0, NULL);
+                force_hdls[j] = force.compute(atom[j], neighbor[j], 0, NULL,
+                                              tally && force.can_tally(atom[j], neighbor[j]) ? thermo.tally(j, atom[j].nlocal) : NULL);
             }
         }
+        if (force.eam)
+            force.eam->compute(atom, neighbor, comm, 1, NULL, force_hdls);
         //fprintf(stderr, "All force handles enqueued.\n");
         timer.stamp(TIME_NEIGH);
 
+        mcl_handle** reverse_hdls = NULL;
+        if (neighbor[0].halfneigh && neighbor[0].ghost_newton)
+            reverse_hdls = comm.reverse_communicate(atom, 1, force_hdls);
+
         for (int j = 0; j < partitions; j++)
         {
-            uint64_t output = n + 1 >= ntimes ? MCL_ARG_OUTPUT : 0;
-            integrate_final_hdls[j] = mcl->LaunchKernel("integrate_kernel.h", "integrate_final", atom[j].nlocal, 1, &force_hdls[j], 5,
-                                                        atom[j].d_v->devData(), atom[j].d_v->devSize(), atom[j].d_v->mclFlags() | MCL_ARG_REWRITE | output,
-                                                        atom[j].d_f->devData(), atom[j].d_f->devSize(), atom[j].d_f->mclFlags() | output,
-                                                        &atom[j].nlocal, sizeof(atom[j].nlocal), MCL_ARG_SCALAR,
-                                                        &dtforce, sizeof(dtforce), MCL_ARG_SCALAR,
-                                                        &atom[j].nmax, sizeof(atom[j].nmax), MCL_ARG_SCALAR);
+            uint64_t output = n + 1 >= ntimes || ckpt_now ? MCL_ARG_OUTPUT : 0;
+            uint64_t rewrite = atom[j].host_modified ? MCL_ARG_REWRITE : 0;
+            set_params(params[j], atom[j]);
+            integrate_final_hdls[j] = mcl->LaunchKernel(k_final, atom[j].nlocal, 1, reverse_hdls ? &reverse_hdls[j] : &force_hdls[j], &params[j], sizeof(IntegrateParams), 2,
+                                                        atom[j].d_v->devData(), atom[j].d_v->devSize(), atom[j].d_v->mclFlags() | rewrite | output,
+                                                        atom[j].d_f->devData(), atom[j].d_f->devSize(), atom[j].d_f->mclFlags() | output);
         }
+        delete[] reverse_hdls;
         timer.stamp(TIME_FORCE);
 
-        if (share)
+        frame_hdls = stream ? stream->launch(n + nsteps, atom, neighbor, integrate_final_hdls) : NULL;
+        thermo_hdls = thermo.launch(n + nsteps, atom, neighbor, force, timer,
+                                    frame_hdls ? frame_hdls : integrate_final_hdls);
+
+        // x is current on the host since the exchange, v once integrate_final is back
+        if (ckpt_now)
         {
             for (int j = 0; j < partitions; j++)
-            {
-                int natoms = min(65536, atom[j].nlocal);
-                int idx = ((n+neighbor[0].every-1) * partitions) + j;
-                int buf_idx = idx % NUM_SHARED_BUF;
-                if(idx < NUM_SHARED_BUF) {
-                    sprintf(shared_buf_name, "mcl_pos_buffer_%05d", buf_idx);
-                    shared_mem[idx]  = (MMD_float3*)mcl_get_shared_buffer(shared_buf_name, 65536 * 3 * sizeof(float), 
-                                        MCL_ARG_DYNAMIC | MCL_SHARED_MEM_NEW | MCL_SHARED_MEM_DEL_OLD);
-                }
-                nwait = 1;
-                waitlist = &integrate_final_hdls[j];
-                share_hdls[idx] = mcl->LaunchKernelShared("share_kernel.h", "copy_atoms", atom[j].nlocal, nwait, waitlist, 3,
-                                                        atom[j].d_x->devData(), atom[j].d_x->devSize(), atom[j].d_x->mclFlags(),
-                                                        shared_mem[idx], natoms * 3 * sizeof(float),  MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_SHARED | MCL_ARG_DYNAMIC,
-                                                        &natoms, sizeof(natoms), MCL_ARG_SCALAR);
-            }
+                mcl_wait(integrate_final_hdls[j]);
+            ckpt->save(n + nsteps, atom, neighbor, comm, *this, partitions);
         }
-
-        // if(thermo.nstat) {
-        //   thermo.compute(n + neighbor->every - 1,atom,neighbor,force,timer,comm);
-        // }
     }
     mcl_wait_all();
+    thermo.flush();
 
-    if(share)
-    {
-        for(int i = 0; i < ntimes * partitions; i++){
-            mcl_free_shared_buffer(shared_mem[i]);
-        }
-        this_thread::sleep_for(chrono::seconds(1));
-    }
-    
+    if (stream)
+        stream->finish();
 
     for (int j = 0; j < partitions; j++)
     {
@@ -315,3 +430,149 @@ void Integrate::run(Atom atom[], Force &force, Neighbor neighbor[],
         atom[j].d_f->download();
     }
 }
+
+/* bin serially, then build the lists of every partition in parallel,
+   partitions whose lists overflowed are rebuilt with 1.5x maxneighs */
+
+void Integrate::build_native(Atom atom[], Neighbor neighbor[], ThreadPool &pool, int partitions)
+{
+    int* pending = new int[partitions];
+    int npending = partitions;
+    for (int j = 0; j < partitions; j++)
+    {
+        neighbor[j].resize_buffers(atom[j]);
+        neighbor[j].bin_native(atom[j]);
+        pending[j] = 1;
+    }
+
+    while (npending)
+    {
+        int* overflow = new int[partitions * pool.nthreads]();
+        pool.run([&](int tid) {
+            int lo, hi;
+            for (int j = 0; j < partitions; j++)
+            {
+                if (!pending[j])
+                    continue;
+                pool.range(tid, j, partitions, atom[j].nlocal, lo, hi);
+                overflow[j * pool.nthreads + tid] = neighbor[j].build_native(atom[j], lo, hi);
+            }
+        });
+
+        npending = 0;
+        for (int j = 0; j < partitions; j++)
+        {
+            pending[j] = 0;
+            for (int t = 0; t < pool.nthreads; t++)
+                pending[j] |= overflow[j * pool.nthreads + t];
+            if (pending[j])
+            {
+                neighbor[j].grow_neighbors();
+                npending++;
+            }
+        }
+        delete[] overflow;
+    }
+    delete[] pending;
+}
+
+/* forces, and with final the velocity update, on the owned slices;
+   the update of atom i only needs f[i], so no barrier in between */
+
+void Integrate::force_native(Atom atom[], Force &force, Neighbor neighbor[], int partitions, int final)
+{
+    ThreadPool &pool = *force.pool;
+    pool.run([&](int tid) {
+        int lo, hi;
+        for (int j = 0; j < partitions; j++)
+        {
+            pool.range(tid, j, partitions, atom[j].nlocal, lo, hi);
+            force.compute_native(atom[j], neighbor[j], lo, hi);
+            if (!final)
+                continue;
+            MMD_float3* v = atom[j].v;
+            MMD_float3* f = atom[j].f;
+            for (int i = lo; i < hi; i++)
+            {
+                v[i].x += dtforce * f[i].x;
+                v[i].y += dtforce * f[i].y;
+                v[i].z += dtforce * f[i].z;
+            }
+        }
+    });
+}
+
+/* move the partition bounds to even out the owned atoms, the bins
+   and sort grid of every partition follow the new box */
+
+void Integrate::balance(Atom atom[], Neighbor neighbor[], Comm &comm)
+{
+    if (!comm.balance(atom))
+        return;
+    for (int j = 0; j < comm.npatitions; j++)
+    {
+        neighbor[j].setup(atom[j]);
+        atom[j].sort_setup(neighbor[j].cutneigh);
+    }
+}
+
+/* the native backend runs the plain miniMD step loop on the host,
+   exchange and borders are the serial host versions */
+
+void Integrate::run_native(Atom atom[], Force &force, Neighbor neighbor[],
+                           Comm &comm, Thermo &thermo, Timer &timer, int partitions)
+{
+    ThreadPool &pool = *force.pool;
+    for (int n = first; n < ntimes; n++)
+    {
+        pool.run([&](int tid) {
+            int lo, hi;
+            for (int j = 0; j < partitions; j++)
+            {
+                pool.range(tid, j, partitions, atom[j].nlocal, lo, hi);
+                MMD_float3* x = atom[j].x;
+                MMD_float3* v = atom[j].v;
+                MMD_float3* f = atom[j].f;
+                for (int i = lo; i < hi; i++)
+                {
+                    v[i].x += dtforce * f[i].x;
+                    v[i].y += dtforce * f[i].y;
+                    v[i].z += dtforce * f[i].z;
+                    x[i].x += dt * v[i].x;
+                    x[i].y += dt * v[i].y;
+                    x[i].z += dt * v[i].z;
+                }
+            }
+        });
+
+        timer.stamp();
+        if ((n + 1) % neighbor[0].every)
+        {
+            comm.communicate_native(atom, pool);
+            timer.stamp(TIME_COMM);
+        }
+        else
+        {
+            if (comm.balance_every && (++nbalance % comm.balance_every == 0))
+                balance(atom, neighbor, comm);
+            comm.exchange(atom);
+            if (atom[0].sort_curve && (nbuild++ % sort_every == 0))
+                for (int j = 0; j < partitions; j++)
+                    atom[j].sort();
+            comm.borders(atom);
+            timer.stamp(TIME_COMM);
+            build_native(atom, neighbor, pool, partitions);
+            timer.stamp(TIME_NEIGH);
+        }
+
+        force_native(atom, force, neighbor, partitions, 1);
+        timer.stamp(TIME_FORCE);
+
+        if (thermo.nstat)
+            thermo.compute(n + 1, atom, neighbor, force, timer, comm);
+
+        if (ckpt && (n + 1) % neighbor[0].every == 0 && ckpt->due(n + 1))
+            ckpt->save(n + 1, atom, neighbor, comm, *this, partitions);
+    }
+}
+
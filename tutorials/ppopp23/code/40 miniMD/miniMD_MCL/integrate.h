@@ -39,6 +39,10 @@
 #include "timer.h"
 #include "mcl_wrapper.h"
 #include "mcl_data.h"
+#include "taskgraph.h"
+#include "kernel_params.h"
+#include "checkpoint.h"
+#include "traj_stream.h"
 #include "precision.h"
 
 #include <queue>
@@ -53,11 +57,29 @@ class Integrate {
   mcl_handle** integrate_final_hdls;
   mcl_handle** neighbor_hdls;
   std::queue<int> pending_list;
+  IntegrateParams* params;         // per partition scalar block of the integrate kernels
+  int k_initial, k_final, k_pack;  // registered kernel ids
+  int use_graph;                   // capture one step per reneighbor interval and replay it
+  TaskGraph graph;
+  int use_fused;                   // fused integrate_pack / force_integrate kernels
+  int sort_every;                  // reorder atoms every this many reneighborings
+  int first;                       // step the run starts from, >0 after a restart
+  int nbuild, nbalance;            // reneighborings so far, pace sorting and balancing
+  Checkpoint* ckpt;                // snapshots at reneighboring steps, NULL: off
+  TrajStream* stream;              // --share trajectory frames, NULL: off
 
   MCLWrapper* mcl;
   Integrate();
   ~Integrate();
   void setup(int partitions);
-  void run(Atom[], Force &, Neighbor[], Comm &, Thermo &, Timer &, int, int);
+  void run(Atom[], Force &, Neighbor[], Comm &, Thermo &, Timer &, int);
+  void set_params(IntegrateParams &, Atom &);
+  int rebuild_due(Atom[], Neighbor[], int);
+  void balance(Atom[], Neighbor[], Comm &);
+
+  /* native CPU backend (-sse), Force::pool does the work */
+  void run_native(Atom[], Force &, Neighbor[], Comm &, Thermo &, Timer &, int);
+  void build_native(Atom[], Neighbor[], ThreadPool &, int);
+  void force_native(Atom[], Force &, Neighbor[], int, int final);
 };
 #endif
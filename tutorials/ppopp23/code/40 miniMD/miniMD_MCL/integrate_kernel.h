@@ -35,29 +35,30 @@
 //#define MMD_float float;
 
 #include "precision.h"
+#include "kernel_params.h"
 
-__kernel void integrate_initial(__global MMD_floatK3* x, __global MMD_floatK3* v,__global MMD_floatK3* f, int nlocal, MMD_float dt,MMD_float dtforce,int nmax)
+__kernel void integrate_initial(__global MMD_floatK3* x, __global MMD_floatK3* v,__global MMD_floatK3* f, struct IntegrateParams p)
 {
   int i = get_global_id(0);
-  if(i<nlocal)
+  if(i<p.nlocal)
   {
     if(f[i].x > 0 || f[i].y > 0 || f[i].z > 0) {
       if(v[i].x > 0 || v[i].y > 0 || v[i].z > 0) {
-        v[i] += dtforce*f[i];
-        x[i] += dt*v[i];
+        v[i] += p.dtforce*f[i];
+        x[i] += p.dt*v[i];
       }
     }
   }
 }
 
-__kernel void integrate_final(__global MMD_floatK3* v, __global MMD_floatK3* f, int nlocal, MMD_float dt,int nmax)
+__kernel void integrate_final(__global MMD_floatK3* v, __global MMD_floatK3* f, struct IntegrateParams p)
 {
   int i = get_global_id(0);
-  if(i<nlocal)
+  if(i<p.nlocal)
   {
     if(f[i].x > 0 || f[i].y > 0 || f[i].z > 0) {
       if(v[i].x > 0 || v[i].y > 0 || v[i].z > 0) {
-        v[i] += dt*f[i];
+        v[i] += p.dtforce*f[i];
       }
     }
 	  
@@ -65,3 +66,40 @@ __kernel void integrate_final(__global MMD_floatK3* v, __global MMD_floatK3* f,
 
 }
 
+/* integrate_initial fused with the packing of the first swaps, which only
+   send local atoms. slot[FUSED_SWAPS*i+s] is the position of atom i in the
+   send list of swap s (-1 if not sent), so every atom is packed by the
+   work item that integrates it */
+
+__kernel void integrate_pack(__global MMD_floatK3* x, __global MMD_floatK3* v,__global MMD_floatK3* f, __global int* slot,
+                             __global MMD_float* buf0, __global MMD_float* buf1, struct IntegratePackParams p)
+{
+  int i = get_global_id(0);
+  if(i<p.nlocal)
+  {
+    MMD_floatK3 xi = x[i];
+    if(f[i].x > 0 || f[i].y > 0 || f[i].z > 0) {
+      if(v[i].x > 0 || v[i].y > 0 || v[i].z > 0) {
+        MMD_floatK3 vi = v[i] + p.dtforce*f[i];
+        xi += p.dt*vi;
+        v[i] = vi;
+        x[i] = xi;
+      }
+    }
+
+    for(int s=0; s<p.nswap; s++)
+    {
+      int j = slot[FUSED_SWAPS*i+s];
+      if(j<0) continue;
+      MMD_floatK3 xs = xi + p.pbc[s];
+      if(p.self[s])
+        x[j+p.first[s]] = xs;
+      else {
+        __global MMD_float* buf = s ? buf1 : buf0;
+        buf[3*j]=xs.x;
+        buf[3*j+1]=xs.y;
+        buf[3*j+2]=xs.z;
+      }
+    }
+  }
+}
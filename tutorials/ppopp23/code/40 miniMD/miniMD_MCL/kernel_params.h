@@ -0,0 +1,157 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+/* scalar argument blocks of the per-timestep kernels
+   included by the host code and by the kernel sources, so member order
+   and types have to be valid (and identically laid out) on both sides:
+   3-vectors first, then MMD_float, then int */
+
+#ifndef KERNEL_PARAMS_H
+#define KERNEL_PARAMS_H
+
+#include "precision.h"
+
+#ifdef IAMONDEVICE
+#define MMD_paramK3 MMD_floatK3
+#else
+#define MMD_paramK3 MMD_float3
+#endif
+
+struct IntegrateParams {
+  MMD_float dt;
+  MMD_float dtforce;
+  int nlocal;
+  int nmax;
+};
+
+struct CommParams {
+  MMD_paramK3 pbc;                 // PBC shift added to sent positions
+  int offset;                      // start of this swap in the send list
+  int first;                       // first ghost slot to unpack into
+  int n;                           // # of atoms in this swap
+  int pad;
+};
+
+/* atom_pack_batch/atom_unpack_batch: both swaps of one stage (a dimension
+   and hop) in a single launch, they only read atoms of earlier stages */
+
+#define STAGE_SWAPS 2
+
+struct CommBatchParams {
+  MMD_paramK3 pbc[STAGE_SWAPS];    // PBC shift of each swap
+  int offset[STAGE_SWAPS];         // start of each swap in the send list
+  int first[STAGE_SWAPS];          // first ghost slot of each swap
+  int n[STAGE_SWAPS];              // # of atoms of each swap
+  int mode[STAGE_SWAPS];           // 0: skip, 1: through the send buffer, 2: self swap
+};
+
+/* integrate_pack: integrate_initial fused with the first FUSED_SWAPS swaps */
+
+#define FUSED_SWAPS 2
+
+struct IntegratePackParams {
+  MMD_paramK3 pbc[FUSED_SWAPS];    // PBC shift of each fused swap
+  MMD_float dt;
+  MMD_float dtforce;
+  int nlocal;
+  int nswap;                       // # of fused swaps (<= FUSED_SWAPS)
+  int first[FUSED_SWAPS];          // first ghost slot of a self swap
+  int self[FUSED_SWAPS];           // swap sends to its own partition
+};
+
+/* device exchange/borders, see comm_kernel.h */
+
+struct ExchangeParams {
+  MMD_paramK3 shift;               // box size (atom_pbc) or PBC shift (border_pack)
+  MMD_float lo;                    // slab/box bounds in dimension idim
+  MMD_float hi;
+  int idim;
+  int first;                       // first atom of the range / first slot written
+  int n;                           // # of atoms (or buffer entries) in the range
+  int nkeep;                       // exchange: # of owned atoms that stay
+  int offset;                      // borders: start of this swap in the send list
+  int slot;                        // comm_scan: where the total is stored
+};
+
+struct ForceParams {
+  MMD_float cutforcesq;
+  MMD_float dtforce;               // only used by force_integrate
+  int maxneighs;
+  int nlocal;
+  int nall;                        // local + ghost atoms, cleared by force_clear
+  int threads_per_atom;
+  int ghost_newton;                // half list: also accumulate into ghost atoms
+  int compress;                    // neighbor list encoding, see neighbor_codec.h
+};
+
+/* EAM pipeline, see force_eam_kernel.h */
+
+struct EAMParams {
+  MMD_float cutforcesq;
+  MMD_float rdr;                   // 1/dr of the rho(r) and z2(r) splines
+  MMD_float rdrho;                 // 1/drho of the F(rho) spline
+  int nlocal;
+  int nr;                          // # of spline points in r
+  int nrho;                        // # of spline points in rho
+  int compress;                    // neighbor list encoding, see neighbor_codec.h
+  int pad;
+};
+
+/* cluster pair path, see cluster_kernel.h */
+
+struct ClusterParams {
+  MMD_float cutforcesq;
+  MMD_float cutneighsq;
+  int nlocal;
+  int nclusters;                   // cluster slots: mbins * cpb
+  int cpb;                         // cluster slots per bin
+  int atoms_per_bin;
+  int maxpairs;                    // capacity of the cluster pair list
+  int pad;
+};
+
+/* traj_pack: one chunk of owned positions into a trajectory slot,
+   see traj_ring.h for the slot layout */
+
+#define TRAJ_FLOAT 0               // 3 floats per atom
+#define TRAJ_HALF 1                // 3 float16 per atom
+#define TRAJ_FIXED16 2             // 3 ushort per atom, offset from lo in units of 1/scale
+
+struct TrajParams {
+  MMD_paramK3 lo;                  // origin of the fixed16 grid
+  MMD_paramK3 scale;               // 65535 / edge of the fixed16 grid
+  int first;                       // first atom of the chunk
+  int count;                       // # of atoms in the chunk
+  int mode;
+  int pad;
+};
+
+#endif
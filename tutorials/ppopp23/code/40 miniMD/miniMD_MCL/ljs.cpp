@@ -37,11 +37,14 @@
 #include "ljs.h"
 #include "atom.h"
 #include "force.h"
+#include "force_eam.h"
 #include "neighbor.h"
 #include "integrate.h"
 #include "thermo.h"
 #include "comm.h"
 #include "timer.h"
+#include "checkpoint.h"
+#include "traj_stream.h"
 #include "variant.h"
 #include "mcl_wrapper.h"
 #include "mcl_data.h"
@@ -56,7 +59,7 @@ int create_atoms(Atom &, int, int, int, double);
 void create_velocity(double, Atom*, Thermo &, int);
 void output(In &, Atom*, Force&, Neighbor*, Comm &,
             Thermo &, Integrate &, Timer &, int, int);
-int read_lammps_data(MCLWrapper* mcl, Atom &atom, Comm &comm, Neighbor &neighbor, Integrate &integrate, Thermo &thermo, char* file, int units, int nparts);
+int read_lammps_data(Atom*, Comm &, Neighbor*, char*, int);
 void mcl_verify(int res, timespec start);
 
 int main(int argc, char **argv)
@@ -80,6 +83,26 @@ int main(int argc, char **argv)
   int neighbor_size = -1;
   int workers = 1;
   int share = 0;
+  int share_every = 1;
+  const char* share_format = "float";
+  int task_graph = 0;
+  int fuse = 0;
+  int device_exchange = 0;
+  int neigh_check = 0;
+  int neigh_max = 0;
+  int sort = 0;
+  int neigh_compress = 0;
+  int sort_every = 1;
+  int balance = 0;
+  int gather = 0;
+  int batch = 0;
+  int cluster = 0;
+  int checkpoint = 0;
+  const char* checkpoint_file = "miniMD.ckpt";
+  const char* restart = NULL;
+  const char* potential = "Cu_u6.eam";
+  const char* pair_style = "lj";
+  const char* pair_coeff = NULL;
 
   //MCL specific
   int use_tex = 0;
@@ -114,6 +137,23 @@ int main(int argc, char **argv)
      if((strcmp(argv[i],"-n")==0)||(strcmp(argv[i],"--nsteps")==0))  {num_steps=atoi(argv[++i]); continue;}
      if((strcmp(argv[i],"-s")==0)||(strcmp(argv[i],"--size")==0))  {system_size=atoi(argv[++i]); continue;}
      if((strcmp(argv[i],"--share")==0))  {share=1; continue;}
+     if((strcmp(argv[i],"--share_every")==0))  {share_every=atoi(argv[++i]); share=1; continue;}
+     if((strcmp(argv[i],"--share_format")==0))  {share_format=argv[++i]; share=1; continue;}
+     if((strcmp(argv[i],"--task_graph")==0))  {task_graph=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--fuse")==0))  {fuse=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--device_exchange")==0))  {device_exchange=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--neigh_check")==0))  {neigh_check=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--neigh_max")==0))  {neigh_max=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--sort")==0))  {sort=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--neigh_compress")==0))  {neigh_compress=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--sort_every")==0))  {sort_every=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--balance")==0))  {balance=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--comm_gather")==0))  {gather=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--comm_batch")==0))  {batch=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--cluster")==0))  {cluster=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--checkpoint")==0))  {checkpoint=atoi(argv[++i]); continue;}
+     if((strcmp(argv[i],"--checkpoint_file")==0))  {checkpoint_file=argv[++i]; continue;}
+     if((strcmp(argv[i],"--restart")==0))  {restart=argv[++i]; continue;}
      if((strcmp(argv[i],"--half_neigh")==0))  {halfneigh=atoi(argv[++i]); continue;}
      if((strcmp(argv[i],"-sse")==0))  {use_sse=atoi(argv[++i]); continue;}
      if((strcmp(argv[i],"--check_exchange")==0))  {check_safeexchange=1; continue;}
@@ -134,6 +174,12 @@ int main(int argc, char **argv)
        in.forcetype = strcmp(argv[++i], "eam") == 0 ? FORCEEAM : FORCELJ;
        continue;
      }
+     if((strcmp(argv[i], "--pair") == 0)) {pair_style = argv[++i]; continue;}
+     if((strcmp(argv[i], "--pair_coeff") == 0)) {pair_coeff = argv[++i]; continue;}
+     if((strcmp(argv[i], "--potential") == 0)) {
+       potential = argv[++i];
+       continue;
+     }
      if((strcmp(argv[i], "-gn") == 0) || (strcmp(argv[i], "--ghost_newton") == 0)) {
        ghost_newton = atoi(argv[++i]);
        continue;
@@ -165,12 +211,37 @@ int main(int argc, char **argv)
         printf("\t-t / --num_threads <threads>: set number of threads per block (default 32)\n");
         printf("\t--half_neigh <int>:           use half neighborlists (default 0)\n"
                "\t                                0: full neighborlist\n"
-               "\t                                1: half neighborlist (not supported in OpenCL variant)\n"
+               "\t                                1: half neighborlist\n"
                "\t                               -1: original miniMD half neighborlist force \n"
                "\t                                   (not supported in OpenCL variant)\n");
         printf("\t-np / --nparts:               partition problem into grid of size nparts (default:1)\n");
         printf("\t-w  / --workers:              number of MCL workers to use (default:1)\n");
-        printf("\t-sse <sse_version>:           use explicit sse intrinsics (use miniMD-SSE variant)\n");
+        printf("\t-sse <threads>:               run natively on the host with <threads> pinned threads\n"
+               "\t                              and AVX2/AVX-512 forces instead of MCL kernels\n"
+               "\t                              (-1: one per core, default 0)\n");
+        printf("\t--task_graph <int>:           capture the task graph of one step per reneighbor\n"
+               "\t                              interval and replay it for the other steps (default 0)\n");
+        printf("\t--fuse <int>:                 use fused integrate+pack and force+integrate kernels\n"
+               "\t                              (default 0)\n");
+        printf("\t--device_exchange <int>:      run exchange and borders on the device, only atom\n"
+               "\t                              counts are read back (default 0)\n");
+        printf("\t--neigh_check <int>:          check atom displacements every <int> steps and only\n"
+               "\t                              reneighbor once one exceeds half the skin (default 0)\n");
+        printf("\t--neigh_max <int>:            longest reneighbor interval with --neigh_check\n"
+               "\t                              (default 10x neighbor frequency)\n");
+        printf("\t--sort <int>:                 reorder atoms along a space-filling curve when\n"
+               "\t                              reneighboring, 0: off 1: Morton 2: Hilbert (default 0)\n");
+        printf("\t--sort_every <int>:           only reorder every <int>-th reneighboring (default 1)\n");
+        printf("\t--balance <int>:              shift the partition bounds to even out the atom counts\n"
+               "\t                              every <int>-th reneighboring, 0: off (default 0)\n");
+        printf("\t--comm_gather <int>:          with a single MCL device, ghosts are read from the owner\n"
+               "\t                              directly, no send buffer (default 0)\n");
+        printf("\t--comm_batch <int>:           one pack and one unpack launch per partition for\n"
+               "\t                              each dimension and hop instead of each swap (default 0)\n");
+        printf("\t--neigh_compress <int>:       store neighbor lists as 16-bit index differences\n"
+               "\t                              (default 0)\n");
+        printf("\t--cluster <int>:              compute forces on 4x4 or 8x8 atom cluster tiles (4, 8),\n"
+               "\t                              -1: 8 on CPU devices, atom lists otherwise (default 0)\n");
         printf("\t-gn / --ghost_newton <int>:   set usage of newtons third law for ghost atoms\n"
                "\t                              (only applicable with half neighborlists)\n");
         printf("\n  Simulation setup:\n");
@@ -180,7 +251,23 @@ int main(int argc, char **argv)
         printf("\t-b / --neigh_bins <int>:      set linear dimension of neighbor bin grid\n");
         printf("\t-u / --units <string>:        set units (lj or metal), see LAMMPS documentation\n");
         printf("\t-p / --force <string>:        set interaction model (lj or eam)\n");
+        printf("\t--pair <string>:              pair style of the lj force (lj, ljsf, morse, buck, table),\n"
+               "\t                              compiled into the force kernels (default lj)\n");
+        printf("\t--pair_coeff <c1,c2,c3>:      pair coefficients, eps,sigma (lj, ljsf), D0,alpha,r0 (morse)\n"
+               "\t                              or A,rho,C (buck)\n");
+        printf("\t--potential <string>:         EAM potential file in funcfl format (default: Cu_u6.eam)\n"
+               "\t                              or \"r E(r)\" table of --pair table\n");
         printf("\t-f / --data_file <string>:    read configuration from LAMMPS data file\n");
+        printf("\t--restart <string>:           continue from a checkpoint, its input parameters replace\n"
+               "\t                              the input file, -n stays the total number of steps\n");
+        printf("\t--checkpoint <int>:           write a binary checkpoint at the first reneighboring\n"
+               "\t                              after every <int> steps, 0: off (default 0)\n");
+        printf("\t--checkpoint_file <string>:   checkpoint file name (default: miniMD.ckpt)\n");
+        printf("\t--share:                      stream positions to MCL shared buffers for an out-of-process\n"
+               "\t                              consumer (see traj_ring.h, traj_consumer and traj_analysis)\n");
+        printf("\t--share_every <int>:          one trajectory frame every <int> steps (default 1)\n");
+        printf("\t--share_format <string>:      frame encoding, float, half or fixed16 (16-bit offsets\n"
+               "\t                              within the partition) (default float)\n");
 
         printf("\n  Miscelaneous:\n");
         printf("\t--check_exchange:             check whether atoms moved further than subdomain width\n");
@@ -196,6 +283,21 @@ int main(int argc, char **argv)
      }
   }
 
+  Checkpoint ckpt;
+  ckpt.every = checkpoint;
+  ckpt.file = checkpoint_file;
+  if(checkpoint<0)
+  {
+    printf("ERROR: --checkpoint %i is not supported. Exiting.\n",checkpoint);
+    exit(0);
+  }
+  if(restart)
+  {
+    if(ckpt.load(restart, in, nparts)) exit(0);
+    system_size = -1;
+  }
+  ckpt.in = in;
+
   Atom* atom = new Atom[nparts];
   Neighbor* neighbor = new Neighbor[nparts];
   Force force;
@@ -204,25 +306,129 @@ int main(int argc, char **argv)
   Comm comm;
   Timer timer;
 
-  if(in.forcetype == FORCEEAM) {
-	  printf("ERROR: " VARIANT_STRING " does not yet support EAM simulations. Exiting.\n");
-	  exit(0);
+  if(in.forcetype == FORCEEAM && (use_sse || halfneigh || threads_per_atom!=1))
+  {
+    printf("ERROR: EAM is only supported with MCL kernels, full neighborlists and -tpa 1. Exiting.\n");
+    exit(0);
   }
-  if(ghost_newton!=0)
+  if(in.forcetype == FORCEEAM && cluster)
   {
-    printf("ERROR: -ghost_newton %i is not supported in " VARIANT_STRING ". Exiting.\n",ghost_newton);
+    if(cluster>0) printf("# --cluster has no EAM kernels, disabling it\n");
+    cluster = 0;
+  }
+  if(in.forcetype == FORCEEAM)
+  {
+    force.eam = new ForceEAM;
+    force.eam->mcl = mcl;
+    if(force.eam->coeff(potential)) exit(0);
+    // the potential sets the force cutoff, the skin is kept
+    in.neigh_cut += force.eam->cutforce - in.force_cut;
+    in.force_cut = force.eam->cutforce;
+  }
+  if(in.forcetype == FORCELJ)
+  {
+    if(force.pair(pair_style, pair_coeff, potential)) exit(0);
+    if(force.pair_style == PAIR_TABLE) {
+      // the table sets the force cutoff, the skin is kept
+      in.neigh_cut += force.cutforce - in.force_cut;
+      in.force_cut = force.cutforce;
+    }
+  }
+  if(!force.pair_is_lj() && use_sse)
+  {
+    printf("ERROR: -sse only supports --pair lj with the default coefficients. Exiting.\n");
     exit(0);
   }
-  if(halfneigh!=0)
+  if(!force.pair_is_lj() && cluster)
+  {
+    if(cluster>0) printf("# --cluster only supports --pair lj with the default coefficients, disabling it\n");
+    cluster = 0;
+  }
+  if(halfneigh<0 || halfneigh>1)
   {
     printf("ERROR: -half_neigh %i is not supported in " VARIANT_STRING ". Exiting.\n",halfneigh);
     exit(0);
   }
+  if(halfneigh && threads_per_atom!=1)
+  {
+    printf("ERROR: -tpa %i is not supported with half neighborlists in " VARIANT_STRING ". Exiting.\n",threads_per_atom);
+    exit(0);
+  }
+  if(ghost_newton!=0 && !halfneigh)
+  {
+    printf("# -ghost_newton is only applicable with half neighborlists, disabling it\n");
+    ghost_newton = 0;
+  }
+  if(neigh_check<0 || neigh_max<0)
+  {
+    printf("ERROR: --neigh_check/--neigh_max must not be negative. Exiting.\n");
+    exit(0);
+  }
+  if(neigh_check && in.neigh_cut <= in.force_cut)
+  {
+    printf("# --neigh_check needs a neighbor cutoff larger than the force cutoff, disabling it\n");
+    neigh_check = 0;
+  }
+  if(sort<0 || sort>2 || sort_every<1)
+  {
+    printf("ERROR: --sort %i / --sort_every %i is not supported. Exiting.\n",sort,sort_every);
+    exit(0);
+  }
+  if(balance<0)
+  {
+    printf("ERROR: --balance %i is not supported. Exiting.\n",balance);
+    exit(0);
+  }
+  if(use_sse<0)
+    use_sse = std::thread::hardware_concurrency();
+  if(use_sse && halfneigh)
+  {
+    printf("ERROR: -sse is only supported with full neighborlists. Exiting.\n");
+    exit(0);
+  }
+  if(use_sse && (cluster || neigh_compress || neigh_check || task_graph || fuse || device_exchange || share))
+  {
+    printf("# -sse runs without MCL, disabling --cluster, --neigh_compress, --neigh_check,\n"
+           "# --task_graph, --fuse, --device_exchange and --share\n");
+    cluster = neigh_compress = neigh_check = task_graph = fuse = device_exchange = share = 0;
+  }
+  if(cluster<0)
+    cluster = mcl->CPUDevices() ? 8 : 0;
+  if(cluster!=0 && cluster!=4 && cluster!=8)
+  {
+    printf("ERROR: --cluster %i is not supported, use 4 or 8. Exiting.\n",cluster);
+    exit(0);
+  }
+  if(cluster && (halfneigh || threads_per_atom!=1))
+  {
+    printf("ERROR: --cluster is only supported with full neighborlists and -tpa 1. Exiting.\n");
+    exit(0);
+  }
+  if(cluster)
+  {
+    /* same kernel names, the cluster width is a compile time constant */
+    const char* opts = cluster == 8 ? "-DCLUSTER=8" : "-DCLUSTER=4";
+    mcl->RegisterKernel("cluster_kernel.h", "cluster_pairs", opts);
+    mcl->RegisterKernel("cluster_kernel.h", "force_cluster", opts);
+    mcl->RegisterKernel("cluster_kernel.h", "energy_cluster", opts);
+  }
   if(use_tex!=0)
   {
     printf("ERROR: -tex %i is currently broken. Exiting.\n",use_tex);
     exit(0);
   }
+  if(task_graph && share)
+  {
+    printf("# --task_graph is not supported together with --share, disabling task graph\n");
+    task_graph = 0;
+  }
+  int share_mode = strcmp(share_format, "half") == 0 ? TRAJ_HALF :
+                   strcmp(share_format, "fixed16") == 0 ? TRAJ_FIXED16 : TRAJ_FLOAT;
+  if(share && (share_every<1 || (share_mode == TRAJ_FLOAT && strcmp(share_format, "float"))))
+  {
+    printf("ERROR: --share_every %i --share_format %s is not supported. Exiting.\n",share_every,share_format);
+    exit(0);
+  }
   if(use_sse)
   {
     #ifndef VARIANT_SSE
@@ -230,6 +436,16 @@ int main(int argc, char **argv)
     exit(0);
     #endif
   }
+  if(batch && gather)
+  {
+    printf("# --comm_batch already merges the swaps, disabling --comm_gather\n");
+    gather = 0;
+  }
+  if(gather && !mcl->SameDevice(0, nparts - 1))
+  {
+    printf("# --comm_gather needs all partitions on one MCL device, disabling it\n");
+    gather = 0;
+  }
 
   for(int i = 0; i < nparts; i++){
     atom[i].threads_per_atom = threads_per_atom;
@@ -237,6 +453,7 @@ int main(int argc, char **argv)
     atom[i].mcl = mcl;
 
     neighbor[i].halfneigh=halfneigh;
+    neighbor[i].ghost_newton=ghost_newton;
     neighbor[i].mcl = mcl;
 
     if(neighbor_size > 0) {
@@ -263,14 +480,29 @@ int main(int argc, char **argv)
 
     neighbor[i].every = in.neigh_every;
     neighbor[i].cutneigh = in.neigh_cut;
+    neighbor[i].check = neigh_check;
+    neighbor[i].compress = neigh_compress;
+    neighbor[i].cluster = cluster;
+    neighbor[i].max_every = neigh_max ? neigh_max : 10 * in.neigh_every;
+    neighbor[i].skin = in.neigh_cut - in.force_cut;
   }
 
   mcl->blockdim = num_threads;
   comm.do_safeexchange=do_safeexchange;
   force.use_sse=use_sse;
+  if(use_sse)
+    force.pool = new ThreadPool(use_sse, 1);
   
 
   integrate.mcl = mcl;
+  integrate.use_graph = task_graph;
+  integrate.use_fused = fuse;
+  comm.use_fused = fuse;
+  comm.device_exchange = device_exchange;
+  comm.use_gather = gather;
+  comm.use_batch = batch;
+  integrate.sort_every = sort_every;
+  comm.balance_every = balance;
   force.mcl = mcl;
   comm.mcl = mcl;
 
@@ -281,6 +513,9 @@ int main(int argc, char **argv)
     in.ny = system_size;
     in.nz = system_size;
   }
+  ckpt.in.nx = in.nx;
+  ckpt.in.ny = in.ny;
+  ckpt.in.nz = in.nz;
 
   integrate.ntimes = in.ntimes;
   integrate.dt = in.dt;
@@ -289,32 +524,62 @@ int main(int argc, char **argv)
 
   printf("# Create System:\n");
 
-  if(in.datafile && 0) {
-    // read_lammps_data(atom, comm, neighbor, integrate, thermo, in.datafile, in.units);
-    // MMD_float volume = atom[0].box.xprd * atom[0].box.yprd * atom[0].box.zprd;
-    // in.rho = 1.0 * atom.natoms / volume;
-    // force.setup();
+  integrate.setup(nparts);
+
+  force.setup();
+  if(force.eam)
+    force.eam->setup(nparts);
+
+  if(in.datafile && !restart) {
+    if(read_lammps_data(atom, comm, neighbor, in.datafile, nparts)) exit(0);
+    MMD_float volume = atom[0].box.xprd * atom[0].box.yprd * atom[0].box.zprd;
+    in.rho = 1.0 * atom[0].natoms / volume;
 
+    for(int i = 0; i < nparts; i++){
+      atom[i].sort_curve = sort;
+      atom[i].sort_setup(neighbor[0].cutneigh);
+    }
   } else {
     for(int i = 0; i < nparts; i++){
       create_box(atom[i], in.nx, in.ny, in.nz, in.rho);
     }
     comm.setup(neighbor[0].cutneigh, atom, nparts);
+    if(restart)
+      ckpt.restore(atom, neighbor, comm, integrate, nparts);
 
     for(int i = 0; i < nparts; i++){
       neighbor[i].setup(atom[i]);
+      atom[i].sort_curve = sort;
+      atom[i].sort_setup(neighbor[0].cutneigh);
     }
-    
-    integrate.setup(nparts);
 
-    force.setup();
+    if(!restart)
+      for(int i = 0; i < nparts; i++){
+        create_atoms(atom[i], in.nx, in.ny, in.nz, in.rho);
+      }
+  }
 
-    for(int i = 0; i < nparts; i++){
-      create_atoms(atom[i], in.nx, in.ny, in.nz, in.rho);
-    }
-    thermo.setup(mcl, in.rho, integrate, atom[0], in.units, nparts);
-    
+  // the potential's mass wins over Masses of a data file
+  if(force.eam)
+    for(int i = 0; i < nparts; i++)
+      atom[i].mass = force.eam->mass;
+  integrate.dtforce /= atom[0].mass;
+  thermo.setup(mcl, in.rho, integrate, atom[0], in.units, nparts);
+
+  if(!in.datafile && !restart)
     create_velocity(in.t_request, atom, thermo, nparts);
+  if(ckpt.every)
+  {
+    integrate.ckpt = &ckpt;
+    ckpt.setup(integrate.first);
+  }
+  TrajStream stream;
+  if(share)
+  {
+    stream.every = share_every;
+    stream.mode = share_mode;
+    stream.setup(mcl, nparts);
+    integrate.stream = &stream;
   }
   printf("# Done .... \n");
 
@@ -323,6 +588,10 @@ int main(int argc, char **argv)
   fprintf(stdout, "\t# Inputfile: %s\n", input_file == 0 ? "in.lj.miniMD" : input_file);
   fprintf(stdout, "\t# Datafile: %s\n", in.datafile ? in.datafile : "None");
   fprintf(stdout, "\t# ForceStyle: %s\n", in.forcetype == FORCELJ ? "LJ" : "EAM");
+  if(force.eam)
+    fprintf(stdout, "\t# Potential: %s (mass %lf)\n", potential, atom[0].mass);
+  else
+    fprintf(stdout, "\t# PairStyle: %s%s%s\n", pair_style, pair_coeff ? " " : "", pair_coeff ? pair_coeff : "");
   fprintf(stdout, "\t# Units: %s\n", in.units == 0 ? "LJ" : "METAL");
   fprintf(stdout, "\t# Atoms: %i\n", atom[0].natoms);
   fprintf(stdout, "\t# System size: %2.2lf %2.2lf %2.2lf (unit cells: %i %i %i)\n", atom[0].box.xprd, atom[0].box.yprd, atom[0].box.zprd, in.nx, in.ny, in.nz);
@@ -332,11 +601,23 @@ int main(int argc, char **argv)
   fprintf(stdout, "\t# Half neighborlists: %i\n", neighbor[0].halfneigh);
   fprintf(stdout, "\t# Neighbor bins: %i %i %i\n", neighbor[0].nbinx, neighbor[0].nbiny, neighbor[0].nbinz);
   fprintf(stdout, "\t# Neighbor frequency: %i\n", neighbor[0].every);
+  fprintf(stdout, "\t# Compressed neighborlists: %i\n", neighbor[0].compress);
+  fprintf(stdout, "\t# Cluster pair size: %i\n", neighbor[0].cluster);
+  fprintf(stdout, "\t# Displacement check: %i (max interval %i)\n", neighbor[0].check, neighbor[0].check ? neighbor[0].max_every : neighbor[0].every);
   fprintf(stdout, "\t# Timestep size: %lf\n", integrate.dt);
   fprintf(stdout, "\t# Thermo frequency: %i\n", thermo.nstat);
   fprintf(stdout, "\t# Ghost Newton: %i\n", ghost_newton);
   fprintf(stdout, "\t# Use SSE intrinsics: %i\n", force.use_sse);
   fprintf(stdout, "\t# Do safe exchange: %i\n", comm.do_safeexchange);
+  fprintf(stdout, "\t# Task graph replay: %i\n", integrate.use_graph);
+  fprintf(stdout, "\t# Fused kernels: %i\n", integrate.use_fused);
+  fprintf(stdout, "\t# Device exchange: %i\n", comm.device_exchange);
+  fprintf(stdout, "\t# Direct ghost gather: %i\n", comm.use_gather);
+  fprintf(stdout, "\t# Batched ghost swaps: %i\n", comm.use_batch);
+  fprintf(stdout, "\t# Atom sorting: %i (every %i reneighborings)\n", atom[0].sort_curve, integrate.sort_every);
+  fprintf(stdout, "\t# Load balancing: every %i reneighborings (grid %i %i %i)\n", comm.balance_every, comm.procgrid[0], comm.procgrid[1], comm.procgrid[2]);
+  fprintf(stdout, "\t# Checkpoint: every %i steps to %s (restart: %s at step %i)\n", ckpt.every, ckpt.file, restart ? restart : "None", integrate.first);
+  fprintf(stdout, "\t# Trajectory stream: every %i steps (%s)\n", stream.every, share ? share_format : "None");
   fprintf(stdout, "\t# Size of float: %li\n\n",sizeof(MMD_float));
 
   
@@ -364,42 +645,46 @@ int main(int argc, char **argv)
   // return 0;
 
   mcl_handle** hdls = new mcl_handle*[nparts];
-  std::queue<int> pending_list;
-  for(int j = 0; j < nparts; j++){
-    atom[j].d_x->upload();
-    atom[j].d_v->upload();
-    atom[j].d_vold->upload();
-    neighbor[j].resize_buffers(atom[j]);
-    hdls[j] = neighbor[j].binatoms(atom[j]);
-    pending_list.push(j);
-  }
+  if(force.pool) {
+    integrate.build_native(atom, neighbor, *force.pool, nparts);
+  } else {
+    std::queue<int> pending_list;
+    for(int j = 0; j < nparts; j++){
+      atom[j].d_x->upload();
+      atom[j].d_v->upload();
+      atom[j].d_vold->upload();
+      neighbor[j].resize_buffers(atom[j]);
+      hdls[j] = neighbor[j].binatoms(atom[j]);
+      pending_list.push(j);
+    }
   
-  while(!pending_list.empty()){
-    int j = pending_list.front();
-    pending_list.pop();
-    mcl_wait(hdls[j]);
-    mcl_hdl_free(hdls[j]);
-    hdls[j] = neighbor[j].resize_and_bin(atom[j]);
-    if(hdls[j]) pending_list.push(j);
-    else {
-      hdls[j] = neighbor[j].build(atom[j]);
-    } 
-  }
+    while(!pending_list.empty()){
+      int j = pending_list.front();
+      pending_list.pop();
+      mcl_wait(hdls[j]);
+      mcl_hdl_free(hdls[j]);
+      hdls[j] = neighbor[j].resize_and_bin(atom[j]);
+      if(hdls[j]) pending_list.push(j);
+      else {
+        hdls[j] = neighbor[j].build(atom[j]);
+      } 
+    }
 
-  for(int j = 0; j < nparts; j++){
-    mcl_wait(hdls[j]);
-    mcl_hdl_free(hdls[j]);
-    hdls[j] = neighbor[j].reneigh(atom[j]);
-    if(hdls[j]) pending_list.push(j);
-  }
+    for(int j = 0; j < nparts; j++){
+      mcl_wait(hdls[j]);
+      mcl_hdl_free(hdls[j]);
+      hdls[j] = neighbor[j].reneigh(atom[j]);
+      if(hdls[j]) pending_list.push(j);
+    }
 
-  while(!pending_list.empty()){
-    int j = pending_list.front();
-    pending_list.pop();
-    mcl_wait(hdls[j]);
-    mcl_hdl_free(hdls[j]);
-    hdls[j] = neighbor[j].reneigh(atom[j]);
-    if(hdls[j]) pending_list.push(j);
+    while(!pending_list.empty()){
+      int j = pending_list.front();
+      pending_list.pop();
+      mcl_wait(hdls[j]);
+      mcl_hdl_free(hdls[j]);
+      hdls[j] = neighbor[j].reneigh(atom[j]);
+      if(hdls[j]) pending_list.push(j);
+    }
   }
 
   printf("# Starting dynamics ...\n");
@@ -409,13 +694,23 @@ int main(int argc, char **argv)
   //thermo.compute(0,atom,neighbor,force,timer,comm);
   //fprintf(stderr, "Done.\n");
   
-  for(int j = 0; j < nparts; j++){
-    hdls[j] = force.compute(atom[j], neighbor[j], 0, NULL);
-  }
-  mcl_wait_all();
+  if(force.pool) {
+    integrate.force_native(atom, force, neighbor, nparts, 0);
+    thermo.compute(integrate.first,atom,neighbor,force,timer,comm);
+  } else {
+    if(force.eam)
+      force.eam->compute(atom, neighbor, comm, 1, NULL, hdls);
+    else {
+      for(int j = 0; j < nparts; j++){
+        hdls[j] = force.compute(atom[j], neighbor[j], 0, NULL);
+      }
+    }
+    mcl_wait_all();
 
-  for(int j = 0; j < nparts; j++){
-    mcl_hdl_free(hdls[j]);
+    for(int j = 0; j < nparts; j++){
+      mcl_hdl_free(hdls[j]);
+    }
+    thermo.compute(integrate.first,atom,neighbor,force,timer,comm);
   }
   
   //cudaProfilerStart();
@@ -423,14 +718,18 @@ int main(int argc, char **argv)
   clock_gettime(CLOCK_MONOTONIC, &start);
 
   timer.start(TIME_TOTAL);
-  integrate.run(atom,force,neighbor,comm,thermo,timer,nparts,share);
+  if(force.pool)
+    integrate.run_native(atom,force,neighbor,comm,thermo,timer,nparts);
+  else
+    integrate.run(atom,force,neighbor,comm,thermo,timer,nparts);
   timer.stop(TIME_TOTAL);
+  ckpt.finish();
 
   mcl_verify(0, start);
   comm.free();
   //cudaProfilerStop();
 
-  //thermo.compute(-1,atom,neighbor,force,timer,comm);
+  thermo.compute(-1,atom,neighbor,force,timer,comm);
 
   int natoms = 0;
   for(int j = 0; j < nparts; j++){
@@ -448,6 +747,8 @@ int main(int argc, char **argv)
   if(yaml_output)
   output(in,atom,force,neighbor,comm,thermo,integrate,timer,screen_yaml,nparts);
 
+  delete force.pool;
+  delete force.eam;
   delete mcl;
   return 0;
 }
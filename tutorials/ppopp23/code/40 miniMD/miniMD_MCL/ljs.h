@@ -28,6 +28,9 @@
 
    Please read the accompanying README and LICENSE files.
 ---------------------------------------------------------------------- */
+#ifndef LJS_H
+#define LJS_H
+
 #include "precision.h"
 
 enum ForceStyle {FORCELJ, FORCEEAM};
@@ -46,3 +49,5 @@ struct In {
   MMD_float neigh_cut;
   int thermo_nstat;
 };
+
+#endif
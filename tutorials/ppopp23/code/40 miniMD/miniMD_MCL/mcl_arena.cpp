@@ -0,0 +1,102 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstring>
+#include "mcl_arena.h"
+
+std::multimap<size_t, void*> MCLArena::pool;
+size_t MCLArena::pooled = 0;
+
+size_t MCLArena::round(size_t bytes)
+{
+  size_t align = bytes >= ARENA_HUGE ? ARENA_HUGE : (size_t) sysconf(_SC_PAGESIZE);
+  return (bytes + align - 1) / align * align;
+}
+
+/* bytes is rounded up to the size of the block returned */
+
+void* MCLArena::alloc(size_t &bytes)
+{
+  bytes = round(bytes);
+
+  std::multimap<size_t, void*>::iterator it = pool.lower_bound(bytes);
+  if (it != pool.end() && it->first <= 2 * bytes) {
+    void* block = it->second;
+    bytes = it->first;
+    pooled -= bytes;
+    pool.erase(it);
+    return block;
+  }
+
+  void* block = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+  if (bytes >= ARENA_HUGE) madvise(block, bytes, MADV_HUGEPAGE);
+#endif
+  return block;
+}
+
+void* MCLArena::extend(void* block, size_t old_bytes, size_t &bytes)
+{
+  if (!block) return alloc(bytes);
+  if (bytes <= old_bytes) {
+    bytes = old_bytes;
+    return block;
+  }
+  if (bytes < ARENA_GROW * old_bytes) bytes = ARENA_GROW * old_bytes;
+  bytes = round(bytes);
+
+  void* grown = mremap(block, old_bytes, bytes, MREMAP_MAYMOVE);
+  if (grown == MAP_FAILED) {
+    /* no remap, copy into a fresh block, the old one stays valid on failure */
+    grown = alloc(bytes);
+    if (!grown) return NULL;
+    memcpy(grown, block, old_bytes);
+    release(block, old_bytes);
+    return grown;
+  }
+#ifdef MADV_HUGEPAGE
+  if (bytes >= ARENA_HUGE) madvise(grown, bytes, MADV_HUGEPAGE);
+#endif
+  return grown;
+}
+
+void MCLArena::release(void* block, size_t bytes)
+{
+  if (!block) return;
+  if (pooled + bytes <= ARENA_POOL) {
+    pool.insert(std::make_pair(bytes, block));
+    pooled += bytes;
+  } else
+    munmap(block, bytes);
+}
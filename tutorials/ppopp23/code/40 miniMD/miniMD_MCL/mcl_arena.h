@@ -0,0 +1,61 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#ifndef MCL_ARENA_H
+#define MCL_ARENA_H
+
+#include <cstddef>
+#include <map>
+
+/* page aligned backing store of the cMCLData x/xx buffers
+   blocks are anonymous mappings, huge page backed from ARENA_HUGE on,
+   extend() grows a block by at least ARENA_GROW, in place when the
+   address space behind it is free and by moving the pages otherwise,
+   so the contents are never copied; released blocks are kept in a pool
+   and handed out again to allocations of similar size */
+
+#define ARENA_HUGE (2UL << 20)
+#define ARENA_GROW 1.5
+#define ARENA_POOL (256UL << 20)
+
+class MCLArena {
+ public:
+  static void* alloc(size_t &bytes);  // NULL if out of memory
+  static void* extend(void* block, size_t old_bytes, size_t &bytes);
+  static void release(void* block, size_t bytes);
+
+ private:
+  static size_t round(size_t bytes);
+  static std::multimap<size_t, void*> pool;
+  static size_t pooled;
+};
+
+#endif
@@ -28,11 +28,17 @@
 enum copy_mode {x, xx, xy, yx, xyz, xzy}; // yxz, yzx, zxy, zyx not yet implemented since they were not needed yet
 //xx==x in atom_vec x is a member therefore copymode x produces compile errors
 #include "mcl_wrapper.h"
+#include "mcl_arena.h"
 #include <ctime>
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <typeinfo>
 
+/* tile edge of the staged transposes of the yx and xzy modes */
+#define TRANSPOSE_BLOCK 32
+
 template <typename host_type, copy_mode mode>
 class cMCLData
 {
@@ -43,8 +49,10 @@ class cMCLData
 	host_type* host_data;
 	host_type* temp_data;
 	unsigned nbytes;
+	size_t mapped;                    // size of the arena block behind an owned x/xx buffer
 	bool is_continues;
 	bool owns_data;
+	unsigned dirty_begin, dirty_end;  // touched range of the last host index, empty means all of it
 
 	public:
 	cMCLData(MCLWrapper* mcl_wrapper, uint64_t flags, unsigned dim_x, unsigned dim_y=0, unsigned dim_z=0);
@@ -52,6 +60,8 @@ class cMCLData
 	~cMCLData();
 	void setHostData(host_type* host_data);
 	host_type* hostData() { return host_data;};
+	void resize(unsigned dim_x);
+	void touch(unsigned begin, unsigned end);
 
 	void upload();
 	void download();
@@ -60,6 +70,10 @@ class cMCLData
 	unsigned int devSize() {return nbytes;}
 	uint64_t mclFlags() {return flags;}
 	host_type* devData() {return temp_data ? temp_data : host_data;}
+
+	protected:
+	unsigned lastDim() {return mode==x || mode==xx ? dim[0] : (mode==xy || mode==yx ? dim[1] : dim[2]);}
+	void takeRange(unsigned &begin, unsigned &end);
 };
 
 
@@ -72,6 +86,8 @@ cMCLData<host_type, mode>
 	is_continues = true;
 	owns_data = true;
 	flags = mcl_flags;
+	mapped = 0;
+	dirty_begin = dirty_end = 0;
 
 	unsigned ndev;
 	if((mode == x)||(mode==xx))
@@ -105,9 +121,21 @@ cMCLData<host_type, mode>
 		return;
 	}
 
-	host_type* host_tmp = new host_type[ndev];
 	if((mode==x)||(mode==xx))
-		host_data = host_tmp;
+	{
+		mapped = nbytes;
+		host_data = (host_type*) MCLArena::alloc(mapped);
+		temp_data = NULL;
+		if(host_data == NULL)
+		{
+			printf("ERROR: No memory for a %lu byte MCL buffer\n", (unsigned long) nbytes);
+			exit(1);
+		}
+		mcl_register_buffer(host_data, nbytes, mcl_flags);
+		return;
+	}
+
+	host_type* host_tmp = new host_type[ndev];
 	if((mode==xy)||(mode==yx))
 	{
 		host_type** host_tmpx = new host_type*[dim[0]];
@@ -146,6 +174,8 @@ cMCLData<host_type, mode>
 	owns_data = false;
 	temp_data = NULL;
 	flags = mcl_flags;
+	mapped = 0;
+	dirty_begin = dirty_end = 0;
 
 	this->host_data = host_data;
 	unsigned ndev;
@@ -196,10 +226,11 @@ template <typename host_type, copy_mode mode>
 cMCLData<host_type, mode>
 ::~cMCLData()
 {
-	if(owns_data)
+	if(owns_data && ((mode==x)||(mode==xx)))
+		MCLArena::release(host_data, mapped);
+	else if(owns_data)
 	{
 		host_type* host_tmp;
-		if((mode==x)||(mode==xx)) host_tmp=host_data;
 		if((mode==xy)||(mode==yx))
 		{
 			host_tmp=&((host_type**)host_data)[0][0];
@@ -227,45 +258,105 @@ void cMCLData<host_type, mode>
 	this->host_data = host_data;
 }
 
+/* grow an owned x/xx buffer to at least dim_x elements, keeping its contents
+   the buffer takes the whole arena block, so getDim() can return more than
+   asked for, and is registered again under its possibly new address */
+
+template <typename host_type, copy_mode mode>
+void cMCLData<host_type, mode>
+::resize(unsigned dim_x)
+{
+	if(dim_x <= dim[0] || !owns_data || ((mode!=x)&&(mode!=xx))) return;
+
+	if(host_data) mcl_unregister_buffer(host_data);
+	size_t bytes = (size_t) dim_x * sizeof(host_type);
+	if(bytes > mapped)
+	{
+		host_type* grown = (host_type*) MCLArena::extend(host_data, mapped, bytes);
+		if(grown == NULL)
+		{
+			printf("ERROR: No memory to grow a MCL buffer to %lu bytes\n", (unsigned long) bytes);
+			exit(1);
+		}
+		host_data = grown;
+		mapped = bytes;
+	}
+	dim[0] = mapped / sizeof(host_type);
+	nbytes = dim[0] * sizeof(host_type);
+	mcl_register_buffer(host_data, nbytes, flags);
+}
+
+/* narrow the next upload()/download() to elements [begin,end) of the last
+   host index (the atom index of the lists), in every row; touches add up
+   until the transfer, without any the whole buffer moves */
+
+template <typename host_type, copy_mode mode>
+void cMCLData<host_type, mode>
+::touch(unsigned begin, unsigned end)
+{
+	if(end > lastDim()) end = lastDim();
+	if(begin >= end) return;
+	if(dirty_begin == dirty_end)
+	{
+		dirty_begin = begin;
+		dirty_end = end;
+		return;
+	}
+	if(begin < dirty_begin) dirty_begin = begin;
+	if(end > dirty_end) dirty_end = end;
+}
+
+template <typename host_type, copy_mode mode>
+void cMCLData<host_type, mode>
+::takeRange(unsigned &begin, unsigned &end)
+{
+	begin = 0;
+	end = lastDim();
+	if(dirty_begin != dirty_end)
+	{
+		begin = dirty_begin;
+		end = dirty_end;
+	}
+	dirty_begin = dirty_end = 0;
+}
+
+/* x and xx are the device buffer themselves, the other modes are staged
+   in temp_data, rows by memcpy and the transposed modes in square tiles
+   so both sides stay in cache */
+
 template <typename host_type, copy_mode mode>
 void cMCLData<host_type, mode>
 ::upload()
 {
+	unsigned b, e;
+	takeRange(b, e);
+	if(b >= e || !temp_data) return;
+
 	switch(mode)
 	{
 		case x:
-		{	
-			//temp_data = host_data;
-			break;
-		}
-		
 		case xx:
-		{
-			//temp_data = host_data;
 			break;
-		}
 
 		case xy:
 		{
 			for(unsigned i=0; i<dim[0]; ++i)
-			{
-				host_type* temp = &temp_data[i * dim[1]];
-				for(unsigned j=0; j< dim[1]; ++j)
-				{
-					temp[j] = reinterpret_cast<host_type**>(host_data)[i][j];
-				}
-			}
+				memcpy(&temp_data[i * dim[1] + b], &reinterpret_cast<host_type**>(host_data)[i][b], (e - b) * sizeof(host_type));
 			break;
 		}
 		
 		case yx:
 		{
-			for(unsigned j=0; j< dim[1]; ++j)
+			for(unsigned ii=0; ii<dim[0]; ii+=TRANSPOSE_BLOCK)
+			for(unsigned jj=b; jj<e; jj+=TRANSPOSE_BLOCK)
 			{
-				host_type* temp = &temp_data[j * dim[0]];
-				for(unsigned i=0; i< dim[0]; ++i)
+				unsigned ie = ii + TRANSPOSE_BLOCK < dim[0] ? ii + TRANSPOSE_BLOCK : dim[0];
+				unsigned je = jj + TRANSPOSE_BLOCK < e ? jj + TRANSPOSE_BLOCK : e;
+				for(unsigned i=ii; i<ie; ++i)
 				{
-					temp[i] = reinterpret_cast<host_type**>(host_data)[i][j];
+					host_type* row = reinterpret_cast<host_type**>(host_data)[i];
+					for(unsigned j=jj; j<je; ++j)
+						temp_data[j * dim[0] + i] = row[j];
 				}
 			}
 			break;
@@ -274,25 +365,23 @@ void cMCLData<host_type, mode>
 		{
 			for(unsigned i=0; i < dim[0]; ++i)
 			for(unsigned j=0; j < dim[1]; ++j)
-			{
-				host_type* temp = &temp_data[(i * dim[1] + j) * dim[2]];
-				for(unsigned k=0; k < dim[2]; ++k)
-				{
-					temp[k] = reinterpret_cast<host_type***>(host_data)[i][j][k];
-				}
-			}
+				memcpy(&temp_data[(i * dim[1] + j) * dim[2] + b], &reinterpret_cast<host_type***>(host_data)[i][j][b], (e - b) * sizeof(host_type));
 			break;
 		}	
 
 		case xzy:
 		{
 			for(unsigned i=0; i< dim[0]; ++i)
-			for(unsigned k=0; k< dim[2]; ++k)
+			for(unsigned jj=0; jj<dim[1]; jj+=TRANSPOSE_BLOCK)
+			for(unsigned kk=b; kk<e; kk+=TRANSPOSE_BLOCK)
 			{
-				host_type* temp = &temp_data[(i* dim[2]+k)* dim[1]];
-				for(unsigned j=0; j< dim[1]; ++j)
+				unsigned je = jj + TRANSPOSE_BLOCK < dim[1] ? jj + TRANSPOSE_BLOCK : dim[1];
+				unsigned ke = kk + TRANSPOSE_BLOCK < e ? kk + TRANSPOSE_BLOCK : e;
+				for(unsigned j=jj; j<je; ++j)
 				{
-					temp[j] = reinterpret_cast<host_type***>(host_data)[i][j][k];
+					host_type* row = reinterpret_cast<host_type***>(host_data)[i][j];
+					for(unsigned k=kk; k<ke; ++k)
+						temp_data[(i * dim[2] + k) * dim[1] + j] = row[k];
 				}
 			}
 			break;
@@ -304,6 +393,10 @@ template <typename host_type, copy_mode mode>
 void cMCLData<host_type, mode>
 ::download()
 {
+	unsigned b, e;
+	takeRange(b, e);
+	if(b >= e || !temp_data) return;
+
 	switch(mode)
 	{
 		case x:
@@ -312,25 +405,23 @@ void cMCLData<host_type, mode>
 
 		case xy:
 		{
-			for(unsigned i=0; i< dim[0]; ++i)
-			{
-				host_type* temp = &temp_data[i *  dim[1]];
-				for(unsigned j=0; j< dim[1]; ++j)
-				{
-					reinterpret_cast<host_type**>(host_data)[i][j] = temp[j];
-				}
-			}
+			for(unsigned i=0; i<dim[0]; ++i)
+				memcpy(&reinterpret_cast<host_type**>(host_data)[i][b], &temp_data[i * dim[1] + b], (e - b) * sizeof(host_type));
 			break;
 		}
 		
 		case yx:
 		{
-			for(unsigned j=0; j< dim[1]; ++j)
+			for(unsigned jj=b; jj<e; jj+=TRANSPOSE_BLOCK)
+			for(unsigned ii=0; ii<dim[0]; ii+=TRANSPOSE_BLOCK)
 			{
-				host_type* temp = &temp_data[j* dim[0]];
-				for(unsigned i=0; i< dim[0]; ++i)
+				unsigned ie = ii + TRANSPOSE_BLOCK < dim[0] ? ii + TRANSPOSE_BLOCK : dim[0];
+				unsigned je = jj + TRANSPOSE_BLOCK < e ? jj + TRANSPOSE_BLOCK : e;
+				for(unsigned i=ii; i<ie; ++i)
 				{
-					reinterpret_cast<host_type**>(host_data)[i][j] = temp[i];
+					host_type* row = reinterpret_cast<host_type**>(host_data)[i];
+					for(unsigned j=jj; j<je; ++j)
+						row[j] = temp_data[j * dim[0] + i];
 				}
 			}
 			break;
@@ -340,25 +431,23 @@ void cMCLData<host_type, mode>
 		{
 			for(unsigned i=0; i< dim[0]; ++i)
 			for(unsigned j=0; j< dim[1]; ++j)
-			{
-				host_type* temp = &temp_data[(i *  dim[1]+j)* dim[2]];
-				for(unsigned k=0; k< dim[2]; ++k)
-				{
-					reinterpret_cast<host_type***>(host_data)[i][j][k] = temp[k];
-				}
-			}
+				memcpy(&reinterpret_cast<host_type***>(host_data)[i][j][b], &temp_data[(i * dim[1] + j) * dim[2] + b], (e - b) * sizeof(host_type));
 			break;
 		}
 
 		case xzy:
 		{
 			for(unsigned i=0; i< dim[0]; ++i)
-			for(unsigned k=0; k< dim[2]; ++k)
+			for(unsigned kk=b; kk<e; kk+=TRANSPOSE_BLOCK)
+			for(unsigned jj=0; jj<dim[1]; jj+=TRANSPOSE_BLOCK)
 			{
-				host_type* temp = &temp_data[(i *  dim[2]+k)* dim[1]];
-				for(unsigned j=0; j< dim[1]; ++j)
+				unsigned je = jj + TRANSPOSE_BLOCK < dim[1] ? jj + TRANSPOSE_BLOCK : dim[1];
+				unsigned ke = kk + TRANSPOSE_BLOCK < e ? kk + TRANSPOSE_BLOCK : e;
+				for(unsigned j=jj; j<je; ++j)
 				{
-					reinterpret_cast<host_type***>(host_data)[i][j][k] = temp[j];
+					host_type* row = reinterpret_cast<host_type***>(host_data)[i][j];
+					for(unsigned k=kk; k<ke; ++k)
+						row[k] = temp_data[(i * dim[2] + k) * dim[1] + j];
 				}
 			}
 			break;
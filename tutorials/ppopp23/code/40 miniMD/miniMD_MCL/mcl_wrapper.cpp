@@ -30,6 +30,7 @@
 ---------------------------------------------------------------------- */
 
 #include "mcl_wrapper.h"
+#include "taskgraph.h"
 #include <cstring>
 #include <cmath>
 #include <cstdlib>
@@ -38,6 +39,8 @@
 #define MDPREC_STR "2"
 #elif MDPREC == 2
 #define MDPREC_STR "2"
+#elif MDPREC == 3
+#define MDPREC_STR "3"
 #else
 #define MDPREC_STR "1"
 #endif
@@ -48,6 +51,8 @@ MCLWrapper::MCLWrapper()
 	buffersize = 0;
 	buffer_flags = 0;
 	blockdim = 192;
+	capture = NULL;
+	ndev = 0;
 }
 
 MCLWrapper::~MCLWrapper()
@@ -58,9 +63,140 @@ MCLWrapper::~MCLWrapper()
 int MCLWrapper::Init(int argc, char** argv, int workers)
 {
 	mcl_init(workers, 0x0);
+	ndev = mcl_get_ndev();
+
+	RegisterKernel("integrate_kernel.h", "integrate_initial");
+	RegisterKernel("integrate_kernel.h", "integrate_final");
+	RegisterKernel("integrate_kernel.h", "integrate_pack");
+	RegisterKernel("atom_kernel.h", "atom_pack_comm");
+	RegisterKernel("atom_kernel.h", "atom_unpack_comm");
+	RegisterKernel("atom_kernel.h", "atom_comm_self");
+	RegisterKernel("atom_kernel.h", "atom_gather_comm");
+	RegisterKernel("atom_kernel.h", "atom_pack_batch");
+	RegisterKernel("atom_kernel.h", "atom_unpack_batch");
+	RegisterKernel("atom_kernel.h", "atom_pack_reverse");
+	RegisterKernel("atom_kernel.h", "atom_unpack_reverse");
+	RegisterKernel("atom_kernel.h", "atom_reverse_self");
+	RegisterKernel("atom_kernel.h", "atom_pack_scalar");
+	RegisterKernel("atom_kernel.h", "atom_unpack_scalar");
+	RegisterKernel("atom_kernel.h", "atom_scalar_self");
+	RegisterKernel("force_kernel.h", "force_compute");
+	RegisterKernel("force_kernel.h", "force_compute_ev");
+	RegisterKernel("force_kernel.h", "force_compute_loop");
+	RegisterKernel("force_kernel.h", "force_compute_split");
+	RegisterKernel("force_kernel.h", "force_integrate");
+	RegisterKernel("force_kernel.h", "force_clear");
+	RegisterKernel("force_kernel.h", "force_compute_half");
+	RegisterKernel("force_eam_kernel.h", "eam_density");
+	RegisterKernel("force_eam_kernel.h", "eam_force");
+	RegisterKernel("comm_kernel.h", "atom_pbc");
+	RegisterKernel("comm_kernel.h", "atom_sync");
+	RegisterKernel("comm_kernel.h", "comm_scan");
+	RegisterKernel("comm_kernel.h", "exchange_mark");
+	RegisterKernel("comm_kernel.h", "exchange_pack");
+	RegisterKernel("comm_kernel.h", "exchange_fill");
+	RegisterKernel("comm_kernel.h", "exchange_recv_mark");
+	RegisterKernel("comm_kernel.h", "exchange_unpack");
+	RegisterKernel("comm_kernel.h", "border_mark");
+	RegisterKernel("comm_kernel.h", "border_pack");
+	RegisterKernel("comm_kernel.h", "border_unpack");
+	RegisterKernel("comm_kernel.h", "fuse_clear");
+	RegisterKernel("comm_kernel.h", "fuse_slots");
+	RegisterKernel("neighbor_kernel.h", "neighbor_build");
+	RegisterKernel("neighbor_kernel.h", "neighbor_bin");
+	RegisterKernel("neighbor_kernel.h", "neighbor_hold");
+	RegisterKernel("neighbor_kernel.h", "neighbor_displacement");
+	RegisterKernel("thermo_kernel.h", "energy_virial");
+	RegisterKernel("thermo_kernel.h", "temperature");
+	RegisterKernel("thermo_kernel.h", "thermo_reduce");
+	RegisterKernel("share_kernel.h", "traj_pack");
 	return 0;
 }
 
+/* add a kernel to the registry, returns its id
+   the build options are assembled once here instead of on every launch */
+
+int MCLWrapper::RegisterKernel(const char* kernel_src, const char* kernel_name, const char* extra_opts)
+{
+	KernelInfo k;
+	k.src = kernel_src;
+	k.name = kernel_name;
+	k.opts = "-DMDPREC=" MDPREC_STR " -cl-mad-enable -DIAMONDEVICE";
+	std::map<std::string,std::string>::iterator it = src_opts.find(kernel_src);
+	if(it != src_opts.end()) {
+		k.opts += " ";
+		k.opts += it->second;
+	}
+	if(extra_opts) {
+		k.opts += " ";
+		k.opts += extra_opts;
+	}
+	k.launches = 0;
+
+	int id = kernels.size();
+	kernels.push_back(k);
+	kernel_ids[kernel_name] = id;
+	return id;
+}
+
+/* look up a kernel id by name, registering it if it is not known yet */
+
+int MCLWrapper::Kernel(const char* kernel_src, const char* kernel_name)
+{
+	std::map<std::string,int>::iterator it = kernel_ids.find(kernel_name);
+	if(it != kernel_ids.end()) return it->second;
+	return RegisterKernel(kernel_src, kernel_name);
+}
+
+/* add build options to every kernel of a source file, registered or not,
+   e.g. the pair style of force_kernel.h; only before its first launch */
+
+void MCLWrapper::SourceOptions(const char* kernel_src, const char* opts)
+{
+	std::string& o = src_opts[kernel_src];
+	if(!o.empty()) o += " ";
+	o += opts;
+	for(size_t i=0; i<kernels.size(); i++)
+		if(strcmp(kernels[i].src, kernel_src) == 0) {
+			kernels[i].opts += " ";
+			kernels[i].opts += opts;
+		}
+}
+
+/* the cluster pair path only pays off with wide SIMD units and no
+   hardware atomics bottleneck, i.e. on CPU OpenCL devices */
+
+int MCLWrapper::CPUDevices()
+{
+	int ndev = mcl_get_ndev();
+	if(ndev <= 0) return 0;
+	for(int i=0; i<ndev; i++)
+	{
+		mcl_device_info dev;
+		if(mcl_get_dev(i, &dev)) return 0;
+		if(!(dev.type & MCL_TASK_CPU)) return 0;
+	}
+	return 1;
+}
+
+/* whether two partitions can read each other's resident buffers in place,
+   MCL picks the device of every task, so that is only certain when it has
+   exactly one device to pick from */
+
+int MCLWrapper::SameDevice(int pa, int pb)
+{
+	return ndev == 1;
+}
+
+/* free retired handles, only call when all tasks depending on them are done */
+
+void MCLWrapper::ReleaseRetired()
+{
+	for(size_t i=0; i<retired.size(); i++)
+		mcl_hdl_free(retired[i]);
+	retired.clear();
+}
+
 void* MCLWrapper::BufferResize(uint64_t newsize)
 {
 	if(buffer) free(buffer);
@@ -81,57 +217,86 @@ void* MCLWrapper::BufferGrow(uint64_t newsize)
 
 mcl_handle* MCLWrapper::LaunchKernel(const char* kernel_src, const char* kernel_name, int glob_threads, int nwait, mcl_handle** waitlist, int nargs, ...)
 {
+	void* arg_addr[nargs];
+	unsigned int arg_size[nargs];
+	uint64_t arg_flags[nargs];
+
 	va_list args;
 	va_start(args,nargs);
-	//fprintf(stderr, "Creating task.\n");
-	int ret;
-	mcl_handle* hdl = mcl_task_create();
-	//fprintf(stderr, "Setting kernel.\n");
-	ret = mcl_task_set_kernel(hdl, (char*)kernel_src, (char*)kernel_name, nargs, "-DMDPREC=" MDPREC_STR " -cl-mad-enable -DIAMONDEVICE", 0);
 	for(int i=0; i<nargs; i++)
 	{
-		void* arg = va_arg(args,void*);
-		unsigned int size = va_arg(args,unsigned int);
-		uint64_t flags = va_arg(args, uint64_t);
-		//fprintf(stderr, "Setting argument %d: size: %u, flags: %lu.\n", i, size, flags);
-		mcl_task_set_arg(hdl, i, arg, size, flags);
+		arg_addr[i] = va_arg(args,void*);
+		arg_size[i] = va_arg(args,unsigned int);
+		arg_flags[i] = va_arg(args, uint64_t);
 	}
 	va_end(args);
 
-	size_t grid[3];
-	grid[0] = ((glob_threads+blockdim-1)/blockdim)*blockdim;
-	grid[1] = 1;
-	grid[2] = 1;
+	return Launch(Kernel(kernel_src, kernel_name), 0, glob_threads, nwait, waitlist, nargs, arg_addr, arg_size, arg_flags);
+}
 
-	size_t block[3];
-	block[0] = blockdim;
-	block[1] = 1;
-	block[2] = 1;
+/* launch a registered kernel: nbufs (ptr,size,flags) triplets for the
+   buffer arguments followed by a single block holding all scalars */
 
-	//fprintf(stderr, "Executing task, block dim: %ld .\n", blockdim);
-	ret = mcl_exec_with_dependencies(hdl, grid, block, MCL_TASK_GPU, nwait, waitlist);
-	return hdl;
+mcl_handle* MCLWrapper::LaunchKernel(int kernel, int glob_threads, int nwait, mcl_handle** waitlist, void* params, unsigned int params_size, int nbufs, ...)
+{
+	int nargs = nbufs + 1;
+	void* arg_addr[nargs];
+	unsigned int arg_size[nargs];
+	uint64_t arg_flags[nargs];
+
+	va_list args;
+	va_start(args,nbufs);
+	for(int i=0; i<nbufs; i++)
+	{
+		arg_addr[i] = va_arg(args,void*);
+		arg_size[i] = va_arg(args,unsigned int);
+		arg_flags[i] = va_arg(args, uint64_t);
+	}
+	va_end(args);
+
+	arg_addr[nbufs] = params;
+	arg_size[nbufs] = params_size;
+	arg_flags[nbufs] = MCL_ARG_SCALAR;
+
+	return Launch(kernel, 0, glob_threads, nwait, waitlist, nargs, arg_addr, arg_size, arg_flags);
 }
 
 mcl_handle* MCLWrapper::LaunchKernelShared(const char* kernel_src, const char* kernel_name, int glob_threads, int nwait, mcl_handle** waitlist, int nargs, ...)
 {
+	void* arg_addr[nargs];
+	unsigned int arg_size[nargs];
+	uint64_t arg_flags[nargs];
+
 	va_list args;
 	va_start(args,nargs);
-	//fprintf(stderr, "Creating task.\n");
-	int ret;
-	mcl_handle* hdl = mcl_task_create_with_props(MCL_HDL_SHARED);
-	//fprintf(stderr, "Setting kernel.\n");
-	ret = mcl_task_set_kernel(hdl, (char*)kernel_src, (char*)kernel_name, nargs, "-DMDPREC=" MDPREC_STR " -cl-mad-enable -DIAMONDEVICE", 0);
 	for(int i=0; i<nargs; i++)
 	{
-		void* arg = va_arg(args,void*);
-		unsigned int size = va_arg(args,unsigned int);
-		uint64_t flags = va_arg(args, uint64_t);
-		//fprintf(stderr, "Setting argument %d: size: %u, flags: %lu.\n", i, size, flags);
-		mcl_task_set_arg(hdl, i, arg, size, flags);
+		arg_addr[i] = va_arg(args,void*);
+		arg_size[i] = va_arg(args,unsigned int);
+		arg_flags[i] = va_arg(args, uint64_t);
 	}
 	va_end(args);
 
+	return Launch(Kernel(kernel_src, kernel_name), MCL_HDL_SHARED, glob_threads, nwait, waitlist, nargs, arg_addr, arg_size, arg_flags);
+}
+
+/* create, fill and submit one task of a registered kernel
+   props == 0 creates a plain task, otherwise mcl_task_create_with_props is used
+   if a TaskGraph is capturing, the launch is recorded so it can be replayed */
+
+mcl_handle* MCLWrapper::Launch(int kernel, uint64_t props, int glob_threads, int nwait, mcl_handle** waitlist,
+                               int nargs, void** arg_addr, unsigned int* arg_size, uint64_t* arg_flags)
+{
+	int ret;
+	KernelInfo &k = kernels[kernel];
+	mcl_handle* hdl = props ? mcl_task_create_with_props(props) : mcl_task_create();
+	ret = mcl_task_set_kernel(hdl, (char*)k.src, (char*)k.name, nargs, (char*)k.opts.c_str(), 0);
+	for(int i=0; i<nargs; i++)
+	{
+		//fprintf(stderr, "Setting argument %d: size: %u, flags: %lu.\n", i, arg_size[i], arg_flags[i]);
+		mcl_task_set_arg(hdl, i, arg_addr[i], arg_size[i], arg_flags[i]);
+	}
+
 	size_t grid[3];
 	grid[0] = ((glob_threads+blockdim-1)/blockdim)*blockdim;
 	grid[1] = 1;
@@ -144,6 +309,11 @@ mcl_handle* MCLWrapper::LaunchKernelShared(const char* kernel_src, const char* k
 
 	//fprintf(stderr, "Executing task, block dim: %ld .\n", blockdim);
 	ret = mcl_exec_with_dependencies(hdl, grid, block, MCL_TASK_GPU, nwait, waitlist);
+
+	k.launches++;
+
+	if(capture)
+		capture->record(hdl, kernel, props, glob_threads, nwait, waitlist, nargs, arg_addr, arg_size, arg_flags);
 	return hdl;
 }
 
@@ -34,16 +34,32 @@
 
 #include <cstdio>
 #include <cstdarg>
+#include <string>
+#include <vector>
+#include <map>
 #define __CR printf("Got to line %i in '%s'\n",__LINE__,__FILE__);
 
 #include <minos.h>
 
+class TaskGraph;
+
+/* kernel registry entry, filled once in MCLWrapper::Init */
+struct KernelInfo {
+    const char* src;
+    const char* name;
+    std::string opts;                 // OpenCL build options
+    uint64_t launches;
+};
+
 class MCLWrapper{
 public:
     void* buffer;
     uint64_t buffersize;
     uint64_t buffer_flags;
     uint64_t blockdim;
+    TaskGraph* capture;               // if set, every launch is also recorded here
+    std::vector<KernelInfo> kernels;
+    int ndev;                         // devices MCL schedules on
 
     MCLWrapper();
 	~MCLWrapper();
@@ -55,9 +71,25 @@ public:
     void* BufferGrow(uint64_t newsize);
     void* BufferResize(uint64_t newsize);
 
+    int RegisterKernel(const char* kernel_src, const char* kernel_name, const char* extra_opts = NULL);
+    int Kernel(const char* kernel_src, const char* kernel_name);
+    void SourceOptions(const char* kernel_src, const char* opts);  // extra build options of a whole source file
+    int CPUDevices();                 // 1 if every device MCL schedules on is a CPU
+    int SameDevice(int pa, int pb);   // partitions share a memory space
+    void Retire(mcl_handle* hdl) {retired.push_back(hdl);};
+    void ReleaseRetired();
+
     mcl_handle* LaunchKernel(const char* kernel_src, const char* kernel_name, int threads, int nwait, mcl_handle** waitlist, int nargs, ...);
+    mcl_handle* LaunchKernel(int kernel, int threads, int nwait, mcl_handle** waitlist, void* params, unsigned int params_size, int nbufs, ...);
     mcl_handle* SetupKernel(const char* kernel_src, const char* kernel_name, uint64_t props, int nargs, ...);
     mcl_handle* LaunchKernelShared(const char* kernel_src, const char* kernel_name, int threads, int nwait, mcl_handle** waitlist, int nargs, ...);
+    mcl_handle* Launch(int kernel, uint64_t props, int threads, int nwait, mcl_handle** waitlist,
+                       int nargs, void** arg_addr, unsigned int* arg_size, uint64_t* arg_flags);
+
+private:
+    std::map<std::string,int> kernel_ids;
+    std::map<std::string,std::string> src_opts;  // see SourceOptions
+    std::vector<mcl_handle*> retired;  // finished with, freed at the next sync point
 };
 
 
@@ -31,6 +31,7 @@
 
 #include "stdio.h"
 #include "stdlib.h"
+#include "string.h"
 
 #include "neighbor.h"
 
@@ -59,6 +60,20 @@ Neighbor::Neighbor()
   stencil = NULL;
   d_stencil = NULL;
   d_flag = NULL;
+  halfneigh = 0;
+  ghost_newton = 0;
+  compress = 0;
+  check = 0;
+  max_every = 0;
+  skin = 0;
+  d_xhold = NULL;
+  d_dmax = NULL;
+  cluster = 0;
+  nclusters = 0;
+  maxcpairs = 32;
+  cpb = 0;
+  d_ncpairs = NULL;
+  d_cpairs = NULL;
 }
 
 Neighbor::~Neighbor()
@@ -70,6 +85,10 @@ Neighbor::~Neighbor()
   delete d_ibins;
   delete d_stencil;
   delete d_ilist;
+  delete d_xhold;
+  delete d_dmax;
+  delete d_ncpairs;
+  delete d_cpairs;
 //  if (bincount) free(bincount);
 //  if (bins) free(bins);
 }
@@ -91,21 +110,24 @@ void Neighbor::resize_buffers(Atom &atom)
 
   /* extend atom arrays if necessary */
 
+  /* the arena grows them in place or moves their pages, no copies */
+
   if (nall > nmax) {
     if(nmax){
-      mcl_unregister_buffer(d_numneigh->devData());
-      mcl_unregister_buffer(d_neighbors->devData());
-      mcl_unregister_buffer(d_ibins->devData());
-      delete d_neighbors;
-      delete d_numneigh;
-      delete d_ibins;
+      d_numneigh->resize(nall);
+      nmax = d_numneigh->getDim()[0];
+      d_ibins->resize(nmax);
+      d_neighbors->resize(list_size());
+      if (d_xhold) d_xhold->resize(nmax);
+    } else {
+      nmax = nall;
+      //printf("Creating buffer for size: %d\n", nmax);
+      d_numneigh = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nmax);
+      d_neighbors = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, list_size());
+      d_ibins = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nmax);
+      if (check)
+        d_xhold = new cMCLData<MMD_float3,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nmax);
     }
-    
-    nmax = nall;
-    //printf("Creating buffer for size: %d\n", nmax);
-    d_numneigh = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nmax);
-    d_neighbors = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nmax*maxneighs);
-    d_ibins = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nmax);
     numneigh = d_numneigh->hostData();
     neighbors = d_neighbors->hostData();
     ibins = d_ibins->hostData();
@@ -119,7 +141,35 @@ mcl_handle* Neighbor::build(Atom &atom) {
   d_flag->hostData()[0]=0;
   d_flag->upload();
 
-  mcl_handle* hdl = mcl->LaunchKernel("neighbor_kernel.h", "neighbor_build",atom.nlocal, 0, NULL, 13,
+  if (cluster) {
+    /* cluster slots follow the bin layout, resize_and_bin may have grown it */
+    ClusterParams p;
+    cluster_params(p, atom);
+    if (p.nclusters != nclusters) {
+      if (d_ncpairs) {
+        mcl_unregister_buffer(d_ncpairs->devData());
+        mcl_unregister_buffer(d_cpairs->devData());
+        delete d_ncpairs;
+        delete d_cpairs;
+      }
+      nclusters = p.nclusters;
+      d_ncpairs = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nclusters);
+      d_cpairs = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nclusters*maxcpairs);
+    }
+
+    return mcl->LaunchKernel("cluster_kernel.h", "cluster_pairs", nclusters, 0, NULL, 9,
+      atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags(),
+      d_bincount->devData(),d_bincount->devSize(), d_bincount->mclFlags(),
+      d_bins->devData(),d_bins->devSize(), d_bins->mclFlags(),
+      d_stencil->devData(),d_stencil->devSize(), d_stencil->mclFlags(),
+      d_ncpairs->devData(),d_ncpairs->devSize(), d_ncpairs->mclFlags(),
+      d_cpairs->devData(),d_cpairs->devSize(), d_cpairs->mclFlags(),
+      d_flag->devData(),d_flag->devSize(), d_flag->mclFlags(),
+      &nstencil,sizeof(nstencil), MCL_ARG_SCALAR,
+      &p,sizeof(p), MCL_ARG_SCALAR);
+  }
+
+  mcl_handle* hdl = mcl->LaunchKernel("neighbor_kernel.h", "neighbor_build",atom.nlocal, 0, NULL, 16,
     atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags(),
     d_numneigh->devData(),d_numneigh->devSize(), d_numneigh->mclFlags(),
     d_neighbors->devData(),d_neighbors->devSize(), d_neighbors->mclFlags(),
@@ -132,7 +182,10 @@ mcl_handle* Neighbor::build(Atom &atom) {
     &cutneighsq,sizeof(cutneighsq), MCL_ARG_SCALAR,
     &atoms_per_bin,sizeof(atoms_per_bin), MCL_ARG_SCALAR, 
     &maxneighs,sizeof(maxneighs), MCL_ARG_SCALAR,
-    &atom.nlocal, sizeof(atom.nlocal), MCL_ARG_SCALAR
+    &atom.nlocal, sizeof(atom.nlocal), MCL_ARG_SCALAR,
+    &halfneigh, sizeof(halfneigh), MCL_ARG_SCALAR,
+    &ghost_newton, sizeof(ghost_newton), MCL_ARG_SCALAR,
+    &compress, sizeof(compress), MCL_ARG_SCALAR
     );
 
   return hdl;
@@ -141,13 +194,15 @@ mcl_handle* Neighbor::build(Atom &atom) {
 
 mcl_handle* Neighbor::reneigh(Atom &atom) {
   d_flag->download();
+  if(d_flag->hostData()[0] && cluster)
+  {
+    maxcpairs *= 1.5;
+    d_cpairs->resize(nclusters*maxcpairs);
+    return build(atom);
+  }
   if(d_flag->hostData()[0])
   {
-    mcl_unregister_buffer(d_neighbors->devData());
-    delete d_neighbors;
-    maxneighs *= 1.5;
-    d_neighbors = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, nmax*maxneighs);
-    neighbors = d_neighbors->hostData();
+    grow_neighbors();
     //fprintf(stderr, "Creating new handle, returning...\n");
     return build(atom);
   }
@@ -155,7 +210,133 @@ mcl_handle* Neighbor::reneigh(Atom &atom) {
   return NULL;
   
 }
+
+void Neighbor::grow_neighbors()
+{
+  maxneighs *= 1.5;
+  d_neighbors->resize(list_size());
+  neighbors = d_neighbors->hostData();
+}
+
+/* native backend: serial counting sort of all atoms into bins, same bin
+   layout as neighbor_bin, bins are doubled until every atom fits */
+
+void Neighbor::bin_native(Atom &atom)
+{
+  int nall = atom.nlocal + atom.nghost;
+  MMD_float3 *x = atom.x;
+  int overflow;
+
+  xprd = atom.box.xprd;
+  yprd = atom.box.yprd;
+  zprd = atom.box.zprd;
+
+  do {
+    overflow = 0;
+    for (int i = 0; i < mbins; i++) bincount[i] = 0;
+    for (int i = 0; i < nall; i++) {
+      int ibin = coord2bin(x[i].x, x[i].y, x[i].z);
+      ibins[i] = ibin;
+      if (bincount[ibin] < atoms_per_bin)
+        bins[ibin*atoms_per_bin + bincount[ibin]] = i;
+      else
+        overflow = 1;
+      bincount[ibin]++;
+    }
+    if (overflow) {
+      mcl_unregister_buffer(d_bins->devData());
+      delete d_bins;
+      atoms_per_bin *= 2;
+      d_bins = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, mbins*atoms_per_bin);
+      bins = d_bins->hostData();
+    }
+  } while (overflow);
+}
+
+/* native backend: full lists of owned atoms lo..hi-1 after bin_native,
+   stored row major (neighbors[i*maxneighs+k]) since each list is only
+   read by the thread owning i */
+
+int Neighbor::build_native(Atom &atom, int lo, int hi)
+{
+  MMD_float3 *x = atom.x;
+  int overflow = 0;
+
+  for (int i = lo; i < hi; i++) {
+    int* neighptr = &neighbors[i*maxneighs];
+    int ibin = ibins[i];
+    const MMD_float xtmp = x[i].x;
+    const MMD_float ytmp = x[i].y;
+    const MMD_float ztmp = x[i].z;
+    int n = 0;
+
+    for (int k = 0; k < nstencil; k++) {
+      int jbin = ibin + stencil[k];
+      int* loc_bin = &bins[jbin*atoms_per_bin];
+      for (int m = 0; m < bincount[jbin]; m++) {
+        int j = loc_bin[m];
+        MMD_float delx = xtmp - x[j].x;
+        MMD_float dely = ytmp - x[j].y;
+        MMD_float delz = ztmp - x[j].z;
+        MMD_float rsq = delx*delx + dely*dely + delz*delz;
+        if (rsq <= cutneighsq && j != i) {
+          if (n < maxneighs) neighptr[n] = j;
+          n++;
+        }
+      }
+    }
+
+    numneigh[i] = n;
+    if (n > maxneighs) overflow = 1;
+  }
+  return overflow;
+}
       
+/* # of ints in d_neighbors, a compressed list stores maxneighs shorts per atom */
+
+int Neighbor::list_size()
+{
+  return compress ? (nmax * maxneighs + 1) / 2 : nmax * maxneighs;
+}
+
+/* parameters shared by cluster_pairs and force_cluster */
+
+void Neighbor::cluster_params(ClusterParams &p, Atom &atom)
+{
+  cpb = (atoms_per_bin + cluster - 1) / cluster;
+  p.cutforcesq = 0;
+  p.cutneighsq = cutneighsq;
+  p.nlocal = atom.nlocal;
+  p.nclusters = mbins * cpb;
+  p.cpb = cpb;
+  p.atoms_per_bin = atoms_per_bin;
+  p.maxpairs = maxcpairs;
+  p.pad = 0;
+}
+
+/* largest displacement of an owned atom since binatoms() */
+
+mcl_handle* Neighbor::displacement(Atom &atom, int nwait, mcl_handle** waitlist)
+{
+  d_dmax->hostData()[0]=0;
+  d_dmax->upload();
+  return mcl->LaunchKernel("neighbor_kernel.h", "neighbor_displacement", atom.nlocal, nwait, waitlist, 4,
+    atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags(),
+    d_xhold->devData(),d_xhold->devSize(), d_xhold->mclFlags(),
+    d_dmax->devData(),d_dmax->devSize(), d_dmax->mclFlags(),
+    &atom.nlocal, sizeof(atom.nlocal), MCL_ARG_SCALAR);
+}
+
+/* two atoms moving towards each other by more than half the skin each
+   may have come within the force cutoff without being in the list */
+
+int Neighbor::rebuild_due()
+{
+  float dsq;
+  memcpy(&dsq, d_dmax->hostData(), sizeof(float));
+  return 4.0 * dsq > skin * skin;
+}
+
 /* bin owned and ghost atoms */
 
 mcl_handle* Neighbor::binatoms(Atom &atom)
@@ -191,9 +372,21 @@ mcl_handle* Neighbor::binatoms(Atom &atom)
   d_flag->upload();
   d_bincount->upload();
 
+  /* remember where the owned atoms were binned for the displacement check */
+  uint64_t rewrite = atom.host_modified ? MCL_ARG_REWRITE : 0;
+  mcl_handle* hold = NULL;
+  if (check) {
+    hold = mcl->LaunchKernel("neighbor_kernel.h", "neighbor_hold", nlocal, 0, NULL, 3,
+      atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags() | rewrite,
+      d_xhold->devData(),d_xhold->devSize(), d_xhold->mclFlags(),
+      &nlocal,sizeof(nlocal), MCL_ARG_SCALAR);
+    mcl->Retire(hold);
+    rewrite = 0;
+  }
+
   //fprintf(stderr, "Launching kernel...");
-  mcl_handle* hdl = mcl->LaunchKernel("neighbor_kernel.h", "neighbor_bin",nall, 0, NULL, 12,
-    atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags() | MCL_ARG_REWRITE,
+  mcl_handle* hdl = mcl->LaunchKernel("neighbor_kernel.h", "neighbor_bin",nall, hold ? 1 : 0, hold ? &hold : NULL, 12,
+    atom.d_x->devData(),atom.d_x->devSize(), atom.d_x->mclFlags() | rewrite,
     d_bincount->devData(),d_bincount->devSize(), d_bincount->mclFlags() | MCL_ARG_REWRITE,
     d_bins->devData(),d_bins->devSize(), d_bins->mclFlags(),
     d_ibins->devData(),d_ibins->devSize(), d_ibins->mclFlags(),
@@ -405,29 +598,57 @@ factor < 1.0 for special case of LJ benchmark so code will create
   if (nextz*binsizez < FACTOR*cutneigh) nextz++;
 
   nmax = (2*nextz+1) * (2*nexty+1) * (2*nextx+1);
+  if (d_stencil)
+    mcl_unregister_buffer(d_stencil->devData());
   delete d_stencil;
   d_stencil = new cMCLData<int,xx>(mcl, MCL_ARG_INPUT | MCL_ARG_RESIDENT | MCL_ARG_BUFFER | MCL_ARG_RDONLY, nmax);
   stencil = d_stencil->hostData();
 
 
   nstencil = 0;
-  for (k = -nextz; k <= nextz; k++) {
-    for (j = -nexty; j <= nexty; j++) {
-      for (i = -nextx; i <= nextx; i++) {
-	    if (bindist(i,j,k) < cutneighsq) {
-	      stencil[nstencil++] = k*mbiny*mbinx + j*mbinx + i;
-	    }
+  if (halfneigh && ghost_newton) {
+    /* half stencil: own bin first, then the bins "above" it,
+       pairs with ghosts are stored by only one of the two partitions */
+    stencil[nstencil++] = 0;
+    for (k = 0; k <= nextz; k++) {
+      for (j = -nexty; j <= nexty; j++) {
+        for (i = -nextx; i <= nextx; i++) {
+          if ((k > 0 || j > 0 || (j == 0 && i > 0)) && bindist(i,j,k) < cutneighsq) {
+            stencil[nstencil++] = k*mbiny*mbinx + j*mbinx + i;
+          }
+        }
+      }
+    }
+  } else {
+    for (k = -nextz; k <= nextz; k++) {
+      for (j = -nexty; j <= nexty; j++) {
+        for (i = -nextx; i <= nextx; i++) {
+	      if (bindist(i,j,k) < cutneighsq) {
+	        stencil[nstencil++] = k*mbiny*mbinx + j*mbinx + i;
+	      }
+        }
       }
     }
   }
   d_stencil->upload();
 
+  /* called again when the box bounds move, drop the old bins */
+
+  if (d_bincount) {
+    mcl_unregister_buffer(d_bincount->devData());
+    delete d_bincount;
+    mcl_unregister_buffer(d_bins->devData());
+    delete d_bins;
+  }
   mbins = mbinx*mbiny*mbinz;
   d_bincount = new cMCLData<int,xx>(mcl, MCL_ARG_RESIDENT | MCL_ARG_INPUT | MCL_ARG_DYNAMIC | MCL_ARG_BUFFER, mbins);
   bincount = d_bincount->hostData();
   d_bins = new cMCLData<int,xx>(mcl, MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC | MCL_ARG_BUFFER, mbins*atoms_per_bin);
   bins = d_bins->hostData();
-  d_flag = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_INPUT | MCL_ARG_OUTPUT | MCL_ARG_RESIDENT | MCL_ARG_REWRITE, 1);
+  if (!d_flag)
+    d_flag = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_INPUT | MCL_ARG_OUTPUT | MCL_ARG_RESIDENT | MCL_ARG_REWRITE, 1);
+  if (!d_dmax)
+    d_dmax = new cMCLData<int,xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_INPUT | MCL_ARG_OUTPUT | MCL_ARG_RESIDENT | MCL_ARG_REWRITE, 1);
   return 0;
 }
       
@@ -35,6 +35,7 @@
 #include "atom.h"
 #include "mcl_wrapper.h"
 #include "mcl_data.h"
+#include "kernel_params.h"
 #include "precision.h"
 
 class Neighbor {
@@ -68,18 +69,40 @@ class Neighbor {
   cMCLData<int, xx>* d_flag;
 
   int halfneigh;
+  int compress;                    // 16-bit delta encoded lists, see neighbor_codec.h
+  int list_size();
+
+  int check;                       // check displacements every this often (0: fixed interval)
+  int max_every;                   // longest interval between builds when checking
+  MMD_float skin;                  // neighbor minus force cutoff
+  cMCLData<MMD_float3, xx>* d_xhold;  // owned positions at the last build
+  cMCLData<int, xx>* d_dmax;       // largest squared displacement (float bits)
+  mcl_handle* displacement(Atom &, int nwait, mcl_handle** waitlist);
+  int rebuild_due();               // after displacement(): moved more than skin/2
+
+  int cluster;                     // atoms per cluster for the cluster pair path (0: atom lists)
+  int nclusters;                   // cluster slots, cpb per bin
+  int maxcpairs;                   // max number of cluster pairs per cluster
+  cMCLData<int, xx>* d_ncpairs;    // # of cluster pairs of each cluster
+  cMCLData<int, xx>* d_cpairs;     // transposed like d_neighbors
+  cMCLData<int, xx>* d_bincount;
+  cMCLData<int, xx>* d_bins;
+  void cluster_params(ClusterParams &, Atom &);
+
+  void bin_native(Atom &);                // host binning for the native backend
+  int build_native(Atom &, int lo, int hi);  // row major lists of atoms lo..hi-1, 1 on overflow
+  void grow_neighbors();                  // 1.5x maxneighs
   
  private:
   MMD_float xprd,yprd,zprd;           // box size
 
   int nmax;                        // max size of atom arrays in neighbor
   int *bincount;                    // ptr to 1st atom in each bin
-  cMCLData<int, xx>* d_bincount;
   int *bins;                       // ptr to next atom in each bin
-  cMCLData<int, xx>* d_bins;
   int *ibins;                       // ptr to next atom in each bin
   cMCLData<int, xx>* d_ibins;
   int atoms_per_bin;
+  int cpb;                         // clusters per bin
 
   int nstencil;                    // # of bins in stencil
   int *stencil;                    // stencil list of bin offsets
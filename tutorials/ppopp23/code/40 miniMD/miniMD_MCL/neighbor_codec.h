@@ -0,0 +1,79 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+/* compressed neighbor lists (Neighbor::compress), kernel side
+   the list of atom i keeps the transposed layout, but entry k is the short
+   at [k*nlocal+i]: the difference to the previous neighbor (to i for the
+   first one). Differences that do not fit are stored as NEIGH_ESCAPE
+   followed by the index in two shorts. maxneighs counts shorts. */
+
+#ifndef NEIGHBOR_CODEC_H
+#define NEIGHBOR_CODEC_H
+
+#define NEIGH_ESCAPE (-32768)
+
+/* append j to the list of i, returns the # of shorts used so far
+   nothing is written past maxneighs, the caller flags the overflow */
+
+inline int neigh_put(__global int* neighbors, int i, int nlocal, int maxneighs, int pos, int prev, int j)
+{
+  __global short* nb = (__global short*) neighbors + i;
+  int d = j - prev;
+  if(d > NEIGH_ESCAPE && d < -NEIGH_ESCAPE)
+  {
+    if(pos < maxneighs) nb[pos*nlocal] = (short) d;
+    return pos + 1;
+  }
+  if(pos + 2 < maxneighs)
+  {
+    nb[pos*nlocal] = (short) NEIGH_ESCAPE;
+    nb[(pos+1)*nlocal] = (short) (j & 0xffff);
+    nb[(pos+2)*nlocal] = (short) (j >> 16);
+  }
+  return pos + 3;
+}
+
+/* k-th neighbor of i, calls have to go through k = 0,1,... in order
+   pos and j carry the decoder state and start at 0 and i */
+
+inline int neigh_at(__global const int* neighbors, int i, int k, int nlocal, int compress, int* pos, int j)
+{
+  if(!compress) return neighbors[k*nlocal+i];
+
+  __global const short* nb = (__global const short*) neighbors + i;
+  int d = nb[(*pos)++ * nlocal];
+  if(d != NEIGH_ESCAPE) return j + d;
+  int lo = (unsigned short) nb[(*pos)++ * nlocal];
+  int hi = (unsigned short) nb[(*pos)++ * nlocal];
+  return lo | (hi << 16);
+}
+
+#endif
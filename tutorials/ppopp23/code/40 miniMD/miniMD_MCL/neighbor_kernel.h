@@ -30,6 +30,7 @@
 ---------------------------------------------------------------------- */
 
 #include "precision.h"
+#include "neighbor_codec.h"
 //#define MMD_floatK3 float3;
 //#define MMD_float float;
 /*
@@ -42,9 +43,17 @@ int coord2bin(MMD_floatK3 &x,MMD_floatK3 &bininv, MMD_floatK3 &prd, int3 &mbinlo
 	return (iz*mbin.y*mbin.x + iy*mbin.x + ix + 1);
 }*/
 
+/* halfneigh == 0: full list, every pair is stored by both atoms
+   halfneigh == 1, ghost_newton == 0: full stencil, only j > i is kept, so
+     local pairs are stored once and all ghosts are kept
+   halfneigh == 1, ghost_newton == 1: half stencil (own bin first), ghosts
+     in the own bin are kept only if they lie "above" i, so every pair
+     is stored exactly once by some partition */
+
 __kernel void neighbor_build(__global MMD_floatK3* x, __global int* numneigh, __global int* neighbors,
 		__global int* bincount, __global int* bins, __global int* ibins, __global int* flag,
-		__global int* stencil, int nstencil, MMD_float cutneighsq, int atoms_per_bin, int maxneighs, int nlocal)//,MMD_floatK3 &bininv, MMD_floatK3 prd, int3 &mbinlo, int3 nbin, int3 mbin)
+		__global int* stencil, int nstencil, MMD_float cutneighsq, int atoms_per_bin, int maxneighs, int nlocal,
+		int halfneigh, int ghost_newton, int compress)//,MMD_floatK3 &bininv, MMD_floatK3 prd, int3 &mbinlo, int3 nbin, int3 mbin)
 {
 
 	int i = get_global_id(0);
@@ -52,22 +61,48 @@ __kernel void neighbor_build(__global MMD_floatK3* x, __global int* numneigh, __
 	int ibin = ibins[i];
 	MMD_floatK3 xtmp = x[i];
 	int n = 0;
+	int pos = 0;
+	int prev = i;
 	for(int k = 0; k < nstencil; k++)
 	{
 		int jbin = ibin + stencil[k];
 	    for(int m=0;m<bincount[jbin];m++)
 	    {
 	      int j = bins[jbin*atoms_per_bin+m];
+	      if(halfneigh)
+	      {
+	        if(!ghost_newton && j<=i) continue;
+	        if(ghost_newton && jbin==ibin)
+	        {
+	          if(j<=i) continue;
+	          if(j>=nlocal)
+	          {
+	            MMD_floatK3 xj = x[j];
+	            if(xj.z<xtmp.z) continue;
+	            if(xj.z==xtmp.z && xj.y<xtmp.y) continue;
+	            if(xj.z==xtmp.z && xj.y==xtmp.y && xj.x<xtmp.x) continue;
+	          }
+	        }
+	      }
 	      MMD_floatK3 del = xtmp - x[j];
 	      MMD_float rsq = del.x*del.x + del.y*del.y + del.z*del.z;
-	      if ((rsq <= cutneighsq)&&(j!=i)) neighbors[i+n++*nlocal] = j;
+	      if ((rsq <= cutneighsq)&&(j!=i))
+	      {
+	        if(compress)
+	        {
+	          pos = neigh_put(neighbors, i, nlocal, maxneighs, pos, prev, j);
+	          prev = j;
+	          n++;
+	        }
+	        else neighbors[i+n++*nlocal] = j;
+	      }
 
 	    }
 
 	}
 
 	numneigh[i] = n;
-	if(n>maxneighs)
+	if(n>maxneighs || pos>maxneighs)
 	  	flag[0] = 1;
 
 }
@@ -116,3 +151,25 @@ __kernel void neighbor_bin(__global MMD_floatK3* xg, __global int* bincount, __g
 
 }
 
+
+/* positions of the owned atoms at the last build, for the displacement check */
+
+__kernel void neighbor_hold(__global MMD_floatK3* x, __global MMD_floatK3* xhold, int nlocal)
+{
+	int i = get_global_id(0);
+	if(i>=nlocal) return;
+	xhold[i] = x[i];
+}
+
+/* largest squared displacement since the last build, kept as the bits of a
+   non-negative float so that atomic_max on int orders it correctly */
+
+__kernel void neighbor_displacement(__global MMD_floatK3* x, __global MMD_floatK3* xhold,
+		__global int* dmax, int nlocal)
+{
+	int i = get_global_id(0);
+	if(i>=nlocal) return;
+	MMD_floatK3 del = x[i] - xhold[i];
+	float rsq = (float) (del.x*del.x + del.y*del.y + del.z*del.z);
+	atomic_max(&dmax[0], as_int(rsq));
+}
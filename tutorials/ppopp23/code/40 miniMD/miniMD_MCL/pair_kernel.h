@@ -0,0 +1,104 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+/* pair styles of the LJ kernels, one definition of E(r) and of
+   fpair = -dE/dr / r for every style. The style and its coefficients
+   are fixed when the kernels are built (-DPAIR_STYLE=.. -DPAIR_C0=..,
+   see Force::pair_options), so the inner loops have no branches left
+   and unused energy terms are dropped by the compiler.
+   The coefficients are precomputed on the host:
+   PAIR_LJ       C0..C3: 48 eps s^12, 24 eps s^6, 4 eps s^12, 4 eps s^6
+   PAIR_LJSF     like PAIR_LJ, C4: F(rc), C5: E(rc), C6: rc, force and
+                 energy are shifted to go to zero at the cutoff
+   PAIR_MORSE    C0: D0, C1: alpha, C2: r0
+   PAIR_BUCK     C0: A, C1: 1/rho, C2: C
+   PAIR_TABLE    C0: r of the first table point, C1: 1/dr, C2: # of points
+                 ptab holds the spline of E(r), see ForceEAM::interpolate */
+
+#ifndef PAIR_KERNEL_H
+#define PAIR_KERNEL_H
+
+#include "precision.h"
+
+#define PAIR_LJ 0
+#define PAIR_LJSF 1
+#define PAIR_MORSE 2
+#define PAIR_BUCK 3
+#define PAIR_TABLE 4
+
+#ifdef IAMONDEVICE
+
+#ifndef PAIR_STYLE
+#define PAIR_STYLE PAIR_LJ
+#define PAIR_C0 48.0f
+#define PAIR_C1 24.0f
+#define PAIR_C2 4.0f
+#define PAIR_C3 4.0f
+#endif
+
+inline void pair_eval(MMD_float rsq, __global const MMD_float* ptab, MMD_float* fpair, MMD_float* epair)
+{
+#if PAIR_STYLE == PAIR_LJ || PAIR_STYLE == PAIR_LJSF
+  MMD_float sr2 = 1.0f/rsq;
+  MMD_float sr6 = sr2*sr2*sr2;
+  *fpair = sr6*(PAIR_C0*sr6 - PAIR_C1)*sr2;
+  *epair = sr6*(PAIR_C2*sr6 - PAIR_C3);
+#if PAIR_STYLE == PAIR_LJSF
+  MMD_float r = sqrt(rsq);
+  *fpair -= PAIR_C4/r;
+  *epair += (r - PAIR_C6)*PAIR_C4 - PAIR_C5;
+#endif
+#elif PAIR_STYLE == PAIR_MORSE
+  MMD_float r = sqrt(rsq);
+  MMD_float dexp = exp(-PAIR_C1*(r - PAIR_C2));
+  *fpair = 2.0f*PAIR_C0*PAIR_C1*(dexp*dexp - dexp)/r;
+  *epair = PAIR_C0*(dexp*dexp - 2.0f*dexp);
+#elif PAIR_STYLE == PAIR_BUCK
+  MMD_float r2inv = 1.0f/rsq;
+  MMD_float r6inv = r2inv*r2inv*r2inv;
+  MMD_float r = sqrt(rsq);
+  MMD_float rexp = PAIR_C0*exp(-r*PAIR_C1);
+  *fpair = (r*rexp*PAIR_C1 - 6.0f*PAIR_C2*r6inv)*r2inv;
+  *epair = rexp - PAIR_C2*r6inv;
+#elif PAIR_STYLE == PAIR_TABLE
+  MMD_float r = sqrt(rsq);
+  MMD_float p = (r - PAIR_C0)*PAIR_C1 + 1.0f;
+  int m = clamp((int) p, 1, (int) PAIR_C2 - 1);
+  p = min(p - m, (MMD_float) 1.0f);
+  __global const MMD_float* c = &ptab[m*7];
+  *fpair = -((c[0]*p + c[1])*p + c[2])/r;
+  *epair = ((c[3]*p + c[4])*p + c[5])*p + c[6];
+#endif
+}
+
+#endif /* IAMONDEVICE */
+
+#endif /* PAIR_KERNEL_H */
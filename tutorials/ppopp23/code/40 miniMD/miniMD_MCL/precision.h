@@ -70,7 +70,10 @@ typedef double MMD_float;
 
 #endif //MDPREC == 2
 
-#if MDPREC == 1
+/* MDPREC 3 is mixed precision: positions and velocities are stored
+   like MDPREC 1, forces and thermo sums are accumulated in double */
+
+#if MDPREC == 1 || MDPREC == 3
 
 #ifndef CUDA_PROFILER_ENABLED
 #ifndef float3
@@ -106,7 +109,36 @@ typedef float4 MMD_floatK4 ;
 typedef float MMD_float;
 #define F(a) a.f
 
-#endif //MDPREC == 1
+#endif //MDPREC == 1 || MDPREC == 3
+
+/* accumulator types, ACC3 widens a kernel vector, FLT3 narrows it back */
+
+#if MDPREC == 1
+typedef float MMD_acc;
+#ifdef IAMONDEVICE
+typedef float3 MMD_accK3;
+typedef float2 MMD_accK2;
+#endif
+#define ACC3(a) (a)
+#define FLT3(a) (a)
+#elif MDPREC == 2
+typedef double MMD_acc;
+#ifdef IAMONDEVICE
+typedef double3 MMD_accK3;
+typedef double2 MMD_accK2;
+#endif
+#define ACC3(a) (a)
+#define FLT3(a) (a)
+#elif MDPREC == 3
+#ifdef IAMONDEVICE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double3 MMD_accK3;
+typedef double2 MMD_accK2;
+#endif
+typedef double MMD_acc;
+#define ACC3(a) convert_double3(a)
+#define FLT3(a) convert_float3(a)
+#endif
 
 #ifndef PRECMPI
 #define PRECMPI MPI_DOUBLE
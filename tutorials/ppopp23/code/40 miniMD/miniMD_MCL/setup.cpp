@@ -36,196 +36,228 @@
 #include "precision.h"
 #include "integrate.h"
 #include "neighbor.h"
+#include "comm.h"
+#include "threadpool.h"
 
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 
 double random(int*);
 
-#define NSECTIONS 3
 #define MAXLINE 255
 char line[MAXLINE];
-char keyword[MAXLINE];
-FILE* fp;
 
-void read_lammps_parse_keyword(int first)
-{
-  int eof = 0;
-  char buffer[MAXLINE];
-
-  // proc 0 reads upto non-blank line plus 1 following line
-  // eof is set to 1 if any read hits end-of-file
+/* LAMMPS data file reader
+   the file is mapped, header and section keywords are read serially,
+   the Atoms and Velocities sections are cut into one piece per thread on
+   line boundaries and parsed in parallel into arrays indexed by atom id,
+   then every thread counts its slice of ids per owning partition and,
+   after a prefix sum, scatters them straight into the atom arrays, so
+   each partition holds its atoms in id order; returns 1 on error */
 
-  if(!first) {
-    if(fgets(line, MAXLINE, fp) == NULL) eof = 1;
-  }
-
-  while(eof == 0 && strspn(line, " \t\n\r") == strlen(line)) {
-    if(fgets(line, MAXLINE, fp) == NULL) eof = 1;
-  }
+static const double pow10_exact[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
 
-  if(fgets(buffer, MAXLINE, fp) == NULL) eof = 1;
+static const char* next_line(const char* p, const char* end)
+{
+  const char* nl = (const char*) memchr(p, '\n', end - p);
+  return nl ? nl + 1 : end;
+}
 
-  // if eof, set keyword empty and return
+/* nothing but whitespace up to the end of the line or a comment */
 
-  if(eof) {
-    keyword[0] = '\0';
-    return;
+static int blank_line(const char* p, const char* end)
+{
+  for (; p < end && *p != '\n'; p++) {
+    if (*p == '#') return 1;
+    if (*p != ' ' && *p != '\t' && *p != '\r') return 0;
   }
+  return 1;
+}
 
-  // bcast keyword line to all procs
-
-
-  // copy non-whitespace portion of line into keyword
-
-  int start = strspn(line, " \t\n\r");
-  int stop = strlen(line) - 1;
-
-  while(line[stop] == ' ' || line[stop] == '\t'
-        || line[stop] == '\n' || line[stop] == '\r') stop--;
+/* copy a line into the global line buffer, comment cut off, 0-terminated */
 
-  line[stop + 1] = '\0';
-  strcpy(keyword, &line[start]);
+static void copy_line(const char* p, const char* end)
+{
+  int n = 0;
+  while (p < end && *p != '\n' && *p != '#' && n < MAXLINE - 1) line[n++] = *p++;
+  line[n] = '\0';
 }
 
-void read_lammps_header(Atom& atom)
+static const char* parse_int(const char* p, const char* end, long &value)
 {
-  int n;
-  char* ptr;
-
-  // customize for new sections
-
-  const char* section_keywords[NSECTIONS] =
-  {"Atoms", "Velocities", "Masses"};
-
-  // skip 1st line of file
-
-  char* eof = fgets(line, MAXLINE, fp);
-
-  // customize for new header lines
-  int ntypes = 0;
-
-  while(1) {
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+  int neg = 0;
+  if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+  value = 0;
+  while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+  if (neg) value = -value;
+  return p;
+}
 
-    if(fgets(line, MAXLINE, fp) == NULL) n = 0;
-    else n = strlen(line) + 1;
+/* decimal number, up to 19 significant digits are collected into an
+   integer; exactly rounded with a single multiply or divide when that
+   fits 53 bits and the power of ten is exact (|exponent| <= 22), which
+   covers the fixed width columns LAMMPS writes, strtod otherwise */
 
-    if(n == 0) {
-      line[0] = '\0';
-      return;
+static const char* parse_double(const char* p, const char* end, double &value)
+{
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+  const char* start = p;
+  int neg = 0;
+  if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+  unsigned long long m = 0;
+  int digits = 0, exp10 = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    if (digits < 19) {
+      m = m * 10 + (*p - '0');
+      if (m) digits++;
+    } else exp10++;
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+      if (digits < 19) {
+        m = m * 10 + (*p - '0');
+        if (m) digits++;
+        exp10--;
+      }
+    }
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    int eneg = 0, e = 0;
+    if (q < end && (*q == '-' || *q == '+')) eneg = *q++ == '-';
+    if (q < end && *q >= '0' && *q <= '9') {
+      for (; q < end && *q >= '0' && *q <= '9'; q++)
+        if (e < 10000) e = e * 10 + (*q - '0');
+      exp10 += eneg ? -e : e;
+      p = q;
     }
-
-    // trim anything from '#' onward
-    // if line is blank, continue
-
-    double xlo, xhi, ylo, yhi, zlo, zhi;
-
-    if(ptr = strchr(line, '#')) * ptr = '\0';
-
-    if(strspn(line, " \t\n\r") == strlen(line)) continue;
-
-    // search line for header keyword and set corresponding variable
-
-    if(strstr(line, "atoms")) sscanf(line, "%i", &atom.natoms);
-    else if(strstr(line, "atom types")) sscanf(line, "%i", &ntypes);
-
-    // check for these first
-    // otherwise "triangles" will be matched as "angles"
-
-    else if(strstr(line, "xlo xhi")) {
-      sscanf(line, "%lg %lg", &xlo, &xhi);
-      atom.box.xprd = xhi - xlo;
-    } else if(strstr(line, "ylo yhi")) {
-      sscanf(line, "%lg %lg", &ylo, &yhi);
-      atom.box.yprd = yhi - ylo;
-    } else if(strstr(line, "zlo zhi")) {
-      sscanf(line, "%lg %lg", &zlo, &zhi);
-      atom.box.zprd = zhi - zlo;
-    } else break;
   }
 
-  // error check on total system size
-
-
-  // check that exiting string is a valid section keyword
-
-  read_lammps_parse_keyword(1);
-
-  for(n = 0; n < NSECTIONS; n++)
-    if(strcmp(keyword, section_keywords[n]) == 0) break;
-
-  if(n == NSECTIONS) {
-    char str[36 + 255 + 1];
-    sprintf(str, "Unknown identifier in data file: %s", keyword);
+  if (m < (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+    value = exp10 < 0 ? m / pow10_exact[-exp10] : m * pow10_exact[exp10];
+    if (neg) value = -value;
+    return p;
   }
 
-  // error check on consistency of header values
+  /* the mapping is not 0-terminated */
+  char token[64];
+  int n = MIN((int) (p - start), 63);
+  memcpy(token, start, n);
+  token[n] = '\0';
+  value = strtod(token, NULL);
+  return p;
 }
 
-void read_lammps_atoms(Atom &atom, MMD_float3* x)
-{
-  int i;
+/* "id type x y z [ix iy iz]" (vel 0) or "id vx vy vz" (vel 1) lines of
+   [lo,hi) into out[id-1], returns the # of lines read, bad counts the
+   lines with an id outside 1..natoms or one claimed before in seen */
 
-  int nread = 0;
-  int natoms = atom.natoms;
-  atom.nlocal = 0;
-
-  int type;
-  double xx, xy, xz;
-
-  while(nread < natoms) {
-    fgets(line, MAXLINE, fp);
-    sscanf(line, "%i %i %lg %lg %lg", &i, &type, &xx, &xy, &xz);
-    i--;
-    x[i].x = xx;
-    x[i].y = xy;
-    x[i].z = xz;
-    nread++;
+static int parse_lines(const char* lo, const char* hi, int vel, int natoms, MMD_float3* out, char* seen, int &bad)
+{
+  int n = 0;
+  for (const char* p = lo; p < hi; p = next_line(p, hi)) {
+    if (blank_line(p, hi)) continue;
+    long id, type;
+    double c[3];
+    p = parse_int(p, hi, id);
+    if (!vel) p = parse_int(p, hi, type);
+    for (int k = 0; k < 3; k++) p = parse_double(p, hi, c[k]);
+    if (id < 1 || id > natoms || __atomic_exchange_n(&seen[id - 1], 1, __ATOMIC_RELAXED)) {
+      bad++;
+      continue;
+    }
+    out[id - 1].x = c[0];
+    out[id - 1].y = c[1];
+    out[id - 1].z = c[2];
+    n++;
   }
-
+  return n;
 }
 
-void read_lammps_velocities(Atom &atom, MMD_float3* v)
-{
-  int i;
-
-  int nread = 0;
-  int natoms = atom.natoms;
-
-  double x, y, z;
+/* parse a section body on all threads, piece boundaries are moved to the
+   next line start, returns the # of lines read or -1 on bad or duplicate ids,
+   so natoms means every id 1..natoms was read exactly once */
 
-  while(nread < natoms) {
-    fgets(line, MAXLINE, fp);
-    sscanf(line, "%i %lg %lg %lg", &i, &x, &y, &z);
-    i--;
-    v[i].x = x;
-    v[i].y = y;
-    v[i].z = z;
-    nread++;
+static int parse_section(ThreadPool &pool, const char* lo, const char* hi, int vel, int natoms, MMD_float3* out)
+{
+  std::vector<int> nread(pool.nthreads, 0), bad(pool.nthreads, 0);
+  std::vector<char> seen(natoms, 0);
+  size_t size = hi - lo;
+  pool.run([&](int tid) {
+    const char* a = lo + size * tid / pool.nthreads;
+    const char* b = lo + size * (tid + 1) / pool.nthreads;
+    if (a > lo && a[-1] != '\n') a = next_line(a, hi);
+    if (b > lo && b < hi && b[-1] != '\n') b = next_line(b, hi);
+    if (a < b) nread[tid] = parse_lines(a, b, vel, natoms, out, &seen[0], bad[tid]);
+  });
+  int n = 0;
+  for (int t = 0; t < pool.nthreads; t++) {
+    if (bad[t]) return -1;
+    n += nread[t];
   }
-
-  // check that all atoms were assigned correctly
-
+  return n;
 }
 
-int read_lammps_data(MCLWrapper* mcl, Atom* atom, Comm &comm, Neighbor* neighbor, Integrate &integrate, Thermo &thermo, char* file, int units, int nparts)
+int read_lammps_data(Atom* atom, Comm &comm, Neighbor* neighbor, char* file, int nparts)
 {
-  fp = fopen(file, "r");
-
-  if(fp == NULL) {
-    char str[128];
-    sprintf(str, "Cannot open file %s", file);
+  int fd = open(file, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    printf("ERROR: Cannot open data file %s\n", file);
+    if(fd >= 0) close(fd);
+    return 1;
+  }
+  size_t size = st.st_size;
+  const char* base = (const char*) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED) {
+    printf("ERROR: Cannot map data file %s\n", file);
+    return 1;
+  }
+  madvise((void*) base, size, MADV_WILLNEED);
+  const char* end = base + size;
+
+  /* header, the 1st line is a comment, the first other line ends it */
+
+  double lo[3] = {0.0, 0.0, 0.0};
+  double hi[3] = {0.0, 0.0, 0.0};
+  int natoms = 0;
+  const char* p = next_line(base, end);
+  for(; p < end; p = next_line(p, end)) {
+    if(blank_line(p, end)) continue;
+    copy_line(p, end);
+    if(strstr(line, "atoms")) sscanf(line, "%i", &natoms);
+    else if(strstr(line, "atom types")) continue;
+    else if(strstr(line, "xlo xhi")) sscanf(line, "%lg %lg", &lo[0], &hi[0]);
+    else if(strstr(line, "ylo yhi")) sscanf(line, "%lg %lg", &lo[1], &hi[1]);
+    else if(strstr(line, "zlo zhi")) sscanf(line, "%lg %lg", &lo[2], &hi[2]);
+    else break;
+  }
+  if(natoms <= 0) {
+    printf("ERROR: No atoms in data file %s\n", file);
+    munmap((void*) base, size);
+    return 1;
   }
 
-  read_lammps_header(atom[0]);
   for(int j = 0; j < nparts; j++){
-    atom[j].box.xprd = atom[0].box.xprd;
-    atom[j].box.yprd = atom[0].box.zprd;
-    atom[j].box.zprd = atom[0].box.yprd;
-    atom[j].natoms = atom[0].natoms;
+    atom[j].box.xprd = hi[0] - lo[0];
+    atom[j].box.yprd = hi[1] - lo[1];
+    atom[j].box.zprd = hi[2] - lo[2];
+    atom[j].natoms = natoms;
   }
 
   comm.setup(neighbor[0].cutneigh, atom, nparts);
@@ -248,50 +280,100 @@ int read_lammps_data(MCLWrapper* mcl, Atom* atom, Comm &comm, Neighbor* neighbor
     neighbor[j].setup(atom[j]);
   }
 
-  integrate.setup(nparts);
-
-  //force->setup();
-
-  thermo.setup(mcl, atom[0].box.xprd * atom[0].box.yprd * atom[0].box.zprd / atom[0].natoms, integrate, atom[0], units, nparts);
-
-  MMD_float3* x = new MMD_float3[atom[0].natoms];
-  MMD_float3* v = new MMD_float3[atom[0].natoms];
+  /* sections, each keyword line is followed by a blank line and the body,
+     which runs up to the next blank line */
 
+  ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()), 0);
+  std::vector<MMD_float3> x(natoms), v(natoms);
+  memset(&v[0], 0, natoms * sizeof(MMD_float3));
   int atomflag = 0;
-  int tmp;
+  int error = 0;
+
+  while(p < end && !error) {
+    if(blank_line(p, end)) {
+      p = next_line(p, end);
+      continue;
+    }
+    char keyword[MAXLINE];
+    copy_line(p, end);
+    sscanf(line, "%254s", keyword);
+    for(p = next_line(p, end); p < end && blank_line(p, end); p = next_line(p, end));
+    const char* body = p;
+    for(; p < end && !blank_line(p, end); p = next_line(p, end));
 
-  while(strlen(keyword)) {
     if(strcmp(keyword, "Atoms") == 0) {
-      read_lammps_atoms(atom[0], x);
+      if(parse_section(pool, body, p, 0, natoms, &x[0]) != natoms) {
+        printf("ERROR: Atoms section of %s does not hold atoms 1 to %i once each\n", file, natoms);
+        error = 1;
+      }
       atomflag = 1;
     } else if(strcmp(keyword, "Velocities") == 0) {
       if(atomflag == 0) printf("Must read Atoms before Velocities\n");
-
-      read_lammps_velocities(atom[0], v);
+      if(parse_section(pool, body, p, 1, natoms, &v[0]) != natoms) {
+        printf("ERROR: Velocities section of %s does not hold atoms 1 to %i once each\n", file, natoms);
+        error = 1;
+      }
     } else if(strcmp(keyword, "Masses") == 0) {
-      fgets(line, MAXLINE, fp);
-      if(sizeof(MMD_float) == 4)
-        sscanf(line, "%i %g", &tmp, &atom[0].mass);
-      else
-        sscanf(line, "%i %g", &tmp, &atom[0].mass);
-
-      for(int j = 0; j < nparts; j++) atom[j].mass = atom[0].mass;
+      long type;
+      double mass;
+      parse_double(parse_int(body, p, type), p, mass);
+      for(int j = 0; j < nparts; j++) atom[j].mass = mass;
+    } else {
+      printf("ERROR: Unknown identifier in data file: %s\n", keyword);
+      error = 1;
     }
-
-    read_lammps_parse_keyword(0);
+  }
+  munmap((void*) base, size);
+  if(error || !atomflag) {
+    if(!atomflag && !error) printf("ERROR: No Atoms section in data file %s\n", file);
+    return 1;
   }
 
-  for(int i = 0; i < atom[0].natoms; i++) {
-    for(int j = 0; j < nparts; j++){
-      if(x[i].x >= atom[j].box.xlo && x[i].x < atom[j].box.xhi &&
-        x[i].y >= atom[j].box.ylo && x[i].y < atom[j].box.yhi &&
-        x[i].z >= atom[j].box.zlo && x[i].z < atom[j].box.zhi)
-          atom[j].addatom(x[i].x, x[i].y, x[i].z, v[i].x, v[i].y, v[i].z);
+  /* owners, per thread counts of every partition, their prefix sums are
+     where each thread writes its atoms */
+
+  int nthreads = pool.nthreads;
+  std::vector<int> owner(natoms);
+  std::vector<int> pos(nthreads * nparts, 0);
+  pool.run([&](int tid) {
+    int i0, i1;
+    pool.range(tid, 0, 1, natoms, i0, i1);
+    for(int i = i0; i < i1; i++) {
+      MMD_float c[3] = {x[i].x - (MMD_float) lo[0], x[i].y - (MMD_float) lo[1], x[i].z - (MMD_float) lo[2]};
+      for(int k = 0; k < 3; k++) {
+        if(c[k] < 0.0) c[k] += comm.prd[k];
+        if(c[k] >= comm.prd[k]) c[k] -= comm.prd[k];
+      }
+      x[i].x = c[0];
+      x[i].y = c[1];
+      x[i].z = c[2];
+      owner[i] = comm.owner(c[0], c[1], c[2]);
+      pos[tid * nparts + owner[i]]++;
     }
-    
+  });
+
+  for(int j = 0; j < nparts; j++){
+    int n = 0;
+    for(int t = 0; t < nthreads; t++) {
+      int count = pos[t * nparts + j];
+      pos[t * nparts + j] = n;
+      n += count;
+    }
+    if(atom[j].nmax == 0) atom[j].growarray();
+    while(atom[j].nmax < n) atom[j].growarray();
+    atom[j].nlocal = n;
   }
 
-  // check that all atoms were assigned correctly
+  pool.run([&](int tid) {
+    int i0, i1;
+    pool.range(tid, 0, 1, natoms, i0, i1);
+    for(int i = i0; i < i1; i++) {
+      int j = owner[i];
+      int k = pos[tid * nparts + j]++;
+      atom[j].x[k] = x[i];
+      atom[j].v[k] = v[i];
+    }
+  });
   return 0;
 }
 
@@ -1,13 +1,33 @@
 #include "precision.h"
+#include "kernel_params.h"
 
-__kernel void copy_atoms(__global MMD_floatK3* x, __global float* x_copy, int nlocal)
+/* positions of atoms [first, first+count) into one trajectory slot,
+   as floats, float16 or 16-bit offsets on the grid lo + q / scale */
+
+__kernel void traj_pack(__global MMD_floatK3* x, __global float* out, struct TrajParams p)
 {
   int i = get_global_id(0);
-  if(i<nlocal)
+  if(i >= p.count) return;
+
+  MMD_floatK3 xi = x[p.first + i];
+  if(p.mode == TRAJ_HALF)
   {
-    x_copy[(3*i)] = x[i].x;
-    x_copy[(3*i)+1] = x[i].y;
-    x_copy[(3*i)+2] = x[i].z;
+    __global half* h = (__global half*) out;
+    vstore_half((float) xi.x, 3*i, h);
+    vstore_half((float) xi.y, 3*i+1, h);
+    vstore_half((float) xi.z, 3*i+2, h);
   }
-
-}
\ No newline at end of file
+  else if(p.mode == TRAJ_FIXED16)
+  {
+    __global ushort* q = (__global ushort*) out;
+    q[3*i] = (ushort) clamp(rint((float) ((xi.x - p.lo.x) * p.scale.x)), 0.0f, 65535.0f);
+    q[3*i+1] = (ushort) clamp(rint((float) ((xi.y - p.lo.y) * p.scale.y)), 0.0f, 65535.0f);
+    q[3*i+2] = (ushort) clamp(rint((float) ((xi.z - p.lo.z) * p.scale.z)), 0.0f, 65535.0f);
+  }
+  else
+  {
+    out[3*i] = xi.x;
+    out[3*i+1] = xi.y;
+    out[3*i+2] = xi.z;
+  }
+}
@@ -0,0 +1,172 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#include "stdio.h"
+#include <cstring>
+#include "taskgraph.h"
+
+TaskGraph::TaskGraph()
+{
+  valid = 0;
+  nreplay = 0;
+}
+
+TaskGraph::~TaskGraph()
+{
+}
+
+/* start recording, inputs[i] is the handle later replays will pass in
+   the same slot, NULL entries are ignored */
+
+void TaskGraph::begin(int ninputs, mcl_handle** inputs)
+{
+  clear();
+  for(int i = 0; i < ninputs; i++)
+    if(inputs[i]) input_of[inputs[i]] = i;
+}
+
+void TaskGraph::record(mcl_handle* hdl, int kernel, uint64_t props, int threads,
+                       int nwait, mcl_handle** waitlist, int nargs, void** addr, unsigned int* size, uint64_t* flags)
+{
+  TaskNode node;
+  node.kernel = kernel;
+  node.props = props;
+  node.threads = threads;
+
+  /* scalars may live on the caller's stack, keep a copy */
+
+  node.firstarg = arg_addr.size();
+  node.nargs = nargs;
+  for(int i = 0; i < nargs; i++) {
+    arg_addr.push_back(addr[i]);
+    arg_size.push_back(size[i]);
+    arg_flags.push_back(flags[i]);
+    if(flags[i] & MCL_ARG_SCALAR) {
+      arg_scalar.push_back(scalars.size());
+      scalars.insert(scalars.end(), (char*) addr[i], (char*) addr[i] + size[i]);
+    } else
+      arg_scalar.push_back(-1);
+  }
+
+  /* anything not produced inside the graph or passed as input was
+     already complete when the graph was captured and is dropped */
+
+  node.firstdep = deps.size();
+  for(int i = 0; i < nwait; i++) {
+    std::map<mcl_handle*,int>::iterator it = node_of.find(waitlist[i]);
+    if(it != node_of.end()) {
+      deps.push_back(it->second);
+      continue;
+    }
+    it = input_of.find(waitlist[i]);
+    if(it != input_of.end()) deps.push_back(-1 - it->second);
+  }
+  node.ndeps = deps.size() - node.firstdep;
+
+  node_of[hdl] = nodes.size();
+  nodes.push_back(node);
+}
+
+/* outputs[i] is returned in the same slot by every replay */
+
+void TaskGraph::end(int noutputs, mcl_handle** hdls)
+{
+  outputs.resize(noutputs);
+  valid = 1;
+  for(int i = 0; i < noutputs; i++) {
+    std::map<mcl_handle*,int>::iterator it = node_of.find(hdls[i]);
+    if(it == node_of.end()) {
+      printf("ERROR: task graph output %i was not captured\n", i);
+      valid = 0;
+      outputs[i] = -1;
+    } else outputs[i] = it->second;
+  }
+  node_of.clear();
+  input_of.clear();
+}
+
+/* resubmit every node in capture order, so dependencies always point
+   backwards; inputs and outputs may alias */
+
+void TaskGraph::replay(MCLWrapper* mcl, mcl_handle** inputs, mcl_handle** out)
+{
+  int nnodes = nodes.size();
+  replay_hdls.resize(nnodes);
+
+  std::vector<mcl_handle*> waitlist;
+  std::vector<void*> addr(arg_addr);
+  for(size_t i = 0; i < addr.size(); i++)
+    if(arg_scalar[i] >= 0) addr[i] = &scalars[arg_scalar[i]];
+
+  for(int n = 0; n < nnodes; n++) {
+    TaskNode &node = nodes[n];
+
+    waitlist.clear();
+    for(int d = node.firstdep; d < node.firstdep + node.ndeps; d++) {
+      if(deps[d] >= 0) waitlist.push_back(replay_hdls[deps[d]]);
+      else if(inputs[-1 - deps[d]]) waitlist.push_back(inputs[-1 - deps[d]]);
+    }
+
+    replay_hdls[n] = mcl->Launch(node.kernel, node.props, node.threads,
+                                 waitlist.size(), waitlist.size() ? &waitlist[0] : NULL,
+                                 node.nargs, &addr[node.firstarg], &arg_size[node.firstarg], &arg_flags[node.firstarg]);
+    issued.push_back(replay_hdls[n]);
+  }
+
+  for(size_t i = 0; i < outputs.size(); i++)
+    out[i] = replay_hdls[outputs[i]];
+  nreplay++;
+}
+
+/* only call once every replayed task has completed */
+
+void TaskGraph::release()
+{
+  for(size_t i = 0; i < issued.size(); i++)
+    mcl_hdl_free(issued[i]);
+  issued.clear();
+}
+
+void TaskGraph::clear()
+{
+  nodes.clear();
+  arg_addr.clear();
+  arg_size.clear();
+  arg_flags.clear();
+  arg_scalar.clear();
+  scalars.clear();
+  deps.clear();
+  outputs.clear();
+  node_of.clear();
+  input_of.clear();
+  valid = 0;
+  nreplay = 0;
+}
@@ -0,0 +1,87 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include <vector>
+#include <map>
+#include "mcl_wrapper.h"
+
+/* a recorded DAG of kernel launches that can be resubmitted without
+   redoing the host side work that built it
+
+   dependencies are stored as node indices (>= 0) or as graph inputs
+   (-1-slot), inputs are handles supplied by the caller on every replay
+   (e.g. the last task of each partition in the previous timestep) */
+
+struct TaskNode {
+  int kernel;                      // id in the MCLWrapper kernel registry
+  uint64_t props;
+  int threads;
+  int firstarg,nargs;              // range in TaskGraph::arg_*
+  int firstdep,ndeps;              // range in TaskGraph::deps
+};
+
+class TaskGraph {
+ public:
+  TaskGraph();
+  ~TaskGraph();
+
+  void begin(int, mcl_handle**);   // start capture with graph inputs
+  void record(mcl_handle*, int, uint64_t, int, int, mcl_handle**,
+              int, void**, unsigned int*, uint64_t*);
+  void end(int, mcl_handle**);     // finish capture with graph outputs
+  void replay(MCLWrapper*, mcl_handle**, mcl_handle**);
+  void release();                  // free handles created by replays
+  void clear();                    // drop the recorded graph
+
+  int valid;                       // 1 if a complete graph was captured
+  int nreplay;                     // # of replays since last capture
+
+ private:
+  std::vector<TaskNode> nodes;
+  std::vector<void*> arg_addr;
+  std::vector<unsigned int> arg_size;
+  std::vector<uint64_t> arg_flags;
+  std::vector<int> arg_scalar;     // offset into scalars or -1 for buffers
+  std::vector<char> scalars;       // private copy of all scalar arguments
+  std::vector<int> deps;
+  std::vector<int> outputs;        // node index of each graph output
+
+  std::map<mcl_handle*,int> node_of;     // only valid during capture
+  std::map<mcl_handle*,int> input_of;    // only valid during capture
+
+  std::vector<mcl_handle*> replay_hdls;  // handles of the current replay
+  std::vector<mcl_handle*> issued;       // all handles created by replays
+};
+
+#endif
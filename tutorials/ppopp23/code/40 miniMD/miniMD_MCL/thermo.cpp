@@ -34,15 +34,48 @@
 #include "stdlib.h"
 #include "integrate.h"
 #include "thermo.h"
+#include "force_eam.h"
 
-Thermo::Thermo() {}
-Thermo::~Thermo() {}
+#define BUFFACTOR 1.5
+
+Thermo::Thermo()
+{
+  cur = 0;
+  d_ev = NULL;
+  d_tsum = NULL;
+  maxev = NULL;
+  tallied = NULL;
+  for (int k = 0; k < 2; k++) {
+    slot[k].pending = 0;
+    slot[k].sums = NULL;
+    slot[k].hdls = NULL;
+  }
+}
+
+Thermo::~Thermo()
+{
+  for (int k = 0; k < 2; k++) {
+    delete[] slot[k].sums;
+    delete[] slot[k].hdls;
+  }
+  if (d_ev) {
+    for (int i = 0; i < partitions; i++) {
+      delete d_ev[i];
+      delete d_tsum[i];
+    }
+  }
+  delete[] d_ev;
+  delete[] d_tsum;
+  delete[] maxev;
+  delete[] tallied;
+}
 
 void Thermo::setup(MCLWrapper* w, MMD_float rho_in, Integrate &integrate, Atom &atom,int units,int nparts)
 {
   mcl = w;
   rho = rho_in;
   ntimes = integrate.ntimes;
+  first = integrate.first;
   partitions = nparts;
 
   int maxstat;
@@ -53,16 +86,32 @@ void Thermo::setup(MCLWrapper* w, MMD_float rho_in, Integrate &integrate, Atom &
   engarr = (MMD_float *) malloc(maxstat*sizeof(MMD_float));
   prsarr = (MMD_float *) malloc(maxstat*sizeof(MMD_float));
 
+  natoms = atom.natoms;
+  for (int k = 0; k < 2; k++) {
+    slot[k].sums = new MMD_acc[3 * nparts];
+    slot[k].hdls = new mcl_handle*[nparts];
+  }
+  d_ev = new cMCLData<MMD_acc, xx>*[nparts];
+  d_tsum = new cMCLData<MMD_acc, xx>*[nparts];
+  maxev = new int[nparts];
+  tallied = new int[nparts];
+  for (int i = 0; i < nparts; i++) {
+    d_ev[i] = NULL;
+    maxev[i] = 0;
+    tallied[i] = 0;
+    d_tsum[i] = new cMCLData<MMD_acc, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, 64, 0, 0);
+  }
+
   if(units == LJ) {
     mvv2e = 1.0;
     dof_boltz = (atom.natoms * 3 - 3);
-    t_scale = mvv2e / dof_boltz;
+    t_scale = mvv2e * atom.mass / dof_boltz;
     p_scale = 1.0 / 3 / atom.box.xprd / atom.box.yprd / atom.box.zprd;
     e_scale = 0.5;
   } else if(units == METAL) {
     mvv2e = 1.036427e-04;
     dof_boltz = (atom.natoms * 3 - 3) * 8.617343e-05;
-    t_scale = mvv2e / dof_boltz;
+    t_scale = mvv2e * atom.mass / dof_boltz;
     p_scale = 1.602176e+06 / 3 / atom.box.xprd / atom.box.yprd / atom.box.zprd;
     e_scale = 524287.985533;//16.0;
     integrate.dtforce /= mvv2e;
@@ -73,82 +122,187 @@ void Thermo::setup(MCLWrapper* w, MMD_float rho_in, Integrate &integrate, Atom &
 
 void Thermo::compute(int iflag, Atom atom[], Neighbor neighbor[], Force &force, Timer &timer, Comm &comm)
 {
-  if (iflag > 0 && iflag % nstat) return;
+  if (!force.pool) {
+    launch(iflag, atom, neighbor, force, timer, NULL);
+    flush();
+    return;
+  }
+  if (iflag > 0 && (nstat == 0 || iflag % nstat)) return;
   if (iflag == -1 && nstat > 0 && ntimes % nstat == 0) return;
 
   t_act=0;
   e_act=0;
   p_act=0;
 
-  MMD_float2** sums = new MMD_float2*[partitions];
-  mcl_handle** hdls = new mcl_handle*[partitions];
   MMD_float2 ev = {0.0f, 0.0f};
+  MMD_acc t = 0.0f;
+  sums_native(atom, neighbor, force, ev, t);
+
+  double oldtime=timer.array[TIME_TOTAL];
+  timer.stop(TIME_TOTAL);
+  double time = timer.array[TIME_TOTAL];
+  timer.array[TIME_TOTAL]=oldtime;
+
+  output(iflag == -1 ? ntimes : iflag, ev.x, ev.y, t, time);
+}
+
+/* enqueue the thermo reductions of step iflag after the tasks in after
+   (one per partition, or NULL) and return the handles the next step has
+   to wait on, NULL if iflag is not a thermo step. Nothing blocks here:
+   the slot launched before is printed first, its tasks finished while
+   the interval in between ran, the new slot is read back asynchronously */
+
+mcl_handle** Thermo::launch(int iflag, Atom atom[], Neighbor neighbor[], Force &force, Timer &timer, mcl_handle** after)
+{
+  if (iflag > 0 && (nstat == 0 || iflag % nstat)) return NULL;
+  if (iflag == -1 && nstat > 0 && ntimes % nstat == 0) return NULL;
+
+  if (slot[cur ^ 1].pending) collect(slot[cur ^ 1]);
+  if (slot[cur].pending) collect(slot[cur]);
+  ThermoSlot &s = slot[cur];
+  cur ^= 1;
+
+  double oldtime=timer.array[TIME_TOTAL];
+  timer.stop(TIME_TOTAL);
+  s.time = timer.array[TIME_TOTAL];
+  timer.array[TIME_TOTAL]=oldtime;
+  s.step = iflag == -1 ? ntimes : iflag;
+  s.pending = 1;
+
+  int ntemp = 64;                 // blocks of the temperature kernel, size of d_tsum
   for(int i = 0; i < partitions; i++){
-    int nblocks = (atom[i].nlocal + mcl->blockdim - 1)/mcl->blockdim;
-    sums[i] = new MMD_float2[nblocks];
-    hdls[i] = mcl->LaunchKernel("thermo_kernel.h", "energy_virial", atom[i].nlocal, 0, NULL, 8,
-      atom[i].d_x->devData(), atom[i].d_x->devSize(), atom[i].d_x->mclFlags(),
-      neighbor[i].d_numneigh->devData(), neighbor[i].d_numneigh->devSize(), neighbor[i].d_numneigh->mclFlags(),
-      neighbor[i].d_neighbors->devData(), neighbor[i].d_neighbors->devSize(), neighbor[i].d_neighbors->mclFlags(),
-      sums[i], nblocks * sizeof(MMD_float2), MCL_ARG_BUFFER | MCL_ARG_OUTPUT,
-      NULL, mcl->blockdim * sizeof(MMD_float2), MCL_ARG_BUFFER | MCL_ARG_LOCAL,
-      &force.cutforcesq, sizeof(force.cutforcesq), MCL_ARG_SCALAR,
-      &neighbor[i].maxneighs, sizeof(neighbor[i].maxneighs), MCL_ARG_SCALAR,
-      &atom[i].nlocal, sizeof(atom->nlocal), MCL_ARG_SCALAR
-    );
-  }
-  mcl_wait_all();
-  for(int i = 0; i < partitions; i++){
-    mcl_hdl_free(hdls[i]);
-    int nblocks = (atom[i].nlocal + mcl->blockdim - 1)/mcl->blockdim;
-    for(int j = 0; j < nblocks; j++){
-      ev.x += sums[i][j].x;
-      ev.y += sums[i][j].y;
+    int nwait = after ? 1 : 0;
+    mcl_handle** waitlist = after ? &after[i] : NULL;
+    mcl_handle* hdl[2];
+    int nev;
+
+    if(tallied[i]) {
+      /* the force pass of this step already left its partials in d_ev */
+      nev = tallied[i];
+      tallied[i] = 0;
+      hdl[0] = NULL;
+    } else if(force.eam) {
+      /* embedding and pair energy, energy_virial only knows the pair style */
+      nev = (atom[i].nlocal + mcl->blockdim - 1)/mcl->blockdim;
+      if(nev > maxev[i]) growev(i, nev);
+      hdl[0] = force.eam->energy(atom[i], neighbor[i], i, d_ev[i], nwait, waitlist);
+    } else if(neighbor[i].cluster) {
+      /* the cluster path builds no per-atom lists */
+      ClusterParams p;
+      neighbor[i].cluster_params(p, atom[i]);
+      p.cutforcesq = force.cutforcesq;
+      nev = (p.nclusters + mcl->blockdim - 1)/mcl->blockdim;
+      if(nev > maxev[i]) growev(i, nev);
+      hdl[0] = mcl->LaunchKernel("cluster_kernel.h", "energy_cluster", p.nclusters, nwait, waitlist, 8,
+        atom[i].d_x->devData(), atom[i].d_x->devSize(), atom[i].d_x->mclFlags(),
+        neighbor[i].d_bincount->devData(), neighbor[i].d_bincount->devSize(), neighbor[i].d_bincount->mclFlags(),
+        neighbor[i].d_bins->devData(), neighbor[i].d_bins->devSize(), neighbor[i].d_bins->mclFlags(),
+        neighbor[i].d_ncpairs->devData(), neighbor[i].d_ncpairs->devSize(), neighbor[i].d_ncpairs->mclFlags(),
+        neighbor[i].d_cpairs->devData(), neighbor[i].d_cpairs->devSize(), neighbor[i].d_cpairs->mclFlags(),
+        d_ev[i]->devData(), d_ev[i]->devSize(), d_ev[i]->mclFlags(),
+        NULL, mcl->blockdim * 2 * sizeof(MMD_acc), MCL_ARG_BUFFER | MCL_ARG_LOCAL,
+        &p, sizeof(p), MCL_ARG_SCALAR);
+    } else {
+      nev = (atom[i].nlocal + mcl->blockdim - 1)/mcl->blockdim;
+      if(nev > maxev[i]) growev(i, nev);
+      hdl[0] = mcl->LaunchKernel("thermo_kernel.h", "energy_virial", atom[i].nlocal, nwait, waitlist, 12,
+        atom[i].d_x->devData(), atom[i].d_x->devSize(), atom[i].d_x->mclFlags(),
+        neighbor[i].d_numneigh->devData(), neighbor[i].d_numneigh->devSize(), neighbor[i].d_numneigh->mclFlags(),
+        neighbor[i].d_neighbors->devData(), neighbor[i].d_neighbors->devSize(), neighbor[i].d_neighbors->mclFlags(),
+        d_ev[i]->devData(), d_ev[i]->devSize(), d_ev[i]->mclFlags(),
+        NULL, mcl->blockdim * 2 * sizeof(MMD_acc), MCL_ARG_BUFFER | MCL_ARG_LOCAL,
+        force.d_ptab->devData(), force.d_ptab->devSize(), force.d_ptab->mclFlags(),
+        &force.cutforcesq, sizeof(force.cutforcesq), MCL_ARG_SCALAR,
+        &neighbor[i].maxneighs, sizeof(neighbor[i].maxneighs), MCL_ARG_SCALAR,
+        &atom[i].nlocal, sizeof(atom->nlocal), MCL_ARG_SCALAR,
+        &neighbor[i].halfneigh, sizeof(neighbor[i].halfneigh), MCL_ARG_SCALAR,
+        &neighbor[i].ghost_newton, sizeof(neighbor[i].ghost_newton), MCL_ARG_SCALAR,
+        &neighbor[i].compress, sizeof(neighbor[i].compress), MCL_ARG_SCALAR
+      );
     }
-    delete[] sums[i];
-  }
-  ev.x  = ev.x/atom[0].natoms;
-  delete[] sums;
 
-  MMD_float** temp_sums = new MMD_float*[partitions];
-  MMD_float t = 0.0f;
-  int nblocks = 64;
-  int threads = nblocks * mcl->blockdim;
-  for(int i = 0; i < partitions; i++){
-    temp_sums[i] = new MMD_float[nblocks];
-    hdls[i] = mcl->LaunchKernel("thermo_kernel.h", "temperature", threads, 0, NULL, 4, 
+    hdl[1] = mcl->LaunchKernel("thermo_kernel.h", "temperature", ntemp * mcl->blockdim, nwait, waitlist, 4,
       atom[i].d_v->devData(), atom[i].d_v->devSize(), MCL_ARG_BUFFER | MCL_ARG_INPUT | MCL_ARG_RDONLY,
-      temp_sums[i], nblocks * sizeof(MMD_float), MCL_ARG_BUFFER | MCL_ARG_OUTPUT,
-      NULL, mcl->blockdim * sizeof(MMD_float3), MCL_ARG_BUFFER | MCL_ARG_LOCAL,
+      d_tsum[i]->devData(), d_tsum[i]->devSize(), d_tsum[i]->mclFlags(),
+      NULL, mcl->blockdim * 4 * sizeof(MMD_acc), MCL_ARG_BUFFER | MCL_ARG_LOCAL,
       &atom[i].nlocal, sizeof(atom[i].nlocal), MCL_ARG_SCALAR);
+
+    int nhdl = hdl[0] ? 2 : 1;
+    s.hdls[i] = mcl->LaunchKernel("thermo_kernel.h", "thermo_reduce", mcl->blockdim, nhdl, &hdl[2 - nhdl], 6,
+      d_ev[i]->devData(), d_ev[i]->devSize(), d_ev[i]->mclFlags(),
+      d_tsum[i]->devData(), d_tsum[i]->devSize(), d_tsum[i]->mclFlags(),
+      &s.sums[3*i], 3 * sizeof(MMD_acc), MCL_ARG_BUFFER | MCL_ARG_OUTPUT,
+      NULL, mcl->blockdim * 4 * sizeof(MMD_acc), MCL_ARG_BUFFER | MCL_ARG_LOCAL,
+      &nev, sizeof(nev), MCL_ARG_SCALAR,
+      &ntemp, sizeof(ntemp), MCL_ARG_SCALAR);
+    if(hdl[0]) mcl->Retire(hdl[0]);
+    mcl->Retire(hdl[1]);
   }
-  mcl_wait_all();
+  return s.hdls;
+}
 
-  t = 0.0f;
-  for(int i = 0; i < partitions; i++){
-    mcl_hdl_free(hdls[i]);
-    for(int j = 0; j < nblocks; j++){
-      //fprintf(stderr, "%f ", temp_sums[i][j]);
-      t += temp_sums[i][j];
-    }
-    //fprintf(stderr, "\nCumulative t: %f\n", t);
-    delete[] temp_sums[i];
+/* partials buffer for a force pass that tallies energy and virial of
+   the next thermo step over n atoms (Force::compute with ev), launch()
+   then only reduces it; growing has to wait for the slots in flight */
+
+cMCLData<MMD_acc, xx>* Thermo::tally(int partition, int n)
+{
+  int nev = (n + mcl->blockdim - 1)/mcl->blockdim;
+  if(nev > maxev[partition]) {
+    flush();
+    growev(partition, nev);
   }
-  delete[] temp_sums;
+  tallied[partition] = nev;
+  return d_ev[partition];
+}
 
-  t *= t_scale;
+/* print every slot still in flight, oldest first */
 
-  //t = temperature(atom, partitions);
+void Thermo::flush()
+{
+  if (slot[cur].pending) collect(slot[cur]);
+  if (slot[cur ^ 1].pending) collect(slot[cur ^ 1]);
+}
 
-  MMD_float eng = 0.5*ev.x;
-  MMD_float p = (t * dof_boltz + 0.5*ev.y) * p_scale;
+/* wait for the reductions of a slot (normally long done) and print it,
+   the handles may still be in the waitlists of later tasks */
 
-  int istep = iflag;
-  if (iflag == -1) istep = ntimes;
+void Thermo::collect(ThermoSlot &s)
+{
+  MMD_acc e = 0, w = 0, t = 0;
+  for(int i = 0; i < partitions; i++){
+    mcl_wait(s.hdls[i]);
+    mcl->Retire(s.hdls[i]);
+    e += s.sums[3*i];
+    w += s.sums[3*i+1];
+    t += s.sums[3*i+2];
+  }
+  s.pending = 0;
+  output(s.step, e, w, t, s.time);
+}
 
-  if (iflag == 0) mstat = 0;
+/* realloc the energy/virial partials of a partition with BUFFACTOR,
+   only while no thermo task is in flight */
 
-  
+void Thermo::growev(int partition, int n)
+{
+  maxev[partition] = static_cast<int>(BUFFACTOR * n);
+  if (d_ev[partition]) {
+    mcl_unregister_buffer(d_ev[partition]->devData());
+    delete d_ev[partition];
+  }
+  d_ev[partition] = new cMCLData<MMD_acc, xx>(mcl, MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_DYNAMIC, 2 * maxev[partition], 0, 0);
+}
+
+/* e, w: sums of pair energy and virial, t: sum of v^2 over all atoms */
+
+void Thermo::output(int istep, MMD_acc e, MMD_acc w, MMD_acc vv, double time)
+{
+  MMD_float t = vv * t_scale;
+  MMD_float eng = 0.5*e/natoms;
+  MMD_float p = (t * dof_boltz + 0.5*w) * p_scale;
+
+  if (istep == first) mstat = 0;
 
   steparr[mstat] = istep;
   tmparr[mstat] = t;
@@ -157,18 +311,11 @@ void Thermo::compute(int iflag, Atom atom[], Neighbor neighbor[], Force &force,
 
   mstat++;
 
-  double oldtime=timer.array[TIME_TOTAL];
-  timer.stop(TIME_TOTAL);
   fprintf(stdout, "%d ", istep);
   fprintf(stdout, "%e ", t);
   fprintf(stdout, "%e ", eng);
   fprintf(stdout, "%e ", p);
-  fprintf(stdout, "%6.3lf\n", istep==0?0.0:timer.array[TIME_TOTAL]);
-
-  // fprintf(stdout,"%i %e %e %e %6.3lf\n",istep,t,eng,p,istep==0?0.0:timer.array[TIME_TOTAL]);
-
-  timer.array[TIME_TOTAL]=oldtime;
-  exit(1);
+  fprintf(stdout, "%6.3lf\n", istep==first?0.0:time);
 }
 
 MMD_float Thermo::temperature(Atom atom[], int nparts)
@@ -188,3 +335,50 @@ MMD_float Thermo::temperature(Atom atom[], int nparts)
 
   return t * t_scale;
 }
+
+/* energy/virial and sum of v^2 for the native backend, one partial per
+   thread accumulated in double */
+
+void Thermo::sums_native(Atom atom[], Neighbor neighbor[], Force &force, MMD_float2 &ev, MMD_acc &t)
+{
+  ThreadPool &pool = *force.pool;
+  double* part = new double[3 * pool.nthreads];
+
+  pool.run([&](int tid) {
+    double e = 0, w = 0, vv = 0;
+    int lo, hi;
+    for (int j = 0; j < partitions; j++) {
+      pool.range(tid, j, partitions, atom[j].nlocal, lo, hi);
+      MMD_float3* x = atom[j].x;
+      MMD_float3* v = atom[j].v;
+      for (int i = lo; i < hi; i++) {
+        const int* neighs = &neighbor[j].neighbors[i * neighbor[j].maxneighs];
+        for (int k = 0; k < neighbor[j].numneigh[i]; k++) {
+          int jj = neighs[k];
+          MMD_float delx = x[i].x - x[jj].x;
+          MMD_float dely = x[i].y - x[jj].y;
+          MMD_float delz = x[i].z - x[jj].z;
+          MMD_float rsq = delx*delx + dely*dely + delz*delz;
+          if (rsq < force.cutforcesq) {
+            MMD_float sr2 = 1.0/rsq;
+            MMD_float sr6 = sr2*sr2*sr2;
+            e += 4.0 * sr6*(sr6-1.0);
+            w += rsq * 48.0*sr6*(sr6-0.5)*sr2;
+          }
+        }
+        vv += v[i].x*v[i].x + v[i].y*v[i].y + v[i].z*v[i].z;
+      }
+    }
+    part[3*tid] = e;
+    part[3*tid+1] = w;
+    part[3*tid+2] = vv;
+  });
+
+  for (int tid = 0; tid < pool.nthreads; tid++) {
+    ev.x += part[3*tid];
+    ev.y += part[3*tid+1];
+    t += part[3*tid+2];
+  }
+  delete[] part;
+}
+
@@ -40,16 +40,28 @@ enum units {LJ, METAL};
 #include "comm.h"
 #include "precision.h"
 
+/* host side of the MMD_accK2 energy/virial block sums */
 struct MMD_float2 {
-	MMD_float x,y;
+	MMD_acc x,y;
 };
 class Integrate;
 
+/* host slot of an asynchronous thermo step, one (e, w, v^2) triple per
+   partition is read back into sums when the tasks in hdls complete */
+struct ThermoSlot {
+  int step;
+  int pending;
+  double time;
+  MMD_acc* sums;
+  mcl_handle** hdls;
+};
+
 class Thermo {
  public:
   int nstat;
   int mstat;
   int ntimes;
+  int first;                       // step of the setup output, see Integrate::first
   int *steparr;
   MMD_float *tmparr;
   MMD_float *engarr;
@@ -60,6 +72,10 @@ class Thermo {
   ~Thermo();
   void setup(MCLWrapper*,MMD_float,Integrate &integrate, Atom &atom,int,int);
   void compute(int, Atom[], Neighbor[], Force &, Timer&, Comm&);
+  mcl_handle** launch(int, Atom[], Neighbor[], Force &, Timer&, mcl_handle** after);
+  int due(int istep) {return nstat > 0 && istep % nstat == 0;};
+  cMCLData<MMD_acc, xx>* tally(int partition, int n);
+  void flush();
   MMD_float temperature(Atom[], int);
 
   MMD_float t_act,p_act,e_act;
@@ -67,7 +83,19 @@ class Thermo {
 
  private:
   MMD_float rho;
+  void sums_native(Atom[], Neighbor[], Force &, MMD_float2 &, MMD_acc &);
+  void output(int, MMD_acc, MMD_acc, MMD_acc, double);
+  void collect(ThermoSlot &);
+  void growev(int partition, int n);
   int partitions;
+  int natoms;
+
+  ThermoSlot slot[2];              // double buffered, see launch()
+  int cur;                         // slot of the next launch
+  cMCLData<MMD_acc, xx>** d_ev;    // per partition: block partials of energy/virial
+  cMCLData<MMD_acc, xx>** d_tsum;  // and of the temperature
+  int* maxev;
+  int* tallied;                    // # of partials the force pass left in d_ev, 0: none
 };
 
 #endif
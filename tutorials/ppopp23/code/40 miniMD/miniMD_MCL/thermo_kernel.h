@@ -1,6 +1,8 @@
 #include "precision.h"
+#include "neighbor_codec.h"
+#include "pair_kernel.h"
 
-void warp_reduce_k3(__local MMD_floatK3* sdata, int tid){
+void warp_reduce_k3(__local MMD_accK3* sdata, int tid){
     //sdata[tid] += sdata[tid + 32];
     sdata[tid] += sdata[tid + 16];
     sdata[tid] += sdata[tid + 8];
@@ -9,7 +11,7 @@ void warp_reduce_k3(__local MMD_floatK3* sdata, int tid){
     sdata[tid] += sdata[tid + 1];
 }
 
-void warp_reduce_k2(__local float2* sdata, int tid){
+void warp_reduce_k2(__local MMD_accK2* sdata, int tid){
     //sdata[tid] += sdata[tid + 32];
     sdata[tid] += sdata[tid + 16];
     sdata[tid] += sdata[tid + 8];
@@ -19,34 +21,35 @@ void warp_reduce_k2(__local float2* sdata, int tid){
 }
 
 __kernel void energy_virial(__global MMD_floatK3* x, __global int* numneigh, __global int* neighbors, 
-                            __global float2* sum, __local float2* temp, MMD_float cutforcesq, int maxneighs, int nlocal) 
+                            __global MMD_accK2* sum, __local MMD_accK2* temp, __global const MMD_float* ptab,
+                            MMD_float cutforcesq, int maxneighs, int nlocal,
+                            int halfneigh, int ghost_newton, int compress) 
 {
-    MMD_float sr2, sr6, phi, pair, rsq;
+    MMD_float phi, pair, rsq;
     MMD_floatK3 xi, delx;
-    float2 ei;
+    MMD_accK2 ei;
     int i = get_global_id(0);
 
     int tid = get_local_id(0);
     int block_id = get_group_id(0);
     int block_dim = get_local_size(0);
-    temp[tid] = (0.0f,0.0f);
+    temp[tid] = (MMD_accK2)(0.0f,0.0f);
 
     if(i<nlocal)
     {
-        __global int* neighs = neighbors + i;
+        int pos = 0, j = i;
         xi = x[i];
-        ei = (float2)(0.0f,0.0f);
+        ei = (MMD_accK2)(0.0f,0.0f);
 
         for (int k = 0; k < numneigh[i]; k++) {
-            int j = neighs[k * nlocal];
+            j = neigh_at(neighbors, i, k, nlocal, compress, &pos, j);
             delx = (xi - x[j]);
             rsq = delx.x*delx.x + delx.y*delx.y + delx.z*delx.z;
             if (rsq < cutforcesq) {
-                sr2 = 1.0f/rsq;
-                sr6 = sr2*sr2*sr2;
-                phi = sr6*(sr6-1.0f);
-                pair = 48.0f * sr6 * (sr6 - 0.5f) * sr2;
-                ei += (float2)(4.0f*phi, rsq * pair);
+                pair_eval(rsq, ptab, &pair, &phi);
+                // a half list stores the pair once where a full list has it twice
+                MMD_acc w = (halfneigh && (ghost_newton || j < nlocal)) ? 2.0f : 1.0f;
+                ei += w * (MMD_accK2)(phi, rsq * pair);
             }
         }
         temp[tid] = ei;
@@ -63,7 +66,7 @@ __kernel void energy_virial(__global MMD_floatK3* x, __global int* numneigh, __g
     if (tid == 0) sum[block_id] = temp[0];
 }
 
-__kernel void temperature(__global const MMD_floatK3* v, __global MMD_float* sum, __local MMD_floatK3* temp, int nlocal) 
+__kernel void temperature(__global const MMD_floatK3* v, __global MMD_acc* sum, __local MMD_accK3* temp, int nlocal) 
 {
     int tid = get_local_id(0);
     int block_id = get_group_id(0);
@@ -71,11 +74,12 @@ __kernel void temperature(__global const MMD_floatK3* v, __global MMD_float* sum
     int grid_dim = get_global_size(0) * 2;
     int i = (block_id * block_dim * 2) + tid;
 
-    temp[tid] = (MMD_floatK3)(0.0f, 0.0f, 0.0f);
+    temp[tid] = (MMD_accK3)(0.0f, 0.0f, 0.0f);
 
     while(i < nlocal){
-        temp[tid] += (v[i] * v[i]);
-        temp[tid] += (v[i + block_dim] * v[i + block_dim]);
+        temp[tid] += ACC3(v[i] * v[i]);
+        if (i + block_dim < nlocal)
+            temp[tid] += ACC3(v[i + block_dim] * v[i + block_dim]);
         i += grid_dim;
     }
 
@@ -90,4 +94,38 @@ __kernel void temperature(__global const MMD_floatK3* v, __global MMD_float* sum
     if (tid == 0) {
         sum[block_id] = temp[0].x + temp[0].y + temp[0].z;
     }
-}
\ No newline at end of file
+}
+
+/* second level of the asynchronous thermo (Thermo::launch), a single work
+   group sums the block partials of energy_virial (or energy_cluster,
+   eam_energy) and temperature into out = (energy, virial, sum of v^2) of
+   the partition */
+
+__kernel void thermo_reduce(__global const MMD_accK2* ev, __global const MMD_acc* tsum, __global MMD_acc* out,
+                            __local MMD_accK3* temp, int nev, int ntemp)
+{
+    int tid = get_local_id(0);
+    int block_dim = get_local_size(0);
+    MMD_accK3 acc = (MMD_accK3)(0.0f, 0.0f, 0.0f);
+
+    for (int k = tid; k < nev; k += block_dim) {
+        acc.x += ev[k].x;
+        acc.y += ev[k].y;
+    }
+    for (int k = tid; k < ntemp; k += block_dim)
+        acc.z += tsum[k];
+    temp[tid] = acc;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(int s=block_dim/2; s>0; s=s>>1) {
+        if (tid < s) {
+            temp[tid] += temp[tid + s];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (tid == 0) {
+        out[0] = temp[0].x;
+        out[1] = temp[0].y;
+        out[2] = temp[0].z;
+    }
+}
@@ -0,0 +1,127 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "threadpool.h"
+
+/* consecutive thread ids on consecutive cores: the threads sharing a
+   partition (see range()) end up on the same socket */
+
+static void pin_thread(int tid)
+{
+#ifdef __linux__
+  int ncpu = std::thread::hardware_concurrency();
+  if (ncpu <= 0) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(tid % ncpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+ThreadPool::ThreadPool(int n, int pin)
+{
+  nthreads = n > 0 ? n : 1;
+  task = NULL;
+  generation = 0;
+  busy = 0;
+  stop = 0;
+  if (pin) pin_thread(0);
+  for (int tid = 1; tid < nthreads; tid++)
+    workers.push_back(std::thread(&ThreadPool::worker, this, tid, pin));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = 1;
+  }
+  wake.notify_all();
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
+void ThreadPool::worker(int tid, int pin)
+{
+  if (pin) pin_thread(tid);
+  int seen = 0;
+  std::unique_lock<std::mutex> guard(lock);
+  while (1) {
+    wake.wait(guard, [&] {return stop || generation != seen;});
+    if (stop) return;
+    seen = generation;
+    guard.unlock();
+    (*task)(tid);
+    guard.lock();
+    if (--busy == 0) done.notify_one();
+  }
+}
+
+void ThreadPool::run(const std::function<void(int)> &fn)
+{
+  if (nthreads == 1) {
+    fn(0);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    task = &fn;
+    busy = nthreads - 1;
+    generation++;
+  }
+  wake.notify_all();
+  fn(0);
+  std::unique_lock<std::mutex> guard(lock);
+  done.wait(guard, [&] {return busy == 0;});
+}
+
+/* [lo,hi) of the n items of partition part owned by thread tid
+   with more threads than partitions every partition gets its own group
+   of threads, otherwise every thread owns whole partitions */
+
+void ThreadPool::range(int tid, int part, int nparts, int n, int &lo, int &hi)
+{
+  lo = hi = 0;
+  if (nthreads >= nparts) {
+    int first = part * nthreads / nparts;
+    int last = (part + 1) * nthreads / nparts;
+    if (tid < first || tid >= last) return;
+    lo = (long) n * (tid - first) / (last - first);
+    hi = (long) n * (tid - first + 1) / (last - first);
+  } else if (part * nthreads / nparts == tid) {
+    hi = n;
+  }
+}
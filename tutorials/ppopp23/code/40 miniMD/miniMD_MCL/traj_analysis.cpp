@@ -0,0 +1,419 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+/* in-situ structure analysis of a running miniMD --share (see traj_ring.h):
+   radial distribution function and mean squared displacement, accumulated
+   frame by frame on a ThreadPool. The stream is read lossy (see
+   traj_reader.h), so the simulation never waits for the analysis; frames
+   published while it is busy are skipped and counted.
+
+     traj_analysis [-t threads] [-r rmax] [-b bins] [-d maxdisp] [-o prefix] [-w seconds]
+
+   The stream carries no atom ids and the atom order changes at every
+   reneighboring, so MSD follows atoms from frame to frame: an atom is
+   matched to the nearest atom of the previous frame within maxdisp
+   (minimum image), atoms without a match of their own drop out. The MSD
+   is averaged over the atoms tracked since the first frame, their number
+   is written next to it. maxdisp has to stay below half the nearest
+   neighbor distance and above the distance an atom moves between two
+   analyzed frames, pick --share_every accordingly.
+
+   Output: <prefix>.rdf  r g(r), at the end
+           <prefix>.msd  step MSD tracked skipped, per analyzed frame */
+
+#include "stdio.h"
+#include "stdlib.h"
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <minos.h>
+#include "threadpool.h"
+#include "traj_reader.h"
+
+using namespace std;
+
+#define MAXCELLS 128               // per dimension
+
+/* atoms sorted into cells of at least cut, periodic in prd */
+
+struct CellGrid {
+  int n[3];
+  double prd[3];
+  vector<int> start;               // atoms of cell c: atoms[start[c] .. start[c + 1])
+  vector<int> atoms;
+  vector<int> owner;               // cell of every atom
+
+  int cell(const double* x) const
+  {
+    int c[3];
+    for (int d = 0; d < 3; d++)
+    {
+      double f = x[d] / prd[d];
+      f -= floor(f);
+      c[d] = min(n[d] - 1, (int) (f * n[d]));
+    }
+    return (c[2] * n[1] + c[1]) * n[0] + c[0];
+  }
+
+  void build(const vector<double> &x, const double* box, double cut)
+  {
+    int natoms = x.size() / 3;
+    for (int d = 0; d < 3; d++)
+    {
+      prd[d] = box[d];
+      n[d] = max(1, min(MAXCELLS, (int) (prd[d] / cut)));
+    }
+    int ncells = n[0] * n[1] * n[2];
+    start.assign(ncells + 1, 0);
+    owner.resize(natoms);
+    for (int i = 0; i < natoms; i++)
+    {
+      owner[i] = cell(&x[3 * i]);
+      start[owner[i] + 1]++;
+    }
+    for (int c = 0; c < ncells; c++)
+      start[c + 1] += start[c];
+    atoms.resize(natoms);
+    vector<int> fill(start.begin(), start.end() - 1);
+    for (int i = 0; i < natoms; i++)
+      atoms[fill[owner[i]]++] = i;
+  }
+
+  /* distinct cells around cell c (itself included), fewer than 27 if a
+     dimension has less than 3 cells */
+  int neighbors(int c, int* nb) const
+  {
+    int ci[3] = {c % n[0], (c / n[0]) % n[1], c / (n[0] * n[1])};
+    int idx[3][3], cnt[3];
+    for (int d = 0; d < 3; d++)
+    {
+      cnt[d] = 0;
+      for (int o = -1; o <= 1; o++)
+      {
+        int k = (ci[d] + o + n[d]) % n[d];
+        int seen = 0;
+        for (int m = 0; m < cnt[d]; m++)
+          seen |= idx[d][m] == k;
+        if (!seen)
+          idx[d][cnt[d]++] = k;
+      }
+    }
+    int nn = 0;
+    for (int z = 0; z < cnt[2]; z++)
+      for (int y = 0; y < cnt[1]; y++)
+        for (int x = 0; x < cnt[0]; x++)
+          nb[nn++] = (idx[2][z] * n[1] + idx[1][y]) * n[0] + idx[0][x];
+    return nn;
+  }
+};
+
+static inline double min_image(const double* a, const double* b, const double* prd, double* dx)
+{
+  double rsq = 0;
+  for (int d = 0; d < 3; d++)
+  {
+    dx[d] = a[d] - b[d];
+    dx[d] -= prd[d] * rint(dx[d] / prd[d]);
+    rsq += dx[d] * dx[d];
+  }
+  return rsq;
+}
+
+/* g(r) histogram, ordered pairs normalized per frame by N rho */
+
+struct RDF {
+  double rmax;
+  int nbins;
+  int nframes;
+  vector<double> acc;
+  vector<vector<long> > hist;      // per thread
+  CellGrid grid;
+
+  void setup(double rmax_, int nbins_, int nthreads)
+  {
+    rmax = rmax_;
+    nbins = nbins_;
+    nframes = 0;
+    acc.assign(nbins, 0.0);
+    hist.assign(nthreads, vector<long>(nbins, 0));
+  }
+
+  void compute(ThreadPool &pool, const vector<double> &x, const double* prd)
+  {
+    int natoms = x.size() / 3;
+    if (natoms < 2)
+      return;
+    grid.build(x, prd, rmax);
+    double rmaxsq = rmax * rmax;
+    double rdr = nbins / rmax;
+    pool.run([&](int tid) {
+      int lo, hi;
+      pool.range(tid, 0, 1, natoms, lo, hi);
+      long* h = &hist[tid][0];
+      int nb[27];
+      double dx[3];
+      for (int i = lo; i < hi; i++)
+      {
+        int nn = grid.neighbors(grid.owner[i], nb);
+        for (int k = 0; k < nn; k++)
+          for (int a = grid.start[nb[k]]; a < grid.start[nb[k] + 1]; a++)
+          {
+            int j = grid.atoms[a];
+            if (j == i)
+              continue;
+            double rsq = min_image(&x[3 * i], &x[3 * j], prd, dx);
+            if (rsq < rmaxsq)
+              h[min(nbins - 1, (int) (sqrt(rsq) * rdr))]++;
+          }
+      }
+    });
+
+    double rho = natoms / (prd[0] * prd[1] * prd[2]);
+    for (int b = 0; b < nbins; b++)
+    {
+      long sum = 0;
+      for (size_t t = 0; t < hist.size(); t++)
+      {
+        sum += hist[t][b];
+        hist[t][b] = 0;
+      }
+      acc[b] += sum / (natoms * rho);
+    }
+    nframes++;
+  }
+
+  void write(const char* file)
+  {
+    FILE* fp = fopen(file, "w");
+    if (!fp)
+    {
+      printf("ERROR: cannot open %s\n", file);
+      return;
+    }
+    fprintf(fp, "# r g(r), %i frames\n", nframes);
+    double dr = rmax / nbins;
+    for (int b = 0; b < nbins; b++)
+    {
+      double r0 = b * dr, r1 = (b + 1) * dr;
+      double shell = 4.0 / 3.0 * M_PI * (r1 * r1 * r1 - r0 * r0 * r0);
+      fprintf(fp, "%lf %lf\n", (b + 0.5) * dr, nframes ? acc[b] / (nframes * shell) : 0.0);
+    }
+    fclose(fp);
+  }
+};
+
+/* unwrapped displacements of the atoms followed since the first frame */
+
+struct MSD {
+  double maxdisp;
+  vector<double> prev;             // positions of the previous frame
+  vector<double> disp, next_disp;
+  vector<char> alive, next_alive;
+  vector<int> match, refs;
+  CellGrid grid;
+  int lost;
+
+  void setup(double maxdisp_)
+  {
+    maxdisp = maxdisp_;
+    lost = 0;
+  }
+
+  int tracked()
+  {
+    return count(alive.begin(), alive.end(), 1);
+  }
+
+  double compute(ThreadPool &pool, const vector<double> &x, const double* prd)
+  {
+    int natoms = x.size() / 3;
+    if (prev.empty())
+    {
+      prev = x;
+      disp.assign(3 * natoms, 0.0);
+      alive.assign(natoms, 1);
+      return 0.0;
+    }
+
+    int nprev = prev.size() / 3;
+    grid.build(prev, prd, maxdisp);
+    match.assign(natoms, -1);
+    double maxsq = maxdisp * maxdisp;
+    pool.run([&](int tid) {
+      int lo, hi;
+      pool.range(tid, 0, 1, natoms, lo, hi);
+      int nb[27];
+      double dx[3];
+      for (int i = lo; i < hi; i++)
+      {
+        double best = maxsq;
+        int nn = grid.neighbors(grid.cell(&x[3 * i]), nb);
+        for (int k = 0; k < nn; k++)
+          for (int a = grid.start[nb[k]]; a < grid.start[nb[k] + 1]; a++)
+          {
+            int p = grid.atoms[a];
+            double rsq = min_image(&x[3 * i], &prev[3 * p], prd, dx);
+            if (rsq < best)
+            {
+              best = rsq;
+              match[i] = p;
+            }
+          }
+      }
+    });
+
+    // an atom of the previous frame claimed twice is ambiguous
+    refs.assign(nprev, 0);
+    for (int i = 0; i < natoms; i++)
+      if (match[i] >= 0)
+        refs[match[i]]++;
+
+    next_disp.resize(3 * natoms);
+    next_alive.resize(natoms);
+    vector<double> sums(pool.nthreads, 0.0);
+    pool.run([&](int tid) {
+      int lo, hi;
+      pool.range(tid, 0, 1, natoms, lo, hi);
+      double dx[3];
+      for (int i = lo; i < hi; i++)
+      {
+        int p = match[i];
+        next_alive[i] = p >= 0 && refs[p] == 1 && alive[p];
+        if (!next_alive[i])
+          continue;
+        min_image(&x[3 * i], &prev[3 * p], prd, dx);
+        for (int d = 0; d < 3; d++)
+        {
+          next_disp[3 * i + d] = disp[3 * p + d] + dx[d];
+          sums[tid] += next_disp[3 * i + d] * next_disp[3 * i + d];
+        }
+      }
+    });
+
+    int before = tracked();
+    prev = x;
+    disp.swap(next_disp);
+    alive.swap(next_alive);
+    int after = tracked();
+    lost += before - after;
+
+    double sum = 0;
+    for (int t = 0; t < pool.nthreads; t++)
+      sum += sums[t];
+    return after ? sum / after : 0.0;
+  }
+};
+
+int main(int argc, char** argv)
+{
+  int nthreads = thread::hardware_concurrency();
+  double rmax = 2.5;
+  int nbins = 100;
+  double maxdisp = 0.3;
+  const char* prefix = "miniMD";
+  int wait = 60;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "-t") == 0) && i + 1 < argc) {nthreads = atoi(argv[++i]); continue;}
+    if ((strcmp(argv[i], "-r") == 0) && i + 1 < argc) {rmax = atof(argv[++i]); continue;}
+    if ((strcmp(argv[i], "-b") == 0) && i + 1 < argc) {nbins = atoi(argv[++i]); continue;}
+    if ((strcmp(argv[i], "-d") == 0) && i + 1 < argc) {maxdisp = atof(argv[++i]); continue;}
+    if ((strcmp(argv[i], "-o") == 0) && i + 1 < argc) {prefix = argv[++i]; continue;}
+    if ((strcmp(argv[i], "-w") == 0) && i + 1 < argc) {wait = atoi(argv[++i]); continue;}
+    printf("usage: %s [-t threads] [-r rdf cutoff] [-b rdf bins] [-d max displacement between frames]\n"
+           "       [-o output prefix] [-w seconds to wait for miniMD]\n", argv[0]);
+    return 1;
+  }
+  if (rmax <= 0 || nbins < 1 || maxdisp <= 0)
+  {
+    printf("ERROR: -r %lf -b %i -d %lf is not supported. Exiting.\n", rmax, nbins, maxdisp);
+    return 1;
+  }
+
+  mcl_init(1, 0x0);
+  TrajReader reader;
+  if (reader.attach(wait, 1))
+  {
+    mcl_finit();
+    return 1;
+  }
+
+  char name[1024];
+  snprintf(name, sizeof(name), "%s.msd", prefix);
+  FILE* msd_fp = fopen(name, "w");
+  if (!msd_fp)
+  {
+    printf("ERROR: cannot open %s\n", name);
+    reader.detach();
+    mcl_finit();
+    return 1;
+  }
+  fprintf(msd_fp, "# step MSD tracked skipped\n");
+
+  ThreadPool pool(nthreads, 0);
+  RDF rdf;
+  rdf.setup(rmax, nbins, pool.nthreads);
+  MSD msd;
+  msd.setup(maxdisp);
+
+  TrajFrame f;
+  vector<double> x;
+  while (reader.next(f))
+  {
+    const double* prd = f.chunks[0].prd;
+    // minimum image only holds up to half the box
+    double half = 0.5 * min(prd[0], min(prd[1], prd[2]));
+    if (rdf.rmax > half)
+    {
+      printf("# RDF cutoff %lf exceeds half the box, using %lf\n", rdf.rmax, half);
+      rdf.setup(half, nbins, pool.nthreads);
+    }
+
+    f.decode(x);
+    rdf.compute(pool, x, prd);
+    double m = msd.compute(pool, x, prd);
+    fprintf(msd_fp, "%i %lf %i %i\n", f.step, m, msd.tracked(), reader.skipped);
+    fflush(msd_fp);
+  }
+  fclose(msd_fp);
+
+  snprintf(name, sizeof(name), "%s.rdf", prefix);
+  rdf.write(name);
+  printf("# %i frames analyzed, %i frames skipped, %i atoms lost by tracking (%i tracked)\n",
+         reader.frames, reader.skipped, msd.lost, msd.tracked());
+
+  reader.detach();
+  mcl_finit();
+  return 0;
+}
@@ -0,0 +1,193 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+/* reference consumer of the --share trajectory stream (see traj_ring.h):
+   attaches to the shared buffers of a running miniMD, gathers the chunks
+   of every frame and appends them, byte-shuffled and deflated, to a file.
+
+     traj_consumer [-o file] [-l level] [-w seconds] [--lossy]
+
+   By default it registers with the producer, which then waits for it
+   instead of overwriting frames it has not read. --lossy does not
+   register, frames overwritten while being read are skipped and counted.
+
+   File: "MMDTRAJ\0", int version, then per frame a TrajFrameRecord, its
+   nchunks TrajChunkRecords and zbytes of zlib data. Inflated, that is the
+   payload of every chunk in order, its bytes split into planes (all first
+   bytes of the chunk, then all second bytes, ...) of 4 byte floats
+   (TRAJ_FLOAT) or 2 byte float16 / fixed16 values, 3 per atom.
+   fixed16 decodes to grid_lo + q * grid_step. Atoms are in the order of the
+   partitions at that step, which changes at every reneighboring. */
+
+#include "stdio.h"
+#include "stdlib.h"
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+#include <minos.h>
+#include "traj_reader.h"
+
+using namespace std;
+
+#define TRAJ_FILE_MAGIC "MMDTRAJ"
+#define TRAJ_FILE_VERSION 1
+
+struct TrajFrameRecord {
+  int step;
+  int natoms;
+  int nparts;
+  int mode;
+  int nchunks;
+  int pad;
+  double prd[3];
+  uint64_t raw_bytes;              // payload size before deflate
+  uint64_t zbytes;                 // size of the zlib data that follows
+};
+
+struct TrajChunkRecord {
+  int partition;
+  int first;
+  int count;
+  int nlocal;
+  double lo[3], hi[3];             // partition bounds
+  double grid_lo[3], grid_step[3]; // TRAJ_FIXED16 decoding
+};
+
+static void shuffle(const unsigned char* in, unsigned char* out, size_t n, int size)
+{
+  size_t m = n / size;
+  for (int b = 0; b < size; b++)
+    for (size_t i = 0; i < m; i++)
+      out[b * m + i] = in[i * size + b];
+}
+
+static int write_frame(FILE* fp, TrajFrame &f, int level, vector<unsigned char> &shuffled, vector<unsigned char> &zbuf)
+{
+  const TrajSlot &head = f.chunks[0];
+  TrajFrameRecord r;
+  memset(&r, 0, sizeof(r));
+  r.step = f.step;
+  r.natoms = head.natoms;
+  r.nparts = head.nparts;
+  r.mode = head.mode;
+  r.nchunks = f.chunks.size();
+  memcpy(r.prd, head.prd, sizeof(r.prd));
+  r.raw_bytes = f.raw.size();
+
+  vector<TrajChunkRecord> chunks(r.nchunks);
+  shuffled.resize(f.raw.size());
+  size_t at = 0;
+  for (int k = 0; k < r.nchunks; k++)
+  {
+    const TrajSlot &h = f.chunks[k];
+    TrajChunkRecord &c = chunks[k];
+    c.partition = h.partition;
+    c.first = h.first;
+    c.count = h.count;
+    c.nlocal = h.nlocal;
+    memcpy(c.lo, h.lo, sizeof(c.lo));
+    memcpy(c.hi, h.hi, sizeof(c.hi));
+    memcpy(c.grid_lo, h.grid_lo, sizeof(c.grid_lo));
+    memcpy(c.grid_step, h.grid_step, sizeof(c.grid_step));
+    size_t bytes = traj_bytes(h.mode, h.count);
+    if (bytes)
+      shuffle(&f.raw[at], &shuffled[at], bytes, h.mode == TRAJ_FLOAT ? 4 : 2);
+    at += bytes;
+  }
+
+  uLongf zbytes = compressBound(shuffled.size());
+  zbuf.resize(zbytes > 0 ? zbytes : 1);
+  if (compress2(&zbuf[0], &zbytes, shuffled.empty() ? NULL : &shuffled[0], shuffled.size(), level) != Z_OK)
+    return 1;
+  r.zbytes = zbytes;
+
+  if (fwrite(&r, sizeof(r), 1, fp) != 1) return 1;
+  if (r.nchunks && fwrite(&chunks[0], sizeof(TrajChunkRecord), r.nchunks, fp) != (size_t) r.nchunks) return 1;
+  if (fwrite(&zbuf[0], 1, zbytes, fp) != zbytes) return 1;
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  const char* file = "miniMD.traj";
+  int level = Z_DEFAULT_COMPRESSION;
+  int wait = 60;
+  int lossy = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "-o") == 0) && i + 1 < argc) {file = argv[++i]; continue;}
+    if ((strcmp(argv[i], "-l") == 0) && i + 1 < argc) {level = atoi(argv[++i]); continue;}
+    if ((strcmp(argv[i], "-w") == 0) && i + 1 < argc) {wait = atoi(argv[++i]); continue;}
+    if (strcmp(argv[i], "--lossy") == 0) {lossy = 1; continue;}
+    printf("usage: %s [-o file] [-l zlib level] [-w seconds to wait for miniMD] [--lossy]\n", argv[0]);
+    return 1;
+  }
+
+  mcl_init(1, 0x0);
+  TrajReader reader;
+  if (reader.attach(wait, lossy))
+  {
+    mcl_finit();
+    return 1;
+  }
+
+  FILE* fp = fopen(file, "wb");
+  if (!fp)
+  {
+    printf("ERROR: cannot open %s\n", file);
+    reader.detach();
+    mcl_finit();
+    return 1;
+  }
+  char magic[8] = TRAJ_FILE_MAGIC;
+  int version = TRAJ_FILE_VERSION;
+  fwrite(magic, sizeof(magic), 1, fp);
+  fwrite(&version, sizeof(version), 1, fp);
+
+  TrajFrame f;
+  vector<unsigned char> shuffled, zbuf;
+  int written = 0, error = 0;
+  while (!error && reader.next(f))
+  {
+    error = write_frame(fp, f, level, shuffled, zbuf);
+    written += !error;
+  }
+
+  if (error)
+    printf("ERROR: writing %s failed\n", file);
+  fclose(fp);
+  printf("# %i frames written to %s, %i frames skipped\n", written, file, reader.skipped);
+
+  reader.detach();
+  mcl_finit();
+  return error;
+}
@@ -0,0 +1,305 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#ifndef TRAJ_READER_H
+#define TRAJ_READER_H
+
+#include "stdio.h"
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <signal.h>
+#include <unistd.h>
+#include <minos.h>
+#include "traj_ring.h"
+
+/* consumer side of the --share trajectory stream (see traj_ring.h), shared
+   by traj_consumer and traj_analysis. next() gathers the chunks of one
+   frame. A registered reader is waited for and gets every frame from the
+   one after attaching on. A lossy reader never holds the producer back:
+   chunks overwritten while being read void their frame, and once more
+   than half the ring is unread it jumps ahead to the newest frames.
+   Frames missed either way are counted in skipped. */
+
+static volatile sig_atomic_t traj_stop = 0;
+
+static void traj_on_signal(int)
+{
+  traj_stop = 1;
+}
+
+static inline float traj_half(uint16_t h)
+{
+  uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t man = h & 0x3ff;
+  uint32_t bits;
+  if (exp == 0x1f)
+    bits = sign | 0x7f800000 | (man << 13);
+  else if (exp)
+    bits = sign | ((exp + 112) << 23) | (man << 13);
+  else if (man)
+  {
+    // subnormal half, normalize
+    exp = 113;
+    while (!(man & 0x400)) {man <<= 1; exp--;}
+    bits = sign | (exp << 23) | ((man & 0x3ff) << 13);
+  }
+  else
+    bits = sign;
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+struct TrajFrame {
+  int step;
+  std::vector<TrajSlot> chunks;    // headers, in partition and chunk order
+  std::vector<unsigned char> raw;  // their payloads back to back
+
+  int natoms() const
+  {
+    int n = 0;
+    for (size_t c = 0; c < chunks.size(); c++)
+      n += chunks[c].count;
+    return n;
+  }
+
+  /* positions of all chunks as x0 y0 z0 x1 ... */
+  void decode(std::vector<double> &x) const
+  {
+    x.resize(3 * (size_t) natoms());
+    size_t at = 0, i = 0;
+    for (size_t c = 0; c < chunks.size(); c++)
+    {
+      const TrajSlot &h = chunks[c];
+      const unsigned char* p = &raw[at];
+      for (int k = 0; k < 3 * h.count; k++, i++)
+      {
+        if (h.mode == TRAJ_FLOAT)
+        {
+          float v;
+          memcpy(&v, p + 4 * k, sizeof(v));
+          x[i] = v;
+        }
+        else
+        {
+          uint16_t q;
+          memcpy(&q, p + 2 * k, sizeof(q));
+          x[i] = h.mode == TRAJ_HALF ? traj_half(q) : h.grid_lo[k % 3] + q * h.grid_step[k % 3];
+        }
+      }
+      at += traj_bytes(h.mode, h.count);
+    }
+  }
+};
+
+class TrajReader {
+ public:
+  int frames;                      // frames returned by next
+  int skipped;                     // frames of the stream that were not
+  int every;                       // steps between frames
+
+  TrajReader()
+  {
+    frames = skipped = every = 0;
+    lossy = 0;
+    ctrl = NULL;
+    seq = 0;
+    last_step = -1;
+  }
+
+  ~TrajReader()
+  {
+    detach();
+  }
+
+  /* wait up to wait seconds for a running miniMD --share, 0 if attached */
+  int attach(int wait, int lossy_)
+  {
+    lossy = lossy_;
+    signal(SIGINT, traj_on_signal);
+    signal(SIGTERM, traj_on_signal);
+
+    // miniMD may not be up yet, or what is there is left over from a finished run
+    for (int t = 0; !traj_stop && t < wait * 10; t++)
+    {
+      ctrl = (TrajControl*) mcl_get_shared_buffer(TRAJ_CTRL_NAME, sizeof(TrajControl), MCL_ARG_DYNAMIC);
+      if (ctrl && __atomic_load_n(&ctrl->magic, __ATOMIC_ACQUIRE) == TRAJ_MAGIC && !__atomic_load_n(&ctrl->done, __ATOMIC_ACQUIRE))
+        break;
+      if (ctrl)
+        mcl_free_shared_buffer(ctrl);
+      ctrl = NULL;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (!ctrl)
+    {
+      printf("ERROR: no trajectory stream found, run miniMD with --share\n");
+      return 1;
+    }
+    if (ctrl->version != TRAJ_VERSION)
+    {
+      printf("ERROR: trajectory stream version %i, expected %i\n", ctrl->version, TRAJ_VERSION);
+      mcl_free_shared_buffer(ctrl);
+      ctrl = NULL;
+      return 1;
+    }
+    every = ctrl->every;
+    slots.assign(ctrl->nslots, (void*) NULL);
+
+    // frames still in flight are not ours, start with the next one
+    seq = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE) + 1;
+    if (!lossy)
+    {
+      __atomic_store_n(&ctrl->start, seq, __ATOMIC_RELEASE);
+      __atomic_store_n(&ctrl->consumer, (int) getpid(), __ATOMIC_RELEASE);
+    }
+    return 0;
+  }
+
+  /* the next complete frame, 0 once the stream ended or on SIGINT/SIGTERM */
+  int next(TrajFrame &f)
+  {
+    f.step = -1;
+    while (!traj_stop)
+    {
+      uint64_t head = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE);
+      if (lossy && head >= seq + ctrl->nslots / 2)
+      {
+        seq = head + 1 - ctrl->nslots / 4;
+        f.step = -1;
+      }
+
+      TrajSlot h;
+      int r = read(h);
+      if (r < 0)
+      {
+        if (__atomic_load_n(&ctrl->done, __ATOMIC_ACQUIRE) && head < seq)
+          return 0;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        continue;
+      }
+      seq++;
+      if (r == 0)
+      {
+        f.step = -1;
+        continue;
+      }
+
+      if (h.partition == 0 && h.chunk == 0)
+      {
+        f.step = h.step;
+        f.chunks.clear();
+        f.raw.clear();
+      }
+      else if (h.step != f.step)
+        continue;                  // rest of a frame whose start was missed
+
+      f.chunks.push_back(h);
+      f.raw.insert(f.raw.end(), payload.begin(), payload.end());
+      if (h.partition == h.nparts - 1 && h.chunk == h.nchunks - 1)
+      {
+        if (last_step >= 0 && every > 0 && f.step > last_step)
+          skipped += (f.step - last_step) / every - 1;
+        last_step = f.step;
+        frames++;
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  /* chunks published but not read yet */
+  uint64_t behind()
+  {
+    uint64_t head = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE);
+    return head >= seq ? head + 1 - seq : 0;
+  }
+
+  void detach()
+  {
+    if (!ctrl)
+      return;
+    if (!lossy)
+      __atomic_store_n(&ctrl->consumer, 0, __ATOMIC_RELEASE);
+    for (size_t s = 0; s < slots.size(); s++)
+      if (slots[s])
+        mcl_free_shared_buffer(slots[s]);
+    slots.clear();
+    mcl_free_shared_buffer(ctrl);
+    ctrl = NULL;
+  }
+
+ private:
+  int lossy;
+  TrajControl* ctrl;
+  std::vector<void*> slots;
+  std::vector<unsigned char> payload;
+  uint64_t seq;                    // next chunk to read
+  int last_step;                   // step of the last frame returned
+
+  /* copy chunk seq into h and payload: 1 valid, 0 overwritten, -1 not published yet */
+  int read(TrajSlot &h)
+  {
+    int s = (seq - 1) % ctrl->nslots;
+    TrajSlot &slot = ctrl->slot[s];
+    uint64_t cur = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+    if (cur == 0 || cur < seq)
+      return -1;
+
+    int valid = 0;
+    if (cur == seq)
+    {
+      memcpy(&h, &slot, sizeof(h));
+      if (!slots[s])
+      {
+        char name[32];
+        sprintf(name, TRAJ_SLOT_NAME, s);
+        slots[s] = mcl_get_shared_buffer(name, traj_bytes(h.mode, ctrl->chunk), MCL_ARG_DYNAMIC);
+      }
+      if (slots[s])
+      {
+        payload.resize(traj_bytes(h.mode, h.count));
+        if (payload.size())
+          memcpy(&payload[0], slots[s], payload.size());
+        // a changed seq means the producer rewrote the slot meanwhile
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        valid = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE) == seq;
+      }
+    }
+    if (!lossy)
+      __atomic_store_n(&slot.ack, seq, __ATOMIC_RELEASE);
+    return valid;
+  }
+};
+
+#endif
@@ -0,0 +1,106 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#ifndef TRAJ_RING_H
+#define TRAJ_RING_H
+
+#include <stdint.h>
+#include "kernel_params.h"
+
+/* layout of the --share trajectory stream, shared by the producer
+   (TrajStream) and out-of-process consumers such as traj_consumer.
+
+   A frame is one chunk of at most TRAJ_CHUNK owned atoms per slot, every
+   partition of a step sends ceil(nlocal / TRAJ_CHUNK) chunks (one if it
+   owns none). Chunks get consecutive sequence numbers, chunk seq lives in
+   slot (seq - 1) % nslots: the payload in the MCL shared buffer
+   TRAJ_SLOT_NAME, its header in the slot array of the control block
+   TRAJ_CTRL_NAME. The payload is written by a device task, the header by
+   the host, so they live in different buffers.
+
+   Protocol (seqlock per slot):
+   - the producer sets seq to 0, rewrites header and payload and stores
+     the new seq once the payload is back, then advances head
+   - a consumer reads seq, copies header and payload and rereads seq,
+     if it changed the slot was overwritten meanwhile and the copy is void
+   - a consumer that stores the first seq it reads in start and then its pid
+     in consumer makes the producer wait before reusing a slot until ack of
+     that slot reached its seq; without one (or once that process is gone)
+     slots are overwritten
+   - done is set after the last chunk was published */
+
+#define TRAJ_MAGIC 0x4a415254u     // "TRAJ"
+#define TRAJ_VERSION 2
+#define TRAJ_SLOTS 100
+#define TRAJ_CHUNK 65536
+#define TRAJ_CTRL_NAME "mcl_traj_ctrl"
+#define TRAJ_SLOT_NAME "mcl_pos_buffer_%05d"
+
+struct TrajSlot {
+  uint64_t seq;                    // sequence number of the chunk in here, 0: being written
+  uint64_t ack;                    // last seq the consumer is done with, written by the consumer
+  int step;
+  int partition;
+  int nparts;
+  int natoms;                      // atoms of the whole system
+  int nlocal;                      // owned atoms of the partition at this step
+  int first;                       // chunk holds owned atoms [first, first + count)
+  int count;
+  int chunk;                       // index of the chunk in the partition
+  int nchunks;                     // chunks of the partition at this step
+  int mode;                        // TRAJ_FLOAT, TRAJ_HALF or TRAJ_FIXED16
+  double prd[3];                   // periodic box
+  double lo[3];                    // partition bounds
+  double hi[3];
+  double grid_lo[3];               // TRAJ_FIXED16: x = grid_lo + q * grid_step
+  double grid_step[3];
+};
+
+struct TrajControl {
+  uint32_t magic;
+  int version;
+  int nslots;
+  int chunk;                       // atoms per slot
+  int every;                       // steps between frames
+  uint64_t head;                   // last published seq
+  uint64_t start;                  // first seq the registered consumer reads
+  int done;
+  int consumer;                    // pid of the consumer the producer waits for, 0: none
+  struct TrajSlot slot[TRAJ_SLOTS];
+};
+
+/* bytes of count atoms in the given mode */
+static inline int traj_bytes(int mode, int count)
+{
+  return count * (mode == TRAJ_FLOAT ? 3 * (int) sizeof(float) : 3 * (int) sizeof(uint16_t));
+}
+
+#endif
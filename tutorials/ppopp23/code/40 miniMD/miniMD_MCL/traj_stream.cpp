@@ -0,0 +1,279 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#include "stdio.h"
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <signal.h>
+#include <errno.h>
+#include <minos.h>
+#include "traj_stream.h"
+
+#define TRAJ_SHARED_FLAGS (MCL_ARG_DYNAMIC | MCL_SHARED_MEM_NEW | MCL_SHARED_MEM_DEL_OLD)
+
+using namespace std;
+
+TrajStream::TrajStream()
+{
+  every = 0;
+  mode = TRAJ_FLOAT;
+  frames = 0;
+  waits = 0;
+  mcl = NULL;
+  partitions = 0;
+  ctrl = NULL;
+  last = NULL;
+  seq = 0;
+}
+
+TrajStream::~TrajStream()
+{
+  delete[] last;
+}
+
+/* the control block is created here, payload buffers once a slot is first used */
+
+void TrajStream::setup(MCLWrapper* mcl_, int partitions_)
+{
+  mcl = mcl_;
+  partitions = partitions_;
+  last = new mcl_handle*[partitions];
+  slots.assign(TRAJ_SLOTS, NULL);
+  occupant.assign(TRAJ_SLOTS, 0);
+
+  ctrl = (TrajControl*) mcl_get_shared_buffer(TRAJ_CTRL_NAME, sizeof(TrajControl), TRAJ_SHARED_FLAGS);
+  memset(ctrl, 0, sizeof(TrajControl));
+  ctrl->version = TRAJ_VERSION;
+  ctrl->nslots = TRAJ_SLOTS;
+  ctrl->chunk = TRAJ_CHUNK;
+  ctrl->every = every;
+  __atomic_store_n(&ctrl->magic, TRAJ_MAGIC, __ATOMIC_RELEASE);
+}
+
+/* enqueue the chunks of the frame of step after the tasks in after (one per
+   partition) and return the last chunk task of every partition, the next
+   step has to wait on those before it moves x. NULL if step has no frame */
+
+mcl_handle** TrajStream::launch(int step, Atom atom[], Neighbor neighbor[], mcl_handle** after)
+{
+  if (!due(step)) return NULL;
+
+  // everything that could depend on these was submitted since the last frame
+  for (size_t k = 0; k < retired.size(); k++)
+    mcl_hdl_free(retired[k]);
+  retired.clear();
+  publish();
+
+  int natoms = 0;
+  for (int j = 0; j < partitions; j++)
+    natoms += atom[j].nlocal;
+
+  for (int j = 0; j < partitions; j++)
+  {
+    Atom &a = atom[j];
+    int nchunks = a.nlocal > 0 ? (a.nlocal + TRAJ_CHUNK - 1) / TRAJ_CHUNK : 1;
+
+    /* owned atoms stay within the neighbor cutoff of the partition
+       until the next exchange, that bounds the fixed16 grid */
+    MMD_float pad = neighbor[j].cutneigh;
+    TrajParams p;
+    p.lo.x = a.box.xlo - pad;
+    p.lo.y = a.box.ylo - pad;
+    p.lo.z = a.box.zlo - pad;
+    p.scale.x = 65535.0 / (a.box.xhi - a.box.xlo + 2 * pad);
+    p.scale.y = 65535.0 / (a.box.yhi - a.box.ylo + 2 * pad);
+    p.scale.z = 65535.0 / (a.box.zhi - a.box.zlo + 2 * pad);
+    p.mode = mode;
+    p.pad = 0;
+
+    mcl_handle* prev = after[j];
+    for (int c = 0; c < nchunks; c++)
+    {
+      uint64_t cseq = ++seq;
+      int s = (cseq - 1) % TRAJ_SLOTS;
+      reserve(s);
+
+      p.first = c * TRAJ_CHUNK;
+      p.count = min(TRAJ_CHUNK, a.nlocal - p.first);
+
+      TrajSlot &h = ctrl->slot[s];
+      __atomic_store_n(&h.seq, 0, __ATOMIC_RELEASE);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      occupant[s] = cseq;
+      h.step = step;
+      h.partition = j;
+      h.nparts = partitions;
+      h.natoms = natoms;
+      h.nlocal = a.nlocal;
+      h.first = p.first;
+      h.count = p.count;
+      h.chunk = c;
+      h.nchunks = nchunks;
+      h.mode = mode;
+      h.prd[0] = a.box.xprd;
+      h.prd[1] = a.box.yprd;
+      h.prd[2] = a.box.zprd;
+      h.lo[0] = a.box.xlo;
+      h.lo[1] = a.box.ylo;
+      h.lo[2] = a.box.zlo;
+      h.hi[0] = a.box.xhi;
+      h.hi[1] = a.box.yhi;
+      h.hi[2] = a.box.zhi;
+      h.grid_lo[0] = p.lo.x;
+      h.grid_lo[1] = p.lo.y;
+      h.grid_lo[2] = p.lo.z;
+      h.grid_step[0] = 1.0 / p.scale.x;
+      h.grid_step[1] = 1.0 / p.scale.y;
+      h.grid_step[2] = 1.0 / p.scale.z;
+
+      // an empty partition still sends its header, with a one atom payload
+      int n = p.count > 0 ? p.count : 1;
+      prev = mcl->LaunchKernelShared("share_kernel.h", "traj_pack", n, prev ? 1 : 0, prev ? &prev : NULL, 3,
+                                     a.d_x->devData(), a.d_x->devSize(), a.d_x->mclFlags(),
+                                     slots[s], traj_bytes(mode, n), MCL_ARG_BUFFER | MCL_ARG_RESIDENT | MCL_ARG_SHARED | MCL_ARG_DYNAMIC | MCL_ARG_OUTPUT,
+                                     &p, sizeof(p), MCL_ARG_SCALAR);
+      TrajChunk chunk = {prev, s, cseq};
+      pending.push_back(chunk);
+    }
+    last[j] = prev;
+  }
+  frames++;
+  return last;
+}
+
+/* publish the chunks whose tasks completed, in seq order */
+
+void TrajStream::publish()
+{
+  while (!pending.empty() && mcl_test(pending.front().hdl) == MCL_REQ_COMPLETED)
+  {
+    TrajChunk &c = pending.front();
+    __atomic_store_n(&ctrl->slot[c.slot].seq, c.seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ctrl->head, c.seq, __ATOMIC_RELEASE);
+    retired.push_back(c.hdl);
+    pending.pop_front();
+  }
+}
+
+/* wait until the chunk slot holds is published and the consumer is done
+   with it, and make sure the slot has a payload buffer. The ring wraps
+   within a frame once it has more than TRAJ_SLOTS chunks, the traj_pack
+   task still writing the slot is then not ordered before the new one */
+
+void TrajStream::reserve(int slot)
+{
+  while (writing(slot))
+  {
+    mcl_wait(pending.front().hdl);
+    publish();
+  }
+
+  if (held(slot))
+  {
+    waits++;
+    while (held(slot))
+    {
+      publish();
+      this_thread::sleep_for(chrono::microseconds(100));
+    }
+  }
+
+  if (!slots[slot])
+  {
+    char name[32];
+    sprintf(name, TRAJ_SLOT_NAME, slot);
+    slots[slot] = mcl_get_shared_buffer(name, traj_bytes(mode, TRAJ_CHUNK), TRAJ_SHARED_FLAGS);
+  }
+}
+
+/* a launched chunk that is not published yet targets slot */
+
+int TrajStream::writing(int slot)
+{
+  for (size_t k = 0; k < pending.size(); k++)
+    if (pending[k].slot == slot)
+      return 1;
+  return 0;
+}
+
+/* the registered consumer still has to read the chunk in slot,
+   chunks from before it attached (seq < start) are not waited for */
+
+int TrajStream::held(int slot)
+{
+  uint64_t s = occupant[slot];
+  if (s == 0 || __atomic_load_n(&ctrl->slot[slot].ack, __ATOMIC_ACQUIRE) >= s || !consumer_alive())
+    return 0;
+  return s >= __atomic_load_n(&ctrl->start, __ATOMIC_ACQUIRE);
+}
+
+/* a registered consumer that exited without deregistering is dropped */
+
+int TrajStream::consumer_alive()
+{
+  int pid = __atomic_load_n(&ctrl->consumer, __ATOMIC_ACQUIRE);
+  if (pid == 0)
+    return 0;
+  if (kill(pid, 0) == 0 || errno == EPERM)
+    return 1;
+  printf("# trajectory consumer %i is gone, overwriting its slots\n", pid);
+  __atomic_store_n(&ctrl->consumer, 0, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* publish the rest after the run and keep the buffers until a registered
+   consumer read the last chunk */
+
+void TrajStream::finish()
+{
+  if (!ctrl)
+    return;
+
+  for (size_t k = 0; k < pending.size(); k++)
+    mcl_wait(pending[k].hdl);
+  publish();
+  for (size_t k = 0; k < retired.size(); k++)
+    mcl_hdl_free(retired[k]);
+  retired.clear();
+  __atomic_store_n(&ctrl->done, 1, __ATOMIC_RELEASE);
+
+  while (seq && held((seq - 1) % TRAJ_SLOTS))
+    this_thread::sleep_for(chrono::milliseconds(1));
+
+  printf("# Trajectory stream: %i frames in %lu chunks, %i waited for the consumer\n", frames, (unsigned long) seq, waits);
+  for (int s = 0; s < TRAJ_SLOTS; s++)
+    if (slots[s])
+      mcl_free_shared_buffer(slots[s]);
+  mcl_free_shared_buffer(ctrl);
+  ctrl = NULL;
+}
@@ -0,0 +1,87 @@
+/* ----------------------------------------------------------------------
+   miniMD is a simple, parallel molecular dynamics (MD) code.   miniMD is
+   an MD microapplication in the Mantevo project at Sandia National 
+   Laboratories ( http://www.mantevo.org ). The primary 
+   authors of miniMD are Steve Plimpton (sjplimp@sandia.gov) , Paul Crozier 
+   (pscrozi@sandia.gov) and Christian Trott (crtrott@sandia.gov).
+
+   Copyright (2008) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This library is free software; you 
+   can redistribute it and/or modify it under the terms of the GNU Lesser 
+   General Public License as published by the Free Software Foundation; 
+   either version 3 of the License, or (at your option) any later 
+   version.
+  
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+   Lesser General Public License for more details.
+    
+   You should have received a copy of the GNU Lesser General Public 
+   License along with this software; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  See also: http://www.gnu.org/licenses/lgpl.txt .
+
+   For questions, contact Paul S. Crozier (pscrozi@sandia.gov) or
+   Christian Trott (crtrott@sandia.gov). 
+
+   Please read the accompanying README and LICENSE files.
+---------------------------------------------------------------------- */
+
+#ifndef TRAJ_STREAM_H
+#define TRAJ_STREAM_H
+
+#include <deque>
+#include <vector>
+#include "atom.h"
+#include "neighbor.h"
+#include "mcl_wrapper.h"
+#include "traj_ring.h"
+#include "precision.h"
+
+/* producer side of the --share trajectory stream, see traj_ring.h.
+   launch enqueues the traj_pack tasks of a frame behind integrate_final,
+   nothing blocks unless a registered consumer still holds the slot that
+   is about to be reused. Slots are published as their tasks complete,
+   checked without waiting at every frame and in finish */
+
+struct TrajChunk {
+  mcl_handle* hdl;
+  int slot;
+  uint64_t seq;
+};
+
+class TrajStream {
+ public:
+  int every;                       // one frame every this many steps, 0: off
+  int mode;                        // TRAJ_FLOAT, TRAJ_HALF or TRAJ_FIXED16
+  int frames;                      // frames launched
+  int waits;                       // slot reuses that had to wait for the consumer
+
+  TrajStream();
+  ~TrajStream();
+  void setup(MCLWrapper*, int partitions);
+  int due(int step) {return every > 0 && step % every == 0;};
+  mcl_handle** launch(int step, Atom[], Neighbor[], mcl_handle** after);
+  void finish();
+
+ private:
+  MCLWrapper* mcl;
+  int partitions;
+  TrajControl* ctrl;
+  std::vector<void*> slots;        // payload buffers, created on first use
+  std::vector<uint64_t> occupant;  // seq last written into each slot
+  std::deque<TrajChunk> pending;   // launched, not yet published, in seq order
+  std::vector<mcl_handle*> retired;// published, freed once no new task can depend on them
+  mcl_handle** last;               // per partition: last chunk task of the frame
+  uint64_t seq;
+
+  void publish();
+  void reserve(int slot);
+  int writing(int slot);
+  int held(int slot);
+  int consumer_alive();
+};
+
+#endif
@@ -30,4 +30,5 @@
 ---------------------------------------------------------------------- */
 
 #define VARIANT_MCL
+#define VARIANT_SSE                       // native CPU backend, see ThreadPool
 #define VARIANT_STRING "miniMD-MCL 0.1 (MCL)"